@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "histogram.h"
+
+
+#define CHART_WIDTH         500
+#define CHART_HEIGHT        500
+
+
+typedef enum
+{
+    CHART_FREQUENCY,        /* Share of replicas ending at each age */
+    CHART_HISTOGRAM,        /* The same, summed into auto ranged bars */
+} chart_enum_t;
+
+
+int chart_write(const histogram_t* bins, chart_enum_t chart, const char* title, const char* path);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "common.h"
+
+
+/*
+ * Checkpoints of modelling_simulate() are result files (result.h) whose
+ * completed count is short of iterations. Replica i always draws from Philox
+ * stream i of the seed, so the seed and the number of replicas done are all
+ * the random state there is to keep. The exact sums behind the mean and
+ * variance are saved with the counts. A checkpoint is only resumed by the
+ * same build with the same parameters, so the finished histogram is the one
+ * an uninterrupted run gives, statistics included.
+ */
+
+
+#define CHECKPOINT_SIMULATION           "checkpoint"
+#define CHECKPOINT_DEFAULT_INTERVAL     60.0        /* Seconds between checkpoints */
+
+
+int checkpoint_save(const char* path, const context_t* context, const histogram_t* bins, uint64_t completed);
+int checkpoint_load(const char* path, const context_t* context, histogram_t* bins, uint64_t* completed);
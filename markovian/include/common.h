@@ -2,29 +2,78 @@
 
 #include <stdint.h>
 
+#include "histogram.h"
+#include "models.h"
+#include "progress.h"
+
 
-#define MAX_NUM_BINS        1000
 #define DATA_DIR            "output"
 
 
-typedef uint16_t bin_t;
-typedef uint16_t timestep_t;
+typedef uint64_t timestep_t;
 
 
-typedef struct
+typedef enum
+{
+    PRECISION_NATIVE,
+    PRECISION_GMP,
+} precision_enum_t;
+
+
+typedef enum
 {
-    uint16_t size;
-    bin_t array[MAX_NUM_BINS];
-} bin_array_t;
+    SAMPLER_EVENTS,
+    SAMPLER_RUNS,
+} sampler_enum_t;
 
 
 typedef struct
 {
-    bin_array_t bins;
+    histogram_t bins;
     uint64_t iterations;
     double infection_rate;
     double recovery_rate;
+    double incubation_rate;
     uint32_t initial_susceptibles;
     uint32_t initial_infectives;
     uint32_t initial_removed;
+    model_enum_t model;
+    precision_enum_t precision;
+    sampler_enum_t sampler;
+    double tau_epsilon;
+    double time_bin_width;
+    const char* network_path;
+    uint32_t num_patches;
+    double coupling_rate;
+    double coupling_interval;
+    const char* coupling_path;
+    uint64_t seed;
+    uint32_t num_threads;
+    const char* checkpoint_path;
+    double checkpoint_interval;
+    progress_t* progress;
 } context_t;
+
+
+static inline void context_defaults(context_t* context)
+{
+    /* The GUI's starting parameters, which the headless drivers share. Seed 0 picks a new one per run */
+    *context = (context_t){.iterations=1000,
+                           .infection_rate=0.01,
+                           .recovery_rate=0.1,
+                           .incubation_rate=0.2,
+                           .initial_susceptibles=99,
+                           .initial_infectives=1,
+                           .initial_removed=0,
+                           .model=MODEL_SIR,
+                           .precision=PRECISION_NATIVE,
+                           .sampler=SAMPLER_RUNS,
+                           .tau_epsilon=0.03,
+                           .time_bin_width=1.0,
+                           .num_patches=100,
+                           .coupling_rate=0.01,
+                           .coupling_interval=1.0,
+                           .seed=0,
+                           .num_threads=1,
+                          };
+}
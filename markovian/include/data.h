@@ -5,9 +5,14 @@
 #include "modelling.h"
 
 
-void data_print_bin_array(bin_array_t bin_array);
-void data_save_data(bin_array_t bin_array, uint64_t iterations);
-void data_make_graph_script(void);
-void data_make_hist_script(void);
-void data_draw_graph(void);
-void data_draw_hist(void);
+/* Replicas saved as trajectories with the results, and the states kept of each */
+#define DATA_TRAJECTORIES           16
+#define DATA_TRAJECTORY_POINTS      4096
+
+
+/* Replays one replica of a run, as gillespie_trajectory() does */
+typedef uint64_t (*data_trajectory_t)(const context_t* context, uint64_t replica, uint64_t max_points, double* times, uint32_t* states);
+
+
+void data_save_data(const char* simulation, const context_t* context, const histogram_t* bins, data_trajectory_t trajectory);
+void data_save_patches(const histogram_t* durations, const histogram_t* final_sizes, uint32_t num_patches);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+
+/*
+ * Indexed binary min-heap of event times. Every item 0 .. size-1 is always in
+ * the heap, and its position is tracked so that its time can be changed in
+ * O(log n). Items that cannot happen have a time of INFINITY.
+ */
+typedef struct
+{
+    uint32_t    size;
+    uint32_t*   heap;           /* Items in heap order */
+    uint32_t*   position;       /* Index of each item in heap */
+    double*     time;           /* Time of each item */
+} event_heap_t;
+
+
+void event_heap_init(event_heap_t* heap, uint32_t size);
+void event_heap_free(event_heap_t* heap);
+void event_heap_set(event_heap_t* heap, uint32_t item, double time);
+void event_heap_build(event_heap_t* heap);
+void event_heap_reset(event_heap_t* heap);
+
+
+static inline uint32_t event_heap_top(const event_heap_t* heap)
+{
+    return heap->heap[0];
+}
+
+
+static inline double event_heap_time(const event_heap_t* heap, uint32_t item)
+{
+    return heap->time[item];
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "common.h"
+
+
+void exact_markovian_SIR(context_t* context, double* final_size_probability);
+void exact_simulate_markovian_SIR(context_t* context);
+void exact_simulate_model(context_t* context);
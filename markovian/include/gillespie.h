@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "common.h"
+
+
+void gillespie_simulate(context_t* context);
+void gillespie_next_reaction_simulate(context_t* context);
+
+/* Replays one replica, storing up to max_points times and states, and returns how many */
+uint64_t gillespie_trajectory(const context_t* context, uint64_t replica, uint64_t max_points, double* times, uint32_t* states);
+uint64_t gillespie_next_reaction_trajectory(const context_t* context, uint64_t replica, uint64_t max_points, double* times, uint32_t* states);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+
+/* Log buckets of the overflow sketch, enough for any uint64_t at 1% error */
+#define HISTOGRAM_SKETCH_BUCKETS    2304
+
+
+/* Wide enough that sums of squares of 64-bit values cannot wrap in practice */
+__extension__ typedef unsigned __int128 histogram_sum_t;
+
+
+typedef struct
+{
+    uint64_t*   counts;         /* counts[v] for every v < size */
+    uint64_t    size;           /* One past the largest value counted in range */
+    uint64_t    capacity;
+    uint64_t    limit;          /* Values at or above go to the overflow bucket */
+    uint64_t    overflow;
+    uint64_t    total;
+    uint64_t    censored;       /* Of overflow, still running at the limit, with no value */
+    double      bin_width;      /* Value of one bin, 1 unless counting real times */
+    double      mean;           /* Mean and sum of squared deviations */
+    double      m2;
+    int         exact;          /* Only whole bins added, mean and m2 follow from the sums */
+    histogram_sum_t sum;        /* Sums of the bins added and of their squares, while exact */
+    histogram_sum_t sum_squares;
+    uint64_t    sketch[HISTOGRAM_SKETCH_BUCKETS];
+} histogram_t;
+
+
+void histogram_init(histogram_t* histogram, uint64_t limit);
+void histogram_free(histogram_t* histogram);
+void histogram_reset(histogram_t* histogram);
+void histogram_copy(histogram_t* dst, const histogram_t* src);
+void histogram_set_limit(histogram_t* histogram, uint64_t limit);
+void histogram_add(histogram_t* histogram, uint64_t value, uint64_t count);
+void histogram_add_real(histogram_t* histogram, double value);
+uint64_t histogram_get(const histogram_t* histogram, uint64_t value);
+void histogram_merge(histogram_t* dst, const histogram_t* src);
+int histogram_equal(const histogram_t* a, const histogram_t* b);
+double histogram_variance(const histogram_t* histogram);
+uint64_t histogram_quantile(const histogram_t* histogram, double q);
+void histogram_print_stats(const histogram_t* histogram);
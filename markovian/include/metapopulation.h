@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "common.h"
+
+
+/* Patch state, one array per compartment so sweeps over patches vectorise */
+typedef struct
+{
+    uint32_t    num_patches;
+    uint32_t*   susceptibles;
+    uint32_t*   infectives;
+    uint32_t*   removed;
+    uint32_t*   infections;     /* Infections in the patch this replica */
+    double*     last_active;    /* When the patch last lost its final infective */
+    double*     coupling;       /* coupling[p * num_patches + q], rate of moving p to q */
+    double*     cumulative;     /* Running sums of each row of coupling */
+    double*     leaving;        /* Total rate of leaving each patch */
+} metapopulation_t;
+
+
+int metapopulation_init(metapopulation_t* metapopulation, const context_t* context);
+void metapopulation_free(metapopulation_t* metapopulation);
+void metapopulation_simulate(context_t* context);
@@ -8,3 +8,4 @@
 
 
 void modelling_simulate(context_t* context);
+void modelling_simulate_replicas(const context_t* context, uint64_t first, uint64_t last, histogram_t* bins);
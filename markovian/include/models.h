@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdint.h>
+
+
+/*
+ * Compartmental models are described once, as macro tables, and every engine
+ * expands the tables into code specialised for the model it runs. A model has
+ *
+ *     MODEL_<id>_COMPARTMENTS(X, P)    X(P, name) per compartment, in order
+ *     MODEL_<id>_TRANSITIONS(X, P)     X(P, name, rate, reads, stoichiometry...)
+ *     MODEL_<id>_ACTIVE                true while the epidemic is still running
+ *
+ * P is passed through untouched, so the expansions know which model they are
+ * in. Rates and the active condition are C expressions over the compartment
+ * names and the parameters beta, gamma and sigma. reads names the compartments
+ * a rate depends on, joined with |, so engines can tell which rates an event
+ * changes. Stoichiometry gives the change to each compartment, in order.
+ *
+ * In continuous time each susceptible is infected at rate beta and each
+ * infective recovers at rate gamma, which gives the embedded chain of the
+ * original SIR kernel. Infection needs at least one infective.
+ *
+ * A new model is a new table plus an entry in MODELS().
+ */
+
+
+#define MODEL_MAX_COMPARTMENTS      4
+#define MODEL_MAX_TRANSITIONS       4
+
+
+#define MODEL_SIR_COMPARTMENTS(X, P)    X(P, S) X(P, I) X(P, R)
+#define MODEL_SIR_TRANSITIONS(X, P)                                             \
+    X(P, infection,     beta * S,               S,          -1, +1,  0)         \
+    X(P, recovery,      gamma * I,              I,           0, -1, +1)
+#define MODEL_SIR_ACTIVE                (I > 0)
+
+
+#define MODEL_SIS_COMPARTMENTS(X, P)    X(P, S) X(P, I)
+#define MODEL_SIS_TRANSITIONS(X, P)                                             \
+    X(P, infection,     beta * S,               S,          -1, +1)             \
+    X(P, recovery,      gamma * I,              I,          +1, -1)
+#define MODEL_SIS_ACTIVE                (I > 0)
+
+
+#define MODEL_SEIR_COMPARTMENTS(X, P)   X(P, S) X(P, E) X(P, I) X(P, R)
+#define MODEL_SEIR_TRANSITIONS(X, P)                                            \
+    X(P, infection,     beta * S * (I > 0),     S | I,      -1, +1,  0,  0)     \
+    X(P, incubation,    sigma * E,              E,           0, -1, +1,  0)     \
+    X(P, recovery,      gamma * I,              I,           0,  0, -1, +1)
+#define MODEL_SEIR_ACTIVE               (E + I > 0)
+
+
+#define MODELS(X)       \
+    X(SIR)              \
+    X(SIS)              \
+    X(SEIR)
+
+
+/* Where each compartment starts, from the initial counts the GUI sets */
+#define MODEL_INITIAL_S(susceptibles, infectives, removed)     (susceptibles)
+#define MODEL_INITIAL_E(susceptibles, infectives, removed)     0
+#define MODEL_INITIAL_I(susceptibles, infectives, removed)     (infectives)
+#define MODEL_INITIAL_R(susceptibles, infectives, removed)     (removed)
+
+
+/* Helpers for expanding the tables, state is read from an array named x */
+#define MODEL_COUNT_ONE(...)                    + 1
+#define MODEL_NUM_COMPARTMENTS(id)              (0 MODEL_##id##_COMPARTMENTS(MODEL_COUNT_ONE, id))
+#define MODEL_NUM_TRANSITIONS(id)               (0 MODEL_##id##_TRANSITIONS(MODEL_COUNT_ONE, id))
+#define MODEL_LOAD_COMPARTMENT(P, name)         const double name = x[_model_k++]; (void)name;
+#define MODEL_RATE(P, name, rate, reads, ...)   (rate),
+#define MODEL_STOICHIOMETRY(P, name, rate, reads, ...)  { __VA_ARGS__ },
+#define MODEL_LOAD_PARAMS(params)                                                           \
+    const double beta = (params)->beta; (void)beta;                                         \
+    const double gamma = (params)->gamma; (void)gamma;                                      \
+    const double sigma = (params)->sigma; (void)sigma;
+#define MODEL_LOAD_STATE(id)                                                                \
+    uint32_t _model_k = 0;                                                                  \
+    MODEL_##id##_COMPARTMENTS(MODEL_LOAD_COMPARTMENT, id)                                   \
+    (void)_model_k;
+
+
+typedef enum
+{
+#define MODEL_ENUM(id)      MODEL_##id,
+    MODELS(MODEL_ENUM)
+#undef MODEL_ENUM
+    MODEL_COUNT,
+} model_enum_t;
+
+
+typedef struct
+{
+    double beta;
+    double gamma;
+    double sigma;
+} model_params_t;
+
+
+/* Run time view of a model, for engines that walk its state space */
+typedef struct
+{
+    const char*     name;
+    uint32_t        num_compartments;
+    uint32_t        num_transitions;
+    const char*     compartment_names[MODEL_MAX_COMPARTMENTS];
+    int8_t          stoichiometry[MODEL_MAX_TRANSITIONS][MODEL_MAX_COMPARTMENTS];
+    int             (*active)(const uint32_t* x);
+    double          (*rates)(const uint32_t* x, const model_params_t* params, double* rates);
+    void            (*reads)(uint32_t* reads);      /* Bit k set if the rate reads compartment k */
+    double          (*rate[MODEL_MAX_TRANSITIONS])(const uint32_t* x, const model_params_t* params);
+} model_t;
+
+
+extern const model_t models[MODEL_COUNT];
+
+
+void model_initial_state(model_enum_t model, uint32_t susceptibles, uint32_t infectives, uint32_t removed, uint32_t* x);
+int models_parse(const char* name, model_enum_t* model);
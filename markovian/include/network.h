@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "common.h"
+
+
+/* Undirected contact network in compressed sparse row form */
+typedef struct
+{
+    uint32_t    num_nodes;
+    uint64_t    num_edges;      /* Each undirected edge is stored twice */
+    uint64_t*   offsets;        /* Neighbours of u are neighbours[offsets[u] .. offsets[u + 1]) */
+    uint32_t*   neighbours;
+} network_t;
+
+
+int network_load(network_t* network, const char* path);
+void network_free(network_t* network);
+void network_simulate(context_t* context);
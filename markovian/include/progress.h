@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "histogram.h"
+
+
+/* Replicas an engine runs between handing its counts over */
+#define PROGRESS_CHUNK              256
+
+
+/*
+ * Shared between a running engine and whoever watches it. Engines add the
+ * replicas they finish, with their counts, and stop at the next replica once
+ * cancelled is set. At most once per interval, and only when the last call has
+ * been dealt with, notify() is called from the engine's thread so the watcher
+ * can pick the snapshot up on its own. Engines given no progress_t run as
+ * they always did.
+ */
+typedef struct
+{
+    uint64_t            completed;      /* Replicas finished, updated atomically */
+    int                 cancelled;      /* Set from any thread to stop the run */
+    pthread_mutex_t     lock;           /* Guards everything below */
+    histogram_t         snapshot;       /* Counts of the replicas handed over so far */
+    uint64_t            interval;       /* Nanoseconds between calls to notify() */
+    uint64_t            notified;       /* Monotonic time of the last call */
+    int                 pending;        /* notify() called and not yet dealt with */
+    void                (*notify)(void* data);
+    void*               data;
+} progress_t;
+
+
+void progress_init(progress_t* progress, uint64_t interval, void (*notify)(void* data), void* data);
+void progress_free(progress_t* progress);
+void progress_reset(progress_t* progress, uint64_t limit);
+void progress_add(progress_t* progress, const histogram_t* bins, uint64_t replicas);
+uint64_t progress_snapshot(progress_t* progress, histogram_t* bins);
+
+
+static inline int progress_cancelled(const progress_t* progress)
+{
+    return progress != NULL && __atomic_load_n(&progress->cancelled, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "common.h"
+
+
+/*
+ * Binary result files. A fixed header describes the run, followed by the raw
+ * histogram counts, the overflow sketch and any number of trajectory blocks:
+ *
+ *     result_header_t                  RESULT_HEADER_SIZE bytes
+ *     uint64_t counts[size]            at counts_offset
+ *     uint64_t sketch[sketch_buckets]  at sketch_offset
+ *     trajectory blocks                from trajectories_offset to the end
+ *
+ * A trajectory block is a result_trajectory_t, then num_points times as
+ * doubles, then num_points · num_compartments states as uint32_t, padded to
+ * 8 bytes. Every section starts on an 8 byte boundary, so a mapped file is
+ * read in place. Files are written in native byte order, which the reader
+ * checks.
+ *
+ * A shard (shard.h) holds the replicas from first_replica on, completed of
+ * them, in blocks of block_replicas.
+ */
+
+
+#define RESULT_MAGIC            "EPIDRSLT"
+#define RESULT_VERSION          1
+#define RESULT_BYTE_ORDER       0x01020304u
+#define RESULT_HEADER_SIZE      512
+
+
+typedef struct
+{
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    byte_order;
+    char        code_version[128];      /* GIT_VERSION of the program that ran, cut to fit */
+    char        simulation[32];         /* Engine, as listed in the GUI */
+    char        model[16];
+    uint32_t    model_id;
+    uint32_t    sampler;
+    uint32_t    precision;
+    uint32_t    num_patches;
+    uint32_t    initial_susceptibles;
+    uint32_t    initial_infectives;
+    uint32_t    initial_removed;
+    uint32_t    sketch_buckets;
+    double      infection_rate;
+    double      recovery_rate;
+    double      incubation_rate;
+    double      tau_epsilon;
+    double      coupling_rate;
+    double      coupling_interval;
+    uint64_t    seed;
+    uint64_t    iterations;
+    /* Histogram, as in histogram_t */
+    uint64_t    limit;
+    uint64_t    size;
+    uint64_t    overflow;
+    uint64_t    total;
+    double      bin_width;
+    double      mean;
+    double      m2;
+    /* Byte offsets from the start of the file */
+    uint64_t    counts_offset;
+    uint64_t    sketch_offset;
+    uint64_t    trajectories_offset;
+    uint64_t    num_trajectories;
+    /* Replicas counted here, short of iterations in a checkpoint or shard */
+    uint64_t    completed;
+    /* Shards only, zero otherwise */
+    uint64_t    first_replica;
+    uint64_t    block_replicas;
+    /* The histogram's exact sums, low word first, when exact is set */
+    uint64_t    exact;
+    uint64_t    sum[2];
+    uint64_t    sum_squares[2];
+    uint64_t    censored;               /* Of overflow, cut off at the limit with no value */
+    uint8_t     reserved[RESULT_HEADER_SIZE - 448];
+} result_header_t;
+
+
+typedef struct
+{
+    uint64_t    replica;
+    uint64_t    num_points;
+    uint32_t    num_compartments;
+    uint32_t    reserved;
+    uint64_t    block_size;             /* Bytes to the next block, header included */
+} result_trajectory_t;
+
+
+typedef struct
+{
+    FILE*               fp;
+    char*               path;
+    char*               temp_path;
+    result_header_t     header;
+} result_writer_t;
+
+
+typedef struct
+{
+    void*                   base;
+    size_t                  length;
+    const result_header_t*  header;
+    const uint64_t*         counts;
+    const uint64_t*         sketch;
+} result_map_t;
+
+
+int result_create(result_writer_t* writer, const char* path, const char* simulation, const context_t* context, const histogram_t* bins);
+int result_add_trajectory(result_writer_t* writer, uint64_t replica, uint32_t num_compartments, uint64_t num_points, const double* times, const uint32_t* states);
+int result_close(result_writer_t* writer);
+int result_save(const char* path, const char* simulation, const context_t* context, const histogram_t* bins);
+
+int result_map(result_map_t* map, const char* path);
+void result_unmap(result_map_t* map);
+void result_histogram(const result_map_t* map, histogram_t* view);
+const result_trajectory_t* result_next_trajectory(const result_map_t* map, const result_trajectory_t* trajectory);
+int result_export_text(const result_map_t* map, const char* path);
+
+
+static inline const double* result_trajectory_times(const result_trajectory_t* trajectory)
+{
+    return (const double*)(trajectory + 1);
+}
+
+
+static inline const uint32_t* result_trajectory_states(const result_trajectory_t* trajectory)
+{
+    return (const uint32_t*)(result_trajectory_times(trajectory) + trajectory->num_points);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "common.h"
+
+
+/*
+ * One iterations budget split across processes. The replicas are cut into
+ * blocks of SHARD_BLOCK_REPLICAS and shard k of n runs the k-th of n
+ * contiguous runs of blocks. Replica i draws from Philox stream i of the
+ * seed, as in modelling_simulate(), so shards never share a stream and a
+ * replica's outcome does not depend on which shard ran it.
+ *
+ * Each shard is saved as a result file (result.h). Its counts and the exact
+ * sums behind its mean and variance add up in any order, so the merged file
+ * is the same byte for byte however the budget was split, and holds the
+ * histogram of the whole run made in one go.
+ */
+
+
+#define SHARD_SIMULATION        "shard"
+#define SHARD_BLOCK_REPLICAS    4096
+
+
+int shard_simulate(context_t* context, uint32_t shard, uint32_t num_shards, const char* path);
+int shard_merge(const char* path, const char* const* shard_paths, uint32_t num_shards);
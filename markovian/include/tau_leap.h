@@ -0,0 +1,6 @@
+#pragma once
+
+#include "common.h"
+
+
+void tau_leap_simulate(context_t* context);
@@ -0,0 +1,668 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "modelling.h"
+#include "rng.h"
+#include "instrument.h"
+#ifdef HAVE_CAIRO
+#include "chart.h"
+#endif
+
+
+/*
+ * Headless parameter sweeps of the Markovian models.
+ *
+ *     build/batch <spec> [threads]
+ *
+ * The spec has one "key = value" per line, # starts a comment:
+ *
+ *     sweep = grid                     grid or lhs
+ *     points = 100                     lhs only
+ *     infection_rate = 0.005 0.02 4    min max count for a grid (count 2 if left
+ *                                      out), min max for lhs
+ *     recovery_rate = 0.1              a single value is fixed
+ *     initial_infectives = 1 10 10
+ *     iterations = 10000
+ *     model = SIR                      SIR, SIS or SEIR
+ *     sampler = runs                   runs or events
+ *     limit = 1000                     histogram limit
+ *     seed = 1
+ *     output = sweep.tsv               stdout if not given
+ *     charts = plots                   directory for per point charts, needs
+ *                                      batch built with cairo
+ *     chart_format = png               png or svg
+ *
+ * The swept parameters are infection_rate, recovery_rate, incubation_rate,
+ * initial_susceptibles, initial_infectives, initial_removed and iterations.
+ * A grid is every combination of the listed values. A Latin hypercube
+ * splits each range into as many strata as points and visits each stratum
+ * once, in an independent random order per parameter.
+ *
+ * Every point runs on the same seed, so points differ by their parameters
+ * rather than their noise, and each point's histogram matches the GUI's for
+ * that seed. The work is split into (point, chunk of replicas) tasks, dealt
+ * out to per-thread deques in blocks and stolen by idle threads. Results are
+ * written one tab separated line per point, in point order, as each point
+ * completes.
+ *
+ * A sweep does not checkpoint. A stopped one starts again from the first
+ * point; trim the spec to the points missing from the output to carry on.
+ */
+
+
+#define BATCH_REPLICA_CHUNK         1024
+#define BATCH_MAX_LINE              1024
+#define BATCH_DEFAULT_LIMIT         1000
+
+
+typedef enum
+{
+    BATCH_SWEEP_GRID,
+    BATCH_SWEEP_LHS,
+} batch_sweep_enum_t;
+
+
+/* Context fields that can be swept, and whether they hold counts */
+#define BATCH_PARAMETERS(X)                 \
+    X(infection_rate,          0)           \
+    X(recovery_rate,           0)           \
+    X(incubation_rate,         0)           \
+    X(initial_susceptibles,    1)           \
+    X(initial_infectives,      1)           \
+    X(initial_removed,         1)           \
+    X(iterations,              1)
+
+
+typedef enum
+{
+#define BATCH_PARAMETER_ENUM(name, integer)     BATCH_PARAMETER_##name,
+    BATCH_PARAMETERS(BATCH_PARAMETER_ENUM)
+#undef BATCH_PARAMETER_ENUM
+    BATCH_PARAMETER_COUNT,
+} batch_parameter_enum_t;
+
+
+typedef struct
+{
+    const char*     name;
+    int             integer;
+    int             swept;
+    double          min;
+    double          max;
+    uint32_t        count;          /* Grid values, 1 when fixed */
+} batch_parameter_t;
+
+
+typedef struct
+{
+    batch_sweep_enum_t  sweep;
+    uint32_t            lhs_points;
+    batch_parameter_t   parameters[BATCH_PARAMETER_COUNT];
+    context_t           defaults;
+    const char*         output_path;
+    char                output_buffer[BATCH_MAX_LINE];
+    const char*         charts_path;
+    char                charts_buffer[BATCH_MAX_LINE];
+    const char*         chart_format;
+} batch_spec_t;
+
+
+typedef struct
+{
+    context_t           context;
+    pthread_mutex_t     lock;
+    uint64_t            chunks_left;
+} batch_point_t;
+
+
+typedef struct
+{
+    uint32_t    point;
+    uint64_t    chunk;
+} batch_task_t;
+
+
+/*
+ * The tasks a worker still owns are tasks[top .. bottom), packed into one
+ * word so that the owner taking from the bottom and thieves taking from the
+ * top agree with a single compare and swap.
+ */
+typedef struct
+{
+    uint64_t    range;
+    char        padding[56];        /* Keeps deques on separate cache lines */
+} batch_deque_t;
+
+
+typedef struct
+{
+    batch_spec_t*       spec;
+    batch_point_t*      points;
+    uint32_t            num_points;
+    batch_task_t*       tasks;
+    batch_deque_t*      deques;
+    uint32_t            num_threads;
+    FILE*               output;
+    pthread_mutex_t     output_lock;
+    uint8_t*            done;
+    uint32_t            next_output;
+} batch_t;
+
+
+typedef struct
+{
+    batch_t*    batch;
+    uint32_t    id;
+} batch_worker_t;
+
+
+static char* _batch_trim(char* text)
+{
+    while (*text == ' ' || *text == '\t')
+    {
+        text++;
+    }
+    char* end = text + strlen(text);
+    while (end > text && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r'))
+    {
+        *--end = '\0';
+    }
+    return text;
+}
+
+
+static int _batch_parse_line(batch_spec_t* spec, const char* key, char* value)
+{
+    for (uint32_t p = 0; p < BATCH_PARAMETER_COUNT; p++)
+    {
+        batch_parameter_t* parameter = &spec->parameters[p];
+        if (strcmp(key, parameter->name) != 0)
+            continue;
+        double count = 2.0;
+        int found = sscanf(value, "%lf %lf %lf", &parameter->min, &parameter->max, &count);
+        if (found < 1 || count < 1.0)
+            return -1;
+        if (found == 1)
+            parameter->max = parameter->min;
+        parameter->swept = found > 1;
+        parameter->count = (uint32_t)count;
+        return parameter->min <= parameter->max && parameter->min >= 0.0 ? 0 : -1;
+    }
+
+    if (strcmp(key, "sweep") == 0)
+    {
+        if (strcmp(value, "grid") == 0)
+            spec->sweep = BATCH_SWEEP_GRID;
+        else if (strcmp(value, "lhs") == 0)
+            spec->sweep = BATCH_SWEEP_LHS;
+        else
+            return -1;
+        return 0;
+    }
+    if (strcmp(key, "points") == 0)
+        return sscanf(value, "%u", &spec->lhs_points) == 1 && spec->lhs_points > 0 ? 0 : -1;
+    if (strcmp(key, "model") == 0)
+        return models_parse(value, &spec->defaults.model);
+    if (strcmp(key, "sampler") == 0)
+    {
+        if (strcmp(value, "runs") == 0)
+            spec->defaults.sampler = SAMPLER_RUNS;
+        else if (strcmp(value, "events") == 0)
+            spec->defaults.sampler = SAMPLER_EVENTS;
+        else
+            return -1;
+        return 0;
+    }
+    if (strcmp(key, "limit") == 0)
+        return sscanf(value, "%" SCNu64, &spec->defaults.bins.limit) == 1 && spec->defaults.bins.limit > 0 ? 0 : -1;
+    if (strcmp(key, "seed") == 0)
+        return sscanf(value, "%" SCNu64, &spec->defaults.seed) == 1 ? 0 : -1;
+    if (strcmp(key, "output") == 0)
+    {
+        snprintf(spec->output_buffer, sizeof(spec->output_buffer), "%s", value);
+        spec->output_path = spec->output_buffer;
+        return 0;
+    }
+    if (strcmp(key, "charts") == 0)
+    {
+#ifndef HAVE_CAIRO
+        printf("Charts need cairo, and batch was built without it.\n");
+        return -1;
+#endif
+        snprintf(spec->charts_buffer, sizeof(spec->charts_buffer), "%s", value);
+        spec->charts_path = spec->charts_buffer;
+        return 0;
+    }
+    if (strcmp(key, "chart_format") == 0)
+    {
+        if (strcmp(value, "png") == 0)
+            spec->chart_format = "png";
+        else if (strcmp(value, "svg") == 0)
+            spec->chart_format = "svg";
+        else
+            return -1;
+        return 0;
+    }
+    return -1;
+}
+
+
+static int _batch_load_spec(batch_spec_t* spec, const char* path)
+{
+    memset(spec, 0, sizeof(batch_spec_t));
+#define BATCH_PARAMETER_INIT(field, is_integer)                                             \
+    spec->parameters[BATCH_PARAMETER_##field].name = #field;                                \
+    spec->parameters[BATCH_PARAMETER_##field].integer = is_integer;                         \
+    spec->parameters[BATCH_PARAMETER_##field].count = 1;
+    BATCH_PARAMETERS(BATCH_PARAMETER_INIT)
+#undef BATCH_PARAMETER_INIT
+
+    /* Unswept parameters keep the GUI's values */
+    context_defaults(&spec->defaults);
+    spec->defaults.bins.limit = BATCH_DEFAULT_LIMIT;
+    spec->defaults.seed = 1;
+#define BATCH_PARAMETER_DEFAULT(field, is_integer)                                          \
+    spec->parameters[BATCH_PARAMETER_##field].min = spec->defaults.field;                   \
+    spec->parameters[BATCH_PARAMETER_##field].max = spec->defaults.field;
+    BATCH_PARAMETERS(BATCH_PARAMETER_DEFAULT)
+#undef BATCH_PARAMETER_DEFAULT
+    spec->sweep = BATCH_SWEEP_GRID;
+    spec->lhs_points = 1;
+    spec->chart_format = "png";
+
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        printf("Cannot open sweep spec %s.\n", path);
+        return -1;
+    }
+    char line[BATCH_MAX_LINE];
+    uint32_t number = 0;
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        number++;
+        char* comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+        char* key = _batch_trim(line);
+        if (*key == '\0')
+            continue;
+        char* equals = strchr(key, '=');
+        if (equals == NULL)
+        {
+            printf("%s:%u: expected key = value.\n", path, number);
+            fclose(fp);
+            return -1;
+        }
+        *equals = '\0';
+        key = _batch_trim(key);
+        char* value = _batch_trim(equals + 1);
+        if (_batch_parse_line(spec, key, value) != 0)
+        {
+            printf("%s:%u: bad value for %s.\n", path, number, key);
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+
+static void _batch_set_parameter(const batch_spec_t* spec, context_t* context, uint32_t p, double value)
+{
+    if (spec->parameters[p].integer)
+        value = floor(value + 0.5);
+    switch ((batch_parameter_enum_t)p)
+    {
+#define BATCH_PARAMETER_SET(name, integer)                                                  \
+        case BATCH_PARAMETER_##name:                                                        \
+            context->name = value;                                                          \
+            break;
+        BATCH_PARAMETERS(BATCH_PARAMETER_SET)
+#undef BATCH_PARAMETER_SET
+        default:
+            break;
+    }
+}
+
+
+static uint32_t _batch_make_points(const batch_spec_t* spec, batch_point_t** points)
+{
+    uint64_t num_points = 1;
+    if (spec->sweep == BATCH_SWEEP_LHS)
+    {
+        num_points = spec->lhs_points;
+    }
+    else
+    {
+        for (uint32_t p = 0; p < BATCH_PARAMETER_COUNT; p++)
+        {
+            num_points *= spec->parameters[p].swept ? spec->parameters[p].count : 1;
+        }
+    }
+    if (num_points > UINT32_MAX)
+    {
+        printf("Sweep of %" PRIu64 " points is too large.\n", num_points);
+        exit(-1);
+    }
+
+    *points = (batch_point_t*)calloc(num_points, sizeof(batch_point_t));
+    uint32_t* strata = (uint32_t*)malloc(num_points * sizeof(uint32_t));
+    if (*points == NULL || strata == NULL)
+    {
+        printf("Failed to allocate %" PRIu64 " sweep points.\n", num_points);
+        exit(-1);
+    }
+    for (uint64_t i = 0; i < num_points; i++)
+    {
+        (*points)[i].context = spec->defaults;
+    }
+
+    rng_t rng;
+    rng_seed(&rng, spec->defaults.seed);
+    uint64_t stride = 1;
+    for (uint32_t p = 0; p < BATCH_PARAMETER_COUNT; p++)
+    {
+        const batch_parameter_t* parameter = &spec->parameters[p];
+        if (!parameter->swept)
+        {
+            for (uint64_t i = 0; i < num_points; i++)
+            {
+                _batch_set_parameter(spec, &(*points)[i].context, p, parameter->min);
+            }
+            continue;
+        }
+
+        double range = parameter->max - parameter->min;
+        if (spec->sweep == BATCH_SWEEP_LHS)
+        {
+            /* A random permutation of the strata, one uniform point in each */
+            for (uint64_t i = 0; i < num_points; i++)
+            {
+                strata[i] = (uint32_t)i;
+            }
+            for (uint64_t i = num_points - 1; i > 0; i--)
+            {
+                uint64_t j = rng_bounded(&rng, i + 1);
+                uint32_t swap = strata[i];
+                strata[i] = strata[j];
+                strata[j] = swap;
+            }
+            for (uint64_t i = 0; i < num_points; i++)
+            {
+                double u = (strata[i] + rng_uniform(&rng)) / num_points;
+                _batch_set_parameter(spec, &(*points)[i].context, p, parameter->min + u * range);
+            }
+        }
+        else
+        {
+            /* The first swept parameter varies slowest */
+            for (uint64_t i = 0; i < num_points; i++)
+            {
+                uint32_t k = (uint32_t)(i / (num_points / stride / parameter->count) % parameter->count);
+                double u = parameter->count > 1 ? (double)k / (parameter->count - 1) : 0.0;
+                _batch_set_parameter(spec, &(*points)[i].context, p, parameter->min + u * range);
+            }
+            stride *= parameter->count;
+        }
+    }
+    free(strata);
+    return (uint32_t)num_points;
+}
+
+
+static int _batch_take(batch_deque_t* deque, int steal, uint64_t* task)
+{
+    uint64_t range = __atomic_load_n(&deque->range, __ATOMIC_ACQUIRE);
+    for (;;)
+    {
+        uint32_t top = (uint32_t)(range >> 32);
+        uint32_t bottom = (uint32_t)range;
+        if (top >= bottom)
+            return 0;
+        uint64_t taken = steal ? (uint64_t)(top + 1) << 32 | bottom : (uint64_t)top << 32 | (bottom - 1);
+        if (__atomic_compare_exchange_n(&deque->range, &range, taken, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            *task = steal ? top : bottom - 1;
+            return 1;
+        }
+    }
+}
+
+
+static void _batch_write_record(batch_t* batch, uint32_t index)
+{
+    const context_t* context = &batch->points[index].context;
+    const histogram_t* bins = &context->bins;
+    int written = fprintf(batch->output,
+            "%u\t%s\t%g\t%g\t%g\t%u\t%u\t%u\t%" PRIu64 "\t%" PRIu64 "\t%f\t%f\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n",
+            index, models[context->model].name,
+            context->infection_rate, context->recovery_rate, context->incubation_rate,
+            context->initial_susceptibles, context->initial_infectives, context->initial_removed,
+            context->iterations, context->seed,
+            bins->mean, sqrt(histogram_variance(bins)),
+            histogram_quantile(bins, 0.5), histogram_quantile(bins, 0.99), bins->overflow);
+    INSTRUMENT_COUNT(BYTES_WRITTEN, written > 0 ? written : 0);
+}
+
+
+static void _batch_write_charts(batch_t* batch, uint32_t index)
+{
+#ifdef HAVE_CAIRO
+    const batch_spec_t* spec = batch->spec;
+    if (spec->charts_path == NULL)
+        return;
+    const context_t* context = &batch->points[index].context;
+    char title[64];
+    char path[BATCH_MAX_LINE + 32];
+    snprintf(title, sizeof(title), "%s, point %u", models[context->model].name, index);
+    snprintf(path, sizeof(path), "%s/point%u_graph.%s", spec->charts_path, index, spec->chart_format);
+    chart_write(&context->bins, CHART_FREQUENCY, title, path);
+    snprintf(path, sizeof(path), "%s/point%u_hist.%s", spec->charts_path, index, spec->chart_format);
+    chart_write(&context->bins, CHART_HISTOGRAM, title, path);
+#endif
+}
+
+
+static void _batch_complete(batch_t* batch, uint32_t index)
+{
+    /* Charts are drawn by the thread that finished the point, outside the lock */
+    _batch_write_charts(batch, index);
+
+    /* Records go out in point order, as soon as every earlier point is done */
+    pthread_mutex_lock(&batch->output_lock);
+    batch->done[index] = 1;
+    while (batch->next_output < batch->num_points && batch->done[batch->next_output])
+    {
+        _batch_write_record(batch, batch->next_output);
+        histogram_free(&batch->points[batch->next_output].context.bins);
+        batch->next_output++;
+    }
+    fflush(batch->output);
+    pthread_mutex_unlock(&batch->output_lock);
+}
+
+
+static void _batch_run_task(batch_t* batch, const batch_task_t* task, histogram_t* bins)
+{
+    batch_point_t* point = &batch->points[task->point];
+    const context_t* context = &point->context;
+    uint64_t first = task->chunk * BATCH_REPLICA_CHUNK;
+    uint64_t last = first + BATCH_REPLICA_CHUNK < context->iterations ? first + BATCH_REPLICA_CHUNK : context->iterations;
+
+    histogram_reset(bins);
+    modelling_simulate_replicas(context, first, last, bins);
+
+    pthread_mutex_lock(&point->lock);
+    histogram_merge(&point->context.bins, bins);
+    uint64_t chunks_left = --point->chunks_left;
+    pthread_mutex_unlock(&point->lock);
+    if (chunks_left == 0)
+        _batch_complete(batch, task->point);
+}
+
+
+static void* _batch_worker(void* arg)
+{
+    batch_worker_t* worker = (batch_worker_t*)arg;
+    batch_t* batch = worker->batch;
+    histogram_t bins;
+    histogram_init(&bins, batch->spec->defaults.bins.limit);
+
+    /* Own tasks first, then steal from the others in turn until all are empty */
+    uint64_t task;
+    for (;;)
+    {
+        if (_batch_take(&batch->deques[worker->id], 0, &task))
+        {
+            _batch_run_task(batch, &batch->tasks[task], &bins);
+            continue;
+        }
+        int stolen = 0;
+        for (uint32_t k = 1; k < batch->num_threads && !stolen; k++)
+        {
+            stolen = _batch_take(&batch->deques[(worker->id + k) % batch->num_threads], 1, &task);
+        }
+        if (!stolen)
+            break;
+        _batch_run_task(batch, &batch->tasks[task], &bins);
+    }
+
+    histogram_free(&bins);
+    return NULL;
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <sweep spec> [threads]\n", argv[0]);
+        printf("Sweeps do not checkpoint, a stopped one starts again from the first point.\n");
+        return -1;
+    }
+
+    INSTRUMENT_START(NULL);
+
+    batch_spec_t spec;
+    if (_batch_load_spec(&spec, argv[1]) != 0)
+        return -1;
+
+    batch_t batch;
+    memset(&batch, 0, sizeof(batch_t));
+    batch.spec = &spec;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    batch.num_threads = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : cpus > 0 ? (uint32_t)cpus : 1;
+    if (batch.num_threads == 0)
+        batch.num_threads = 1;
+    batch.num_points = _batch_make_points(&spec, &batch.points);
+
+    /* Tasks in point order, split into one contiguous block per thread */
+    uint64_t num_tasks = 0;
+    for (uint32_t i = 0; i < batch.num_points; i++)
+    {
+        batch_point_t* point = &batch.points[i];
+        point->chunks_left = (point->context.iterations + BATCH_REPLICA_CHUNK - 1) / BATCH_REPLICA_CHUNK;
+        num_tasks += point->chunks_left;
+        histogram_init(&point->context.bins, spec.defaults.bins.limit);
+        pthread_mutex_init(&point->lock, NULL);
+    }
+    if (num_tasks > UINT32_MAX)
+    {
+        printf("Sweep of %" PRIu64 " tasks is too large.\n", num_tasks);
+        return -1;
+    }
+    batch.tasks = (batch_task_t*)malloc((num_tasks ? num_tasks : 1) * sizeof(batch_task_t));
+    batch.deques = (batch_deque_t*)calloc(batch.num_threads, sizeof(batch_deque_t));
+    batch.done = (uint8_t*)calloc(batch.num_points ? batch.num_points : 1, sizeof(uint8_t));
+    if (batch.tasks == NULL || batch.deques == NULL || batch.done == NULL)
+    {
+        printf("Failed to allocate %" PRIu64 " tasks.\n", num_tasks);
+        return -1;
+    }
+    uint64_t t = 0;
+    for (uint32_t i = 0; i < batch.num_points; i++)
+    {
+        for (uint64_t c = 0; c < batch.points[i].chunks_left; c++)
+        {
+            batch.tasks[t].point = i;
+            batch.tasks[t].chunk = c;
+            t++;
+        }
+    }
+    for (uint32_t w = 0; w < batch.num_threads; w++)
+    {
+        uint64_t top = num_tasks * w / batch.num_threads;
+        uint64_t bottom = num_tasks * (w + 1) / batch.num_threads;
+        batch.deques[w].range = top << 32 | bottom;
+    }
+
+    batch.output = stdout;
+    if (spec.output_path != NULL)
+    {
+        batch.output = fopen(spec.output_path, "w");
+        if (batch.output == NULL)
+        {
+            printf("Cannot open output %s.\n", spec.output_path);
+            return -1;
+        }
+    }
+    fprintf(batch.output, "point\tmodel\tinfection_rate\trecovery_rate\tincubation_rate\t"
+                          "initial_susceptibles\tinitial_infectives\tinitial_removed\titerations\tseed\t"
+                          "mean\tsd\tp50\tp99\toverflow\n");
+    pthread_mutex_init(&batch.output_lock, NULL);
+
+    /* Points with no replicas are complete already */
+    for (uint32_t i = 0; i < batch.num_points; i++)
+    {
+        if (batch.points[i].chunks_left == 0)
+            _batch_complete(&batch, i);
+    }
+
+    INSTRUMENT_PHASE_BEGIN(SIMULATE);
+    batch_worker_t* workers = (batch_worker_t*)calloc(batch.num_threads, sizeof(batch_worker_t));
+    pthread_t* threads = (pthread_t*)malloc(batch.num_threads * sizeof(pthread_t));
+    for (uint32_t w = 0; w < batch.num_threads; w++)
+    {
+        workers[w].batch = &batch;
+        workers[w].id = w;
+    }
+    for (uint32_t w = 1; w < batch.num_threads; w++)
+    {
+        if (pthread_create(&threads[w], NULL, _batch_worker, &workers[w]) != 0)
+        {
+            printf("Failed to start worker thread %u.\n", w);
+            exit(-1);
+        }
+    }
+    /* The calling thread is worker 0 */
+    _batch_worker(&workers[0]);
+    for (uint32_t w = 1; w < batch.num_threads; w++)
+    {
+        pthread_join(threads[w], NULL);
+    }
+    INSTRUMENT_PHASE_END(SIMULATE);
+
+    if (batch.output != stdout)
+        fclose(batch.output);
+    for (uint32_t i = 0; i < batch.num_points; i++)
+    {
+        pthread_mutex_destroy(&batch.points[i].lock);
+    }
+    pthread_mutex_destroy(&batch.output_lock);
+    free(batch.points);
+    free(batch.tasks);
+    free(batch.deques);
+    free(batch.done);
+    free(workers);
+    free(threads);
+    return 0;
+}
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "common.h"
+#include "modelling.h"
+#include "gillespie.h"
+#include "progress.h"
+#include "result.h"
+#include "bench.h"
+
+
+#define BENCH_ITERATIONS    20000
+#define BENCH_SEED          1
+#define BENCH_MAX_BINS      1000
+#define BENCH_TIME_BIN      0.1     /* Gillespie horizon of 100 time units, so SIS stays quick */
+#define BENCH_AGREEMENT     5.0     /* Standard errors the two Gillespie methods may differ by */
+
+/* Interrupted and resumed run, removed again once compared */
+#define BENCH_CHECKPOINT_PATH       "bench_resume.ckpt"
+#define BENCH_CHECKPOINT_INTERVAL   0.001
+#define BENCH_RESUMED_PATH          "bench_resumed.result"
+#define BENCH_WHOLE_PATH            "bench_whole.result"
+
+
+typedef struct
+{
+    const char*         name;
+    model_enum_t        model;
+    precision_enum_t    precision;
+    sampler_enum_t      sampler;
+    histogram_t         bins;
+    uint64_t            events;
+    double              seconds;
+} bench_kernel_t;
+
+
+static void _bench_run(context_t* context, bench_kernel_t* kernel)
+{
+    context->model = kernel->model;
+    context->precision = kernel->precision;
+    context->sampler = kernel->sampler;
+
+    double begin = bench_now();
+    modelling_simulate(context);
+    kernel->seconds = bench_now() - begin;
+
+    /* Every replica takes age events to die out, or limit if it never does */
+    histogram_init(&kernel->bins, context->bins.limit);
+    histogram_merge(&kernel->bins, &context->bins);
+    kernel->events = context->bins.overflow * context->bins.limit;
+    for (uint64_t i = 0; i < context->bins.size; i++)
+    {
+        kernel->events += i * context->bins.counts[i];
+    }
+}
+
+
+static double _bench_gillespie(context_t* context, model_enum_t model, void (*simulate)(context_t*), histogram_t* bins)
+{
+    context->model = model;
+    context->time_bin_width = BENCH_TIME_BIN;
+
+    double begin = bench_now();
+    simulate(context);
+    double seconds = bench_now() - begin;
+
+    histogram_init(bins, context->bins.limit);
+    histogram_merge(bins, &context->bins);
+    return seconds;
+}
+
+
+static int _bench_agree(const histogram_t* a, const histogram_t* b)
+{
+    /* The direct and next reaction methods draw differently, so compare the
+     * share of censored replicas and the mean duration of the rest within
+     * BENCH_AGREEMENT standard errors */
+    double pa = (double)a->censored / a->total;
+    double pb = (double)b->censored / b->total;
+    double p = (double)(a->censored + b->censored) / (a->total + b->total);
+    double share_error = sqrt(p * (1.0 - p) * (1.0 / a->total + 1.0 / b->total));
+    if (fabs(pa - pb) > BENCH_AGREEMENT * share_error)
+        return 0;
+    uint64_t na = a->total - a->censored;
+    uint64_t nb = b->total - b->censored;
+    if (na == 0 || nb == 0)
+        return na == nb;
+    double mean_error = sqrt(histogram_variance(a) / na + histogram_variance(b) / nb);
+    return fabs(a->mean - b->mean) <= BENCH_AGREEMENT * mean_error;
+}
+
+
+typedef struct
+{
+    progress_t          progress;
+    uint64_t            stop;           /* Replicas after which the run is cancelled */
+    histogram_t         snapshot;
+} bench_interrupt_t;
+
+
+static void _bench_interrupt(void* data)
+{
+    /* Cancels the run part way, as the GUI's Cancel does */
+    bench_interrupt_t* interrupt = (bench_interrupt_t*)data;
+    if (__atomic_load_n(&interrupt->progress.completed, __ATOMIC_RELAXED) >= interrupt->stop)
+        __atomic_store_n(&interrupt->progress.cancelled, 1, __ATOMIC_RELAXED);
+    else
+        progress_snapshot(&interrupt->progress, &interrupt->snapshot);
+}
+
+
+static int _bench_same_file(const char* a, const char* b)
+{
+    FILE* fa = fopen(a, "rb");
+    FILE* fb = fopen(b, "rb");
+    int same = fa != NULL && fb != NULL;
+    while (same)
+    {
+        int ca = fgetc(fa);
+        int cb = fgetc(fb);
+        same = ca == cb;
+        if (ca == EOF)
+            break;
+    }
+    if (fa != NULL)
+        fclose(fa);
+    if (fb != NULL)
+        fclose(fb);
+    return same;
+}
+
+
+static int _bench_resume(context_t* context)
+{
+    /* A run cancelled half way and resumed from its checkpoint must save the same file as one never stopped */
+    context->model = MODEL_SIR;
+    context->precision = PRECISION_NATIVE;
+    context->sampler = SAMPLER_EVENTS;
+    context->checkpoint_path = NULL;
+    modelling_simulate(context);
+    int saved = result_save(BENCH_WHOLE_PATH, "Markovian SIR", context, &context->bins) == 0;
+
+    bench_interrupt_t interrupt;
+    progress_init(&interrupt.progress, 0, _bench_interrupt, &interrupt);
+    progress_reset(&interrupt.progress, context->bins.limit);
+    histogram_init(&interrupt.snapshot, context->bins.limit);
+    interrupt.stop = context->iterations / 2;
+    unlink(BENCH_CHECKPOINT_PATH);
+    context->checkpoint_path = BENCH_CHECKPOINT_PATH;
+    context->checkpoint_interval = BENCH_CHECKPOINT_INTERVAL;
+    context->progress = &interrupt.progress;
+    modelling_simulate(context);
+    uint64_t stopped = interrupt.progress.completed;
+    context->progress = NULL;
+    modelling_simulate(context);
+    saved = saved && result_save(BENCH_RESUMED_PATH, "Markovian SIR", context, &context->bins) == 0;
+    context->checkpoint_path = NULL;
+
+    int same = saved && _bench_same_file(BENCH_WHOLE_PATH, BENCH_RESUMED_PATH);
+    printf("Interrupted at %" PRIu64 " of %" PRIu64 " replicas, resumed result %s\n",
+           stopped, context->iterations, same ? "matches" : "DIFFERS");
+    unlink(BENCH_CHECKPOINT_PATH);
+    unlink(BENCH_WHOLE_PATH);
+    unlink(BENCH_RESUMED_PATH);
+    histogram_free(&interrupt.snapshot);
+    progress_free(&interrupt.progress);
+    return same;
+}
+
+
+static void _bench_usage(const char* prog)
+{
+    printf("Usage: %s [-o results.tsv] [-b baseline.tsv] [-t tolerance] [iterations] [threads]\n", prog);
+}
+
+
+int main(int argc, char** argv)
+{
+    const char* output_path = NULL;
+    const char* baseline_path = NULL;
+    double tolerance = BENCH_TOLERANCE;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:b:t:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'b':
+                baseline_path = optarg;
+                break;
+            case 't':
+                tolerance = atof(optarg);
+                break;
+            default:
+                _bench_usage(argv[0]);
+                return opt == 'h' ? 0 : -1;
+        }
+    }
+
+    context_t context;
+    context_defaults(&context);
+    context.iterations = BENCH_ITERATIONS;
+    context.seed = BENCH_SEED;
+    histogram_init(&context.bins, BENCH_MAX_BINS);
+    if (optind < argc)
+        context.iterations = strtoull(argv[optind], NULL, 10);
+    if (optind + 1 < argc)
+        context.num_threads = strtoul(argv[optind + 1], NULL, 10);
+
+    bench_kernel_t kernels[] = {
+        { .name="native", .model=MODEL_SIR,  .precision=PRECISION_NATIVE, .sampler=SAMPLER_EVENTS },
+        { .name="gmp",    .model=MODEL_SIR,  .precision=PRECISION_GMP,    .sampler=SAMPLER_EVENTS },
+        { .name="runs",   .model=MODEL_SIR,  .precision=PRECISION_NATIVE, .sampler=SAMPLER_RUNS   },
+        { .name="sis",    .model=MODEL_SIS,  .precision=PRECISION_NATIVE, .sampler=SAMPLER_EVENTS },
+        { .name="seir",   .model=MODEL_SEIR, .precision=PRECISION_NATIVE, .sampler=SAMPLER_EVENTS },
+    };
+    unsigned num_kernels = sizeof(kernels) / sizeof(kernels[0]);
+
+    for (unsigned i = 0; i < num_kernels; i++)
+    {
+        _bench_run(&context, &kernels[i]);
+    }
+
+    printf("%-8s %12s %10s %14s %12s\n", "kernel", "events", "seconds", "events/s", "replicas/s");
+    for (unsigned i = 0; i < num_kernels; i++)
+    {
+        printf("%-8s %12"PRIu64" %10.3f %14.0f %12.0f\n",
+               kernels[i].name,
+               kernels[i].events,
+               kernels[i].seconds,
+               kernels[i].events / kernels[i].seconds,
+               context.iterations / kernels[i].seconds);
+    }
+    printf("Speedup: %.1fx\n", kernels[1].seconds / kernels[0].seconds);
+    printf("Run skipping speedup: %.1fx\n", kernels[0].seconds / kernels[2].seconds);
+
+    /* Both event kernels see the same uniforms, so the histograms must agree */
+    int match = histogram_equal(&kernels[0].bins, &kernels[1].bins);
+    printf("Histograms %s\n", match ? "match" : "DIFFER");
+    histogram_print_stats(&kernels[0].bins);
+
+    /* Run skipping draws differently, it can only agree in distribution */
+    printf("Run skipping:\n");
+    histogram_print_stats(&kernels[2].bins);
+
+    /* Both Gillespie methods on every model, which must agree in distribution */
+    const struct { const char* name; model_enum_t model; } gillespie_models[] = {
+        { "sir", MODEL_SIR }, { "sis", MODEL_SIS }, { "seir", MODEL_SEIR },
+    };
+    unsigned num_gillespie = sizeof(gillespie_models) / sizeof(gillespie_models[0]);
+    double direct_seconds[num_gillespie], next_reaction_seconds[num_gillespie];
+    int agree = 1;
+    printf("%-8s %12s %14s %14s %s\n", "model", "method", "mean", "censored", "replicas/s");
+    for (unsigned i = 0; i < num_gillespie; i++)
+    {
+        histogram_t direct, next_reaction;
+        direct_seconds[i] = _bench_gillespie(&context, gillespie_models[i].model, gillespie_simulate, &direct);
+        next_reaction_seconds[i] = _bench_gillespie(&context, gillespie_models[i].model, gillespie_next_reaction_simulate, &next_reaction);
+        printf("%-8s %12s %14.4f %14"PRIu64" %.0f\n", gillespie_models[i].name, "direct",
+               direct.mean, direct.censored, context.iterations / direct_seconds[i]);
+        printf("%-8s %12s %14.4f %14"PRIu64" %.0f\n", gillespie_models[i].name, "next",
+               next_reaction.mean, next_reaction.censored, context.iterations / next_reaction_seconds[i]);
+        if (!_bench_agree(&direct, &next_reaction))
+        {
+            printf("Gillespie methods DISAGREE on %s\n", gillespie_models[i].name);
+            agree = 0;
+        }
+        histogram_free(&direct);
+        histogram_free(&next_reaction);
+    }
+    if (agree)
+        printf("Gillespie methods agree\n");
+
+    int resumed = _bench_resume(&context);
+
+    /* Per event cost of each timestep kernel, then throughput of whole runs */
+    bench_t bench;
+    bench_init(&bench, "markovian");
+    for (unsigned i = 0; i < num_kernels; i++)
+    {
+        char name[BENCH_NAME_LEN];
+        snprintf(name, sizeof(name), "%s_timestep", kernels[i].name);
+        bench_record(&bench, name, 1e9 * kernels[i].seconds / kernels[i].events, "ns/event", 0);
+        snprintf(name, sizeof(name), "%s_events", kernels[i].name);
+        bench_record(&bench, name, kernels[i].events / kernels[i].seconds, "events/s", 1);
+        snprintf(name, sizeof(name), "%s_replicas", kernels[i].name);
+        bench_record(&bench, name, context.iterations / kernels[i].seconds, "replicas/s", 1);
+    }
+    for (unsigned i = 0; i < num_gillespie; i++)
+    {
+        char name[BENCH_NAME_LEN];
+        snprintf(name, sizeof(name), "gillespie_%s_direct", gillespie_models[i].name);
+        bench_record(&bench, name, context.iterations / direct_seconds[i], "replicas/s", 1);
+        snprintf(name, sizeof(name), "gillespie_%s_next", gillespie_models[i].name);
+        bench_record(&bench, name, context.iterations / next_reaction_seconds[i], "replicas/s", 1);
+    }
+    bench_rng(&bench);
+    bench_print(&bench);
+
+    if (output_path != NULL && bench_write(&bench, output_path) != 0)
+        return -1;
+    int regressions = 0;
+    if (baseline_path != NULL)
+        regressions = bench_compare(&bench, baseline_path, tolerance);
+    return match && agree && resumed && regressions == 0 ? 0 : 1;
+}
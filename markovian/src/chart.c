@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <cairo.h>
+#include <cairo-svg.h>
+
+#include "chart.h"
+#include "instrument.h"
+
+
+/*
+ * Charts of a finished histogram, drawn with cairo straight into a PNG or SVG
+ * file, picked by the extension of the path. Both axes are ranged from the
+ * data. The frequency chart draws one point per bin, or each pixel column's
+ * min to max range joined by the column means when there are more bins than
+ * pixels. The histogram chart sums bins into bars whose width is chosen by
+ * the Freedman-Diaconis rule, rounded to 1, 2 or 5 times a power of ten.
+ */
+
+
+#define CHART_LEFT          70
+#define CHART_RIGHT         20
+#define CHART_TOP           40
+#define CHART_BOTTOM        50
+#define CHART_TICKS         6           /* At most this many labelled ticks per axis */
+#define CHART_MAX_BARS      100
+#define CHART_POINTRADIUS   2
+
+
+typedef struct
+{
+    double  left;                       /* Plot area, in device units */
+    double  top;
+    double  width;
+    double  height;
+    double  xmax;                       /* Data range, both axes start at 0 */
+    double  ymax;
+} chart_frame_t;
+
+
+static double _chart_nice(double value)
+{
+    /* Smallest of 1, 2 or 5 times a power of ten at or above value */
+    if (!(value > 0.0))
+        return 1.0;
+    double power = pow(10.0, floor(log10(value)));
+    double mantissa = value / power;
+    if (mantissa <= 1.0)
+        return power;
+    if (mantissa <= 2.0)
+        return 2.0 * power;
+    if (mantissa <= 5.0)
+        return 5.0 * power;
+    return 10.0 * power;
+}
+
+
+static double _chart_x(const chart_frame_t* frame, double x)
+{
+    return frame->left + frame->width * x / frame->xmax;
+}
+
+
+static double _chart_y(const chart_frame_t* frame, double y)
+{
+    return frame->top + frame->height * (1.0 - y / frame->ymax);
+}
+
+
+static void _chart_label(cairo_t* cr, double x, double y, const char* text, double align_x, double align_y)
+{
+    /* align 0 puts the text's left or top at the point, 0.5 centres it */
+    cairo_text_extents_t te;
+    cairo_text_extents(cr, text, &te);
+    cairo_move_to(cr, x - te.x_bearing - te.width * align_x, y - te.y_bearing - te.height * align_y);
+    cairo_show_text(cr, text);
+}
+
+
+static void _chart_axes(cairo_t* cr, chart_frame_t* frame, const char* title, const char* xlabel, const char* ylabel)
+{
+    /* Rounds the ranges up to a whole tick, then draws the frame, ticks and labels */
+    double xstep = _chart_nice(frame->xmax / CHART_TICKS);
+    double ystep = _chart_nice(frame->ymax / CHART_TICKS);
+    frame->xmax = xstep * ceil(frame->xmax / xstep);
+    frame->ymax = ystep * ceil(frame->ymax / ystep);
+
+    cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+    cairo_paint(cr);
+
+    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+    cairo_set_line_width(cr, 1.0);
+    cairo_rectangle(cr, frame->left, frame->top, frame->width, frame->height);
+    cairo_stroke(cr);
+
+    cairo_set_font_size(cr, 12);
+    char text[32];
+    for (double x = 0.0; x <= frame->xmax * (1.0 + 1e-9); x += xstep)
+    {
+        double px = _chart_x(frame, x);
+        cairo_move_to(cr, px, frame->top + frame->height);
+        cairo_line_to(cr, px, frame->top + frame->height + 5);
+        snprintf(text, sizeof(text), "%g", x);
+        _chart_label(cr, px, frame->top + frame->height + 8, text, 0.5, 0.0);
+    }
+    for (double y = 0.0; y <= frame->ymax * (1.0 + 1e-9); y += ystep)
+    {
+        double py = _chart_y(frame, y);
+        cairo_move_to(cr, frame->left, py);
+        cairo_line_to(cr, frame->left - 5, py);
+        snprintf(text, sizeof(text), "%g", y);
+        _chart_label(cr, frame->left - 8, py, text, 1.0, 0.5);
+    }
+    cairo_stroke(cr);
+
+    _chart_label(cr, frame->left + frame->width / 2, frame->top + frame->height + 30, xlabel, 0.5, 0.0);
+    cairo_save(cr);
+    cairo_translate(cr, 15, frame->top + frame->height / 2);
+    cairo_rotate(cr, -M_PI / 2);
+    _chart_label(cr, 0, 0, ylabel, 0.5, 0.0);
+    cairo_restore(cr);
+
+    cairo_set_font_size(cr, 15);
+    _chart_label(cr, frame->left + frame->width / 2, frame->top / 2, title, 0.5, 0.5);
+}
+
+
+static void _chart_frequency(cairo_t* cr, chart_frame_t* frame, const histogram_t* bins, const char* title)
+{
+    double total = bins->total ? (double)bins->total : 1.0;
+    uint64_t max = 0;
+    for (uint64_t v = 0; v < bins->size; v++)
+    {
+        if (bins->counts[v] > max)
+            max = bins->counts[v];
+    }
+    frame->xmax = bins->size ? bins->size * bins->bin_width : 1.0;
+    frame->ymax = max ? max / total : 1.0;
+    _chart_axes(cr, frame, title, "Time", "Frequency");
+
+    double pixels = _chart_x(frame, bins->bin_width) - _chart_x(frame, 0.0);
+    if (pixels >= 1.0)
+    {
+        cairo_set_source_rgb(cr, 0.0, 0.5, 0.0);
+        for (uint64_t v = 0; v < bins->size; v++)
+        {
+            double px = _chart_x(frame, v * bins->bin_width);
+            double py = _chart_y(frame, bins->counts[v] / total);
+            cairo_new_path(cr);
+            cairo_arc(cr, px, py, CHART_POINTRADIUS, 0, 2 * M_PI);
+            cairo_fill(cr);
+        }
+        return;
+    }
+
+    /* Bins v with floor(pixels · v) == column share a pixel column */
+    cairo_set_source_rgb(cr, 0.6, 0.8, 0.6);
+    cairo_set_line_width(cr, 1.0);
+    uint64_t v = 0;
+    while (v < bins->size)
+    {
+        int64_t column = (int64_t)(pixels * v);
+        uint64_t lo = bins->counts[v];
+        uint64_t hi = lo;
+        for (v++; v < bins->size && (int64_t)(pixels * v) == column; v++)
+        {
+            if (bins->counts[v] < lo)
+                lo = bins->counts[v];
+            if (bins->counts[v] > hi)
+                hi = bins->counts[v];
+        }
+        cairo_move_to(cr, frame->left + column + 0.5, _chart_y(frame, lo / total) + 0.5);
+        cairo_line_to(cr, frame->left + column + 0.5, _chart_y(frame, hi / total) - 0.5);
+    }
+    cairo_stroke(cr);
+
+    cairo_set_source_rgb(cr, 0.0, 0.5, 0.0);
+    cairo_set_line_width(cr, 1.5);
+    v = 0;
+    while (v < bins->size)
+    {
+        int64_t column = (int64_t)(pixels * v);
+        double sum = 0.0;
+        uint64_t n = 0;
+        for (; v < bins->size && (int64_t)(pixels * v) == column; v++, n++)
+        {
+            sum += bins->counts[v];
+        }
+        cairo_line_to(cr, frame->left + column + 0.5, _chart_y(frame, sum / n / total));
+    }
+    cairo_stroke(cr);
+}
+
+
+static uint64_t _chart_bar_width(const histogram_t* bins)
+{
+    /* Freedman-Diaconis, 2 IQR / cbrt(n), in bins */
+    uint64_t iqr = histogram_quantile(bins, 0.75) - histogram_quantile(bins, 0.25);
+    double width = bins->total ? 2.0 * iqr / cbrt((double)bins->total) : 1.0;
+    if ((double)bins->size / width > CHART_MAX_BARS)
+        width = (double)bins->size / CHART_MAX_BARS;
+    width = _chart_nice(width);
+    return width < 1.0 ? 1 : (uint64_t)width;
+}
+
+
+static void _chart_histogram(cairo_t* cr, chart_frame_t* frame, const histogram_t* bins, const char* title)
+{
+    double total = bins->total ? (double)bins->total : 1.0;
+    uint64_t bar_width = _chart_bar_width(bins);
+    uint64_t num_bars = (bins->size + bar_width - 1) / bar_width;
+    uint64_t* bars = (uint64_t*)calloc(num_bars ? num_bars : 1, sizeof(uint64_t));
+    if (bars == NULL)
+    {
+        printf("Failed to allocate %" PRIu64 " bars.\n", num_bars);
+        exit(-1);
+    }
+    uint64_t max = 0;
+    for (uint64_t v = 0; v < bins->size; v++)
+    {
+        bars[v / bar_width] += bins->counts[v];
+        if (bars[v / bar_width] > max)
+            max = bars[v / bar_width];
+    }
+    frame->xmax = num_bars ? num_bars * bar_width * bins->bin_width : 1.0;
+    frame->ymax = max ? max / total : 1.0;
+    _chart_axes(cr, frame, title, "Time", "Frequency");
+
+    double width = bar_width * bins->bin_width;
+    for (uint64_t b = 0; b < num_bars; b++)
+    {
+        double x0 = _chart_x(frame, (b + 0.05) * width);
+        double x1 = _chart_x(frame, (b + 0.95) * width);
+        double y = _chart_y(frame, bars[b] / total);
+        cairo_rectangle(cr, x0, y, x1 - x0, frame->top + frame->height - y);
+    }
+    cairo_set_source_rgba(cr, 0.0, 0.8, 0.0, 0.5);
+    cairo_fill(cr);
+    free(bars);
+
+    if (bins->overflow > 0)
+    {
+        char text[64];
+        snprintf(text, sizeof(text), "%" PRIu64 " past %g", bins->overflow, bins->limit * bins->bin_width);
+        cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+        cairo_set_font_size(cr, 12);
+        _chart_label(cr, frame->left + frame->width - 5, frame->top + 5, text, 1.0, 0.0);
+    }
+}
+
+
+int chart_write(const histogram_t* bins, chart_enum_t chart, const char* title, const char* path)
+{
+    INSTRUMENT_PHASE_BEGIN(PLOT);
+    size_t length = strlen(path);
+    int svg = length >= 4 && strcmp(path + length - 4, ".svg") == 0;
+    cairo_surface_t* surface = svg
+        ? cairo_svg_surface_create(path, CHART_WIDTH, CHART_HEIGHT)
+        : cairo_image_surface_create(CAIRO_FORMAT_RGB24, CHART_WIDTH, CHART_HEIGHT);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+    {
+        printf("Cannot create chart %s.\n", path);
+        cairo_surface_destroy(surface);
+        return -1;
+    }
+
+    chart_frame_t frame = {
+        .left=CHART_LEFT,
+        .top=CHART_TOP,
+        .width=CHART_WIDTH - CHART_LEFT - CHART_RIGHT,
+        .height=CHART_HEIGHT - CHART_TOP - CHART_BOTTOM,
+    };
+    cairo_t* cr = cairo_create(surface);
+    if (chart == CHART_HISTOGRAM)
+        _chart_histogram(cr, &frame, bins, title);
+    else
+        _chart_frequency(cr, &frame, bins, title);
+    cairo_destroy(cr);
+
+    int ret = 0;
+    if (svg)
+        cairo_surface_finish(surface);
+    else if (cairo_surface_write_to_png(surface, path) != CAIRO_STATUS_SUCCESS)
+        ret = -1;
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+        ret = -1;
+    if (ret != 0)
+        printf("Cannot write chart %s.\n", path);
+    cairo_surface_destroy(surface);
+#ifdef INSTRUMENT
+    /* cairo does the writing, the file size is what it wrote */
+    struct stat st;
+    if (ret == 0 && stat(path, &st) == 0)
+        INSTRUMENT_COUNT(BYTES_WRITTEN, st.st_size);
+#endif
+    INSTRUMENT_PHASE_END(PLOT);
+    return ret;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "result.h"
+
+
+#ifndef GIT_VERSION
+#define GIT_VERSION             "unknown"
+#endif
+
+
+int checkpoint_save(const char* path, const context_t* context, const histogram_t* bins, uint64_t completed)
+{
+    /* result_close() writes to path.tmp and renames, so a crash leaves the last good one */
+    result_writer_t writer;
+    if (result_create(&writer, path, CHECKPOINT_SIMULATION, context, bins) != 0)
+        return -1;
+    writer.header.completed = completed;
+    return result_close(&writer);
+}
+
+
+static const char* _checkpoint_mismatch(const result_header_t* header, const context_t* context, const histogram_t* bins)
+{
+    /* Anything that changes which numbers are drawn or where they are counted */
+    char code_version[sizeof(header->code_version)] = {0};
+    strncpy(code_version, GIT_VERSION, sizeof(code_version) - 1);
+    if (strcmp(header->simulation, CHECKPOINT_SIMULATION) != 0)
+        return "is not a checkpoint";
+    if (strncmp(header->code_version, code_version, sizeof(code_version)) != 0)
+        return "was written by another build";
+    if (header->model_id != (uint32_t)context->model
+        || header->sampler != (uint32_t)context->sampler
+        || header->precision != (uint32_t)context->precision
+        || header->initial_susceptibles != context->initial_susceptibles
+        || header->initial_infectives != context->initial_infectives
+        || header->initial_removed != context->initial_removed
+        || header->infection_rate != context->infection_rate
+        || header->recovery_rate != context->recovery_rate
+        || header->incubation_rate != context->incubation_rate
+        || header->iterations != context->iterations
+        || header->limit != bins->limit)
+        return "is for other parameters";
+    if (header->seed != context->seed)
+        return "is for another seed";
+    if (header->completed > header->iterations || header->total != header->completed || !header->exact)
+        return "is inconsistent";
+    return NULL;
+}
+
+
+int checkpoint_load(const char* path, const context_t* context, histogram_t* bins, uint64_t* completed)
+{
+    /* Returns 0 and the histogram so far when path can be resumed, -1 to start afresh */
+    if (access(path, F_OK) != 0)
+        return -1;
+    result_map_t map;
+    if (result_map(&map, path) != 0)
+        return -1;
+
+    const char* mismatch = _checkpoint_mismatch(map.header, context, bins);
+    if (mismatch != NULL)
+    {
+        printf("Checkpoint %s %s, starting afresh.\n", path, mismatch);
+        result_unmap(&map);
+        return -1;
+    }
+
+    histogram_t view;
+    result_histogram(&map, &view);
+    histogram_copy(bins, &view);
+    *completed = map.header->completed;
+    result_unmap(&map);
+    printf("Resuming from %s at %" PRIu64 " of %" PRIu64 " replicas.\n", path, *completed, context->iterations);
+    return 0;
+}
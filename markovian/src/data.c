@@ -1,11 +1,14 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <gmp.h>
+#include <inttypes.h>
 #include <sys/stat.h>
 #include <errno.h>
 
 #include "data.h"
+#include "result.h"
+#include "models.h"
+#include "instrument.h"
 
 
 static void _data_create_DATA_DIR(void)
@@ -27,106 +30,74 @@ static void _data_create_DATA_DIR(void)
 }
 
 
-void data_print_bin_array(bin_array_t bin_array)
+static int _data_save_results(const char* simulation, const context_t* context, const histogram_t* bins, data_trajectory_t trajectory)
 {
-    for (int i = 0; i < bin_array.size; i++)
-    {
-        printf("%u: %u\n", i, bin_array.array[i]);
-    }
-}
+    /* The first replicas go with the histogram when the engine can replay them */
+    result_writer_t writer;
+    if (result_create(&writer, DATA_DIR"/results", simulation, context, bins) != 0)
+        return -1;
+    if (trajectory == NULL)
+        return result_close(&writer);
 
-
-void data_save_data(bin_array_t bin_array, uint64_t iterations)
-{
-    _data_create_DATA_DIR();
-    FILE* fp = fopen(DATA_DIR"/data", "w");
-    if (fp == NULL)
+    uint32_t num_compartments = models[context->model].num_compartments;
+    double* times = (double*)malloc(DATA_TRAJECTORY_POINTS * sizeof(double));
+    uint32_t* states = (uint32_t*)malloc(DATA_TRAJECTORY_POINTS * num_compartments * sizeof(uint32_t));
+    if (times == NULL || states == NULL)
     {
-        printf("Cannot open data file.\n");
+        printf("Failed to allocate trajectories.\n");
         exit(-1);
     }
-    mpf_t normalised_freq;
-    mpf_init(normalised_freq);
-    double freq;
-    for (int i = 0; i < bin_array.size; i++)
+    int ret = 0;
+    for (uint64_t replica = 0; replica < DATA_TRAJECTORIES && replica < context->iterations && ret == 0; replica++)
     {
-        if (i%2 == 1)
-        {
-            mpf_set_ui(normalised_freq, iterations);
-            mpf_ui_div(normalised_freq, bin_array.array[i], normalised_freq);
-            freq = mpf_get_d(normalised_freq);
-            fprintf(fp, "%u %f\n", i, freq);
-        }
+        uint64_t num_points = trajectory(context, replica, DATA_TRAJECTORY_POINTS, times, states);
+        ret = result_add_trajectory(&writer, replica, num_compartments, num_points, times, states);
     }
-    mpf_clear(normalised_freq);
-    fclose(fp);
+    free(times);
+    free(states);
+    if (result_close(&writer) != 0)
+        ret = -1;
+    return ret;
 }
 
 
-void data_make_graph_script(void)
+void data_save_data(const char* simulation, const context_t* context, const histogram_t* bins, data_trajectory_t trajectory)
 {
+    /* The binary results, then the text gnuplot reads, exported from their mapping */
+    INSTRUMENT_PHASE_BEGIN(SAVE);
     _data_create_DATA_DIR();
-    FILE *fp = fopen(DATA_DIR"/plot_graph.p", "w");
-    if (fp == NULL)
+    result_map_t map;
+    if (_data_save_results(simulation, context, bins, trajectory) == 0
+        && result_map(&map, DATA_DIR"/results") == 0)
     {
-        printf("Failed to create plot_graph.p file.\n");
-        exit(-1);
+        if (result_export_text(&map, DATA_DIR"/data") != 0)
+            printf("Cannot write data file.\n");
+        result_unmap(&map);
     }
-    char* project_path = realpath(".", NULL);
-    char* data_path = realpath(DATA_DIR"/data", NULL);
-    fprintf(fp, "reset\n");
-    fprintf(fp, "set terminal png size 500,500\n");
-    fprintf(fp, "set output \"%s/"DATA_DIR"/graph.png\"\n", project_path);
-    fprintf(fp, "set title \"Markovian SIR Model Time Period\"\n");
-    fprintf(fp, "set xlabel \"Time\"\n");
-    fprintf(fp, "set ylabel \"Frequency\"\n");
-    fprintf(fp, "plot \"%s\"\n", data_path);
-    fclose(fp);
+    INSTRUMENT_PHASE_END(SAVE);
 }
 
 
-void data_make_hist_script(void)
+void data_save_patches(const histogram_t* durations, const histogram_t* final_sizes, uint32_t num_patches)
 {
+    INSTRUMENT_PHASE_BEGIN(SAVE);
     _data_create_DATA_DIR();
-    FILE *fp = fopen(DATA_DIR"/plot_histogram.p", "w");
+    FILE* fp = fopen(DATA_DIR"/patches", "w");
     if (fp == NULL)
     {
-        printf("Failed to create plot_histogram.p file.\n");
+        printf("Cannot open patches file.\n");
         exit(-1);
     }
-    char* project_path = realpath(".", NULL);
-    char* data_path = realpath(DATA_DIR"/data", NULL);
-    fprintf(fp, "reset\n");
-    fprintf(fp, "n=100\n");
-    fprintf(fp, "max=100\n");
-    fprintf(fp, "min=0\n");
-    fprintf(fp, "width=(max-min)/n\n");
-    fprintf(fp, "hist(x,width)=width*floor(x/width)+width/2.0\n");
-    fprintf(fp, "set terminal png size 500,500\n");
-    fprintf(fp, "set output \"%s/"DATA_DIR"/hist.png\"\n", project_path);
-    fprintf(fp, "set xrange [min:max]\n");
-    fprintf(fp, "set yrange[0:]\n");
-    fprintf(fp, "set offset graph 0.05,0.05,0.05,0.0\n");
-    fprintf(fp, "set xtics min,(max-min)/5,max\n");
-    fprintf(fp, "set boxwidth width*0.9\n");
-    fprintf(fp, "set style fill solid 0.5\n");
-    fprintf(fp, "set tics out nomirror\n");
-    fprintf(fp, "set title \"Markovian SIR Model Time Period\"\n");
-    fprintf(fp, "set xlabel \"Time\"\n");
-    fprintf(fp, "set ylabel \"Frequency\"\n");
-    fprintf(fp, "plot \"%s\" using (hist($2,width)):(1.0) smooth freq with boxes lc rgb\"green\"\n", data_path);
-}
-
-
-void data_draw_graph(void)
-{
-    FILE *gnuplot = popen("gnuplot "DATA_DIR"/plot_graph.p", "r");
-    fflush(gnuplot);
-}
-
-
-void data_draw_hist(void)
-{
-    FILE* gnuplot = popen("gnuplot "DATA_DIR"/plot_histogram.p", "r");
-    fflush(gnuplot);
+    fprintf(fp, "# patch duration_mean duration_p50 duration_p99 final_size_mean final_size_p50 final_size_p99\n");
+    for (uint32_t p = 0; p < num_patches; p++)
+    {
+        const histogram_t* d = &durations[p];
+        const histogram_t* f = &final_sizes[p];
+        fprintf(fp, "%u %f %g %g %f %" PRIu64 " %" PRIu64 "\n", p,
+                d->mean, histogram_quantile(d, 0.5) * d->bin_width, histogram_quantile(d, 0.99) * d->bin_width,
+                f->mean, histogram_quantile(f, 0.5), histogram_quantile(f, 0.99));
+    }
+    INSTRUMENT_COUNT(BYTES_WRITTEN, ftell(fp));
+    fclose(fp);
+    INSTRUMENT_PHASE_END(SAVE);
 }
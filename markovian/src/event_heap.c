@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "event_heap.h"
+
+
+static inline void _event_heap_place(event_heap_t* heap, uint32_t index, uint32_t item)
+{
+    heap->heap[index] = item;
+    heap->position[item] = index;
+}
+
+
+static void _event_heap_sift_up(event_heap_t* heap, uint32_t index)
+{
+    uint32_t item = heap->heap[index];
+    double time = heap->time[item];
+    while (index > 0)
+    {
+        uint32_t parent = (index - 1) / 2;
+        if (heap->time[heap->heap[parent]] <= time)
+            break;
+        _event_heap_place(heap, index, heap->heap[parent]);
+        index = parent;
+    }
+    _event_heap_place(heap, index, item);
+}
+
+
+static void _event_heap_sift_down(event_heap_t* heap, uint32_t index)
+{
+    uint32_t item = heap->heap[index];
+    double time = heap->time[item];
+    for (;;)
+    {
+        uint32_t child = 2 * index + 1;
+        if (child >= heap->size)
+            break;
+        if (child + 1 < heap->size && heap->time[heap->heap[child + 1]] < heap->time[heap->heap[child]])
+            child++;
+        if (heap->time[heap->heap[child]] >= time)
+            break;
+        _event_heap_place(heap, index, heap->heap[child]);
+        index = child;
+    }
+    _event_heap_place(heap, index, item);
+}
+
+
+void event_heap_init(event_heap_t* heap, uint32_t size)
+{
+    heap->size = size;
+    heap->heap = (uint32_t*)malloc(size * sizeof(uint32_t));
+    heap->position = (uint32_t*)malloc(size * sizeof(uint32_t));
+    heap->time = (double*)malloc(size * sizeof(double));
+    if (size && (heap->heap == NULL || heap->position == NULL || heap->time == NULL))
+    {
+        printf("Failed to allocate an event heap of %u items.\n", size);
+        exit(-1);
+    }
+    for (uint32_t i = 0; i < size; i++)
+    {
+        _event_heap_place(heap, i, i);
+        heap->time[i] = INFINITY;
+    }
+}
+
+
+void event_heap_free(event_heap_t* heap)
+{
+    free(heap->heap);
+    free(heap->position);
+    free(heap->time);
+    heap->heap = NULL;
+    heap->position = NULL;
+    heap->time = NULL;
+    heap->size = 0;
+}
+
+
+void event_heap_set(event_heap_t* heap, uint32_t item, double time)
+{
+    double old = heap->time[item];
+    heap->time[item] = time;
+    if (time < old)
+        _event_heap_sift_up(heap, heap->position[item]);
+    else if (time > old)
+        _event_heap_sift_down(heap, heap->position[item]);
+}
+
+
+void event_heap_build(event_heap_t* heap)
+{
+    /* Restores heap order after the times were written directly, in O(n) */
+    for (uint32_t i = heap->size / 2; i-- > 0;)
+    {
+        _event_heap_sift_down(heap, i);
+    }
+}
+
+
+void event_heap_reset(event_heap_t* heap)
+{
+    /* Any order is a heap once every time is the same */
+    for (uint32_t i = 0; i < heap->size; i++)
+    {
+        heap->time[i] = INFINITY;
+    }
+}
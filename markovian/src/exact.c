@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <math.h>
+#include <gmp.h>
+
+#include "exact.h"
+
+
+/*
+ * The SIR embedded jump chain moves (S, I) either to (S - 1, I + 1) or to
+ * (S, I - 1), so sweeping S downwards and, within each S, I downwards visits
+ * every state after all of its predecessors. Only the column for the current
+ * S and the one it infects into are kept.
+ *
+ * Every infection is followed by exactly one recovery, so an epidemic that
+ * infects k susceptibles always dies out after 2k + I0 events. The age
+ * distribution is the final size distribution shifted and spread by two.
+ */
+
+
+typedef struct
+{
+    uint64_t    age;
+    double      expected;       /* Probability of the age times iterations */
+    uint64_t    count;
+    double      remainder;
+} exact_share_t;
+
+
+static int _exact_compare_shares(const void* a, const void* b)
+{
+    /* Largest remainder first, younger ages first among equals */
+    const exact_share_t* x = (const exact_share_t*)a;
+    const exact_share_t* y = (const exact_share_t*)b;
+    if (x->remainder != y->remainder)
+        return x->remainder > y->remainder ? -1 : 1;
+    return x->age < y->age ? -1 : x->age > y->age;
+}
+
+
+static void _exact_add_shares(histogram_t* bins, uint64_t iterations, exact_share_t* shares, uint64_t num_shares)
+{
+    /*
+     * The bins hold whole counts, so the expected ones are apportioned by
+     * largest remainder: each is rounded down, then the replicas left over go
+     * one each to the largest fractions. The counts add up to iterations, and
+     * no more than one replica's worth of any age is rounded away.
+     */
+    uint64_t assigned = 0;
+    for (uint64_t n = 0; n < num_shares; n++)
+    {
+        double expected = shares[n].expected > 0.0 ? shares[n].expected : 0.0;
+        shares[n].count = (uint64_t)expected;
+        shares[n].remainder = expected - shares[n].count;
+        assigned += shares[n].count;
+    }
+    qsort(shares, num_shares, sizeof(exact_share_t), _exact_compare_shares);
+    for (uint64_t n = 0; n < num_shares && assigned < iterations; n++, assigned++)
+    {
+        shares[n].count++;
+    }
+    for (uint64_t n = 0; n < num_shares; n++)
+    {
+        if (shares[n].count > 0)
+            histogram_add(bins, shares[n].age, shares[n].count);
+    }
+}
+
+
+static void _exact_markovian_SIR_long_double(context_t* context, double* final_size_probability)
+{
+    uint32_t s0 = context->initial_susceptibles;
+    uint32_t column_size = s0 + context->initial_infectives + 1;
+    long double beta = context->infection_rate;
+    long double gamma = context->recovery_rate;
+
+    long double* column = (long double*)calloc(column_size, sizeof(long double));
+    long double* next = (long double*)calloc(column_size, sizeof(long double));
+    column[context->initial_infectives] = 1.0L;
+
+    for (int64_t s = s0; s >= 0; s--)
+    {
+        for (uint32_t i = column_size - 1; i > 0; i--)
+        {
+            if (column[i] == 0.0L)
+                continue;
+            long double avg_infected = beta * s;
+            long double avg_recovered = gamma * i;
+            long double total = avg_infected + avg_recovered;
+            long double prob_infection = total > 0.0L ? avg_infected / total : 0.0L;
+
+            if (s > 0 && i + 1 < column_size)
+                next[i + 1] += column[i] * prob_infection;
+            column[i - 1] += column[i] * (1.0L - prob_infection);
+            column[i] = 0.0L;
+        }
+        final_size_probability[s0 - s] = column[0];
+        column[0] = 0.0L;
+
+        long double* swap = column;
+        column = next;
+        next = swap;
+    }
+
+    free(column);
+    free(next);
+}
+
+
+static void _exact_markovian_SIR_gmp(context_t* context, double* final_size_probability)
+{
+    uint32_t s0 = context->initial_susceptibles;
+    uint32_t column_size = s0 + context->initial_infectives + 1;
+
+    mpf_t* column = (mpf_t*)malloc(column_size * sizeof(mpf_t));
+    mpf_t* next = (mpf_t*)malloc(column_size * sizeof(mpf_t));
+    for (uint32_t i = 0; i < column_size; i++)
+    {
+        mpf_init(column[i]);
+        mpf_init(next[i]);
+    }
+    mpf_set_ui(column[context->initial_infectives], 1);
+
+    mpf_t avg_infected;
+    mpf_init(avg_infected);
+    mpf_t avg_recovered;
+    mpf_init(avg_recovered);
+    mpf_t prob_infection;
+    mpf_init(prob_infection);
+    mpf_t flow;
+    mpf_init(flow);
+
+    for (int64_t s = s0; s >= 0; s--)
+    {
+        for (uint32_t i = column_size - 1; i > 0; i--)
+        {
+            if (mpf_sgn(column[i]) == 0)
+                continue;
+            mpf_set_d(avg_infected, context->infection_rate);
+            mpf_set_d(avg_recovered, context->recovery_rate);
+            mpf_mul_ui(avg_infected, avg_infected, s);
+            mpf_mul_ui(avg_recovered, avg_recovered, i);
+            mpf_add(prob_infection, avg_infected, avg_recovered);
+            if (mpf_sgn(prob_infection) > 0)
+                mpf_div(prob_infection, avg_infected, prob_infection);
+
+            mpf_mul(flow, column[i], prob_infection);
+            if (s > 0 && i + 1 < column_size)
+                mpf_add(next[i + 1], next[i + 1], flow);
+            mpf_sub(flow, column[i], flow);
+            mpf_add(column[i - 1], column[i - 1], flow);
+            mpf_set_ui(column[i], 0);
+        }
+        final_size_probability[s0 - s] = mpf_get_d(column[0]);
+        mpf_set_ui(column[0], 0);
+
+        mpf_t* swap = column;
+        column = next;
+        next = swap;
+    }
+
+    mpf_clear(flow);
+    mpf_clear(prob_infection);
+    mpf_clear(avg_recovered);
+    mpf_clear(avg_infected);
+    for (uint32_t i = 0; i < column_size; i++)
+    {
+        mpf_clear(column[i]);
+        mpf_clear(next[i]);
+    }
+    free(column);
+    free(next);
+}
+
+
+void exact_markovian_SIR(context_t* context, double* final_size_probability)
+{
+    /* final_size_probability must hold initial_susceptibles + 1 entries */
+    if (context->precision == PRECISION_GMP)
+        _exact_markovian_SIR_gmp(context, final_size_probability);
+    else
+        _exact_markovian_SIR_long_double(context, final_size_probability);
+}
+
+
+void exact_simulate_markovian_SIR(context_t* context)
+{
+    /*
+     * Fills the bins with the expected count of each age over
+     * context->iterations replicas, in place of the Monte Carlo estimate,
+     * apportioned so that they add up to iterations.
+     */
+    printf("Infection Rate: %f\n", context->infection_rate);
+
+    uint32_t num_sizes = context->initial_susceptibles + 1;
+    double* final_size_probability = (double*)malloc(num_sizes * sizeof(double));
+    exact_share_t* shares = (exact_share_t*)malloc(num_sizes * sizeof(exact_share_t));
+    if (final_size_probability == NULL || shares == NULL)
+    {
+        printf("Failed to allocate %u final sizes.\n", num_sizes);
+        exit(-1);
+    }
+    exact_markovian_SIR(context, final_size_probability);
+
+    histogram_reset(&context->bins);
+    for (uint32_t k = 0; k < num_sizes; k++)
+    {
+        shares[k].age = 2 * (uint64_t)k + context->initial_infectives;
+        shares[k].expected = final_size_probability[k] * context->iterations;
+    }
+    _exact_add_shares(&context->bins, context->iterations, shares, num_sizes);
+
+    free(shares);
+    free(final_size_probability);
+}
+
+
+/*
+ * Any model from models.h, by pushing the distribution over states forward
+ * one event at a time. Mass on a state where the epidemic has ended, or where
+ * nothing can happen, is the probability of that age. Whatever is still
+ * running at the time range goes to the overflow bucket.
+ *
+ * Every transition keeps the population fixed, so the last compartment is
+ * implied by the others and states are indexed by the first ones alone, in
+ * base N + 1. Only states holding mass are visited at each step.
+ */
+
+
+#define EXACT_MAX_STATES    (1u << 24)
+
+
+void exact_simulate_model(context_t* context)
+{
+    if (context->model == MODEL_SIR)
+    {
+        exact_simulate_markovian_SIR(context);
+        return;
+    }
+
+    const model_t* model = &models[context->model];
+    printf("Model: %s\n", model->name);
+    printf("Infection Rate: %f\n", context->infection_rate);
+    histogram_reset(&context->bins);
+
+    uint32_t initial[MODEL_MAX_COMPARTMENTS];
+    model_initial_state(context->model, context->initial_susceptibles, context->initial_infectives, context->initial_removed, initial);
+    uint64_t population = 0;
+    for (uint32_t k = 0; k < model->num_compartments; k++)
+    {
+        population += initial[k];
+    }
+
+    uint32_t dimensions = model->num_compartments - 1;
+    uint64_t radix[MODEL_MAX_COMPARTMENTS];
+    uint64_t num_states = 1;
+    for (uint32_t k = 0; k < dimensions; k++)
+    {
+        radix[k] = num_states;
+        num_states *= population + 1;
+        if (num_states > EXACT_MAX_STATES)
+        {
+            printf("%s with a population of %" PRIu64 " has too many states to solve exactly.\n", model->name, population);
+            return;
+        }
+    }
+
+    int64_t offset[MODEL_MAX_TRANSITIONS];
+    for (uint32_t t = 0; t < model->num_transitions; t++)
+    {
+        offset[t] = 0;
+        for (uint32_t k = 0; k < dimensions; k++)
+        {
+            offset[t] += model->stoichiometry[t][k] * (int64_t)radix[k];
+        }
+    }
+
+    double* mass = (double*)calloc(num_states, sizeof(double));
+    double* next = (double*)calloc(num_states, sizeof(double));
+    uint32_t* occupied = (uint32_t*)malloc(num_states * sizeof(uint32_t));
+    uint32_t* next_occupied = (uint32_t*)malloc(num_states * sizeof(uint32_t));
+    uint8_t* queued = (uint8_t*)calloc(num_states, sizeof(uint8_t));      /* Listed in next_occupied */
+    exact_share_t* shares = (exact_share_t*)malloc((context->bins.limit + 1) * sizeof(exact_share_t));
+    if (mass == NULL || next == NULL || occupied == NULL || next_occupied == NULL || queued == NULL || shares == NULL)
+    {
+        printf("Failed to allocate %" PRIu64 " states.\n", num_states);
+        exit(-1);
+    }
+    model_params_t params = {.beta=context->infection_rate, .gamma=context->recovery_rate, .sigma=context->incubation_rate};
+
+    uint64_t start = 0;
+    for (uint32_t k = 0; k < dimensions; k++)
+    {
+        start += initial[k] * radix[k];
+    }
+    mass[start] = 1.0;
+    occupied[0] = (uint32_t)start;
+    uint64_t num_occupied = 1;
+
+    double running = 1.0;
+    uint64_t num_shares = 0;
+    for (uint64_t age = 0; age < context->bins.limit && num_occupied > 0; age++)
+    {
+        double ended = 0.0;
+        uint64_t num_next = 0;
+        for (uint64_t n = 0; n < num_occupied; n++)
+        {
+            uint32_t index = occupied[n];
+            double p = mass[index];
+            mass[index] = 0.0;
+
+            uint32_t x[MODEL_MAX_COMPARTMENTS];
+            uint64_t rest = population;
+            for (uint32_t k = 0; k < dimensions; k++)
+            {
+                x[k] = (uint32_t)(index / radix[k] % (population + 1));
+                rest -= x[k];
+            }
+            x[dimensions] = (uint32_t)rest;
+
+            double rates[MODEL_MAX_TRANSITIONS];
+            double total = model->active(x) ? model->rates(x, &params, rates) : 0.0;
+            if (!(total > 0.0))
+            {
+                ended += p;
+                continue;
+            }
+            for (uint32_t t = 0; t < model->num_transitions; t++)
+            {
+                if (rates[t] <= 0.0)
+                    continue;
+                /* Mass that underflows to nothing is not worth a state */
+                double q = p * rates[t] / total;
+                if (q == 0.0)
+                    continue;
+                uint32_t target = (uint32_t)((int64_t)index + offset[t]);
+                if (!queued[target])
+                {
+                    queued[target] = 1;
+                    next_occupied[num_next++] = target;
+                }
+                next[target] += q;
+            }
+        }
+
+        shares[num_shares].age = age;
+        shares[num_shares].expected = ended * context->iterations;
+        num_shares++;
+        running -= ended;
+
+        double* swap = mass;
+        mass = next;
+        next = swap;
+        uint32_t* swap_occupied = occupied;
+        occupied = next_occupied;
+        next_occupied = swap_occupied;
+        num_occupied = num_next;
+        for (uint64_t n = 0; n < num_occupied; n++)
+        {
+            queued[occupied[n]] = 0;
+        }
+    }
+
+    /* Still running at the time range */
+    shares[num_shares].age = context->bins.limit;
+    shares[num_shares].expected = running * context->iterations;
+    num_shares++;
+    _exact_add_shares(&context->bins, context->iterations, shares, num_shares);
+
+    free(shares);
+    free(mass);
+    free(next);
+    free(occupied);
+    free(next_occupied);
+    free(queued);
+}
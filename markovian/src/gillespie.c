@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "gillespie.h"
+#include "event_heap.h"
+#include "models.h"
+#include "philox.h"
+#include "instrument.h"
+
+
+/*
+ * Continuous time simulation of the model tables, recording how long each
+ * epidemic lasts in the model's own time units rather than in events.
+ *
+ * gillespie_simulate() uses Gillespie's direct method: the waiting time is
+ * Exp(total rate) and the event is picked in proportion to its rate, both
+ * O(R) in the number of transitions R.
+ *
+ * gillespie_next_reaction_simulate() uses the next reaction method (Gibson &
+ * Bruck, 2000) instead. Every transition keeps the absolute time it next
+ * fires in an indexed heap. After an event only the transitions whose rates
+ * read a compartment it changed are updated, and their pending times are
+ * rescaled rather than redrawn, so an event costs O(log R) plus one rate per
+ * dependent. The two draw differently and agree in distribution, which
+ * make bench checks.
+ *
+ * Replicas still running at limit · bin width are censored: they land in
+ * the overflow bucket and stay out of the mean and variance.
+ *
+ * gillespie_trajectory() and gillespie_next_reaction_trajectory() replay one
+ * replica from its own Philox stream and record the state after every event,
+ * so a saved trajectory is exactly a path that was counted.
+ */
+
+
+typedef struct
+{
+    const model_t*  model;
+    model_params_t  params;
+    double          horizon;
+    /* Transitions to update after each event, CSR by event */
+    uint32_t        dependents_start[MODEL_MAX_TRANSITIONS + 1];
+    uint32_t        dependents[MODEL_MAX_TRANSITIONS * MODEL_MAX_TRANSITIONS];
+} gillespie_t;
+
+
+/* States of a replica being recorded, the first max_points of them */
+typedef struct
+{
+    uint64_t        max_points;
+    uint64_t        num_points;
+    double*         times;
+    uint32_t*       states;
+} gillespie_path_t;
+
+
+static double _gillespie_exponential(philox_t* philox)
+{
+    /* philox_uniform() is never 0 */
+    return -log(philox_uniform(philox));
+}
+
+
+static void _gillespie_build_dependencies(gillespie_t* gillespie)
+{
+    const model_t* model = gillespie->model;
+    uint32_t reads[MODEL_MAX_TRANSITIONS];
+    model->reads(reads);
+
+    uint32_t count = 0;
+    for (uint32_t e = 0; e < model->num_transitions; e++)
+    {
+        uint32_t changes = 0;
+        for (uint32_t k = 0; k < model->num_compartments; k++)
+        {
+            if (model->stoichiometry[e][k] != 0)
+                changes |= 1u << k;
+        }
+
+        gillespie->dependents_start[e] = count;
+        for (uint32_t t = 0; t < model->num_transitions; t++)
+        {
+            /* An event always needs its own next time drawn again */
+            if (t == e || (reads[t] & changes))
+                gillespie->dependents[count++] = t;
+        }
+    }
+    gillespie->dependents_start[model->num_transitions] = count;
+}
+
+
+static void _gillespie_init(gillespie_t* gillespie, const context_t* context)
+{
+    gillespie->model = &models[context->model];
+    gillespie->params.beta = context->infection_rate;
+    gillespie->params.gamma = context->recovery_rate;
+    gillespie->params.sigma = context->incubation_rate;
+    gillespie->horizon = context->bins.limit * context->time_bin_width;
+    _gillespie_build_dependencies(gillespie);
+}
+
+
+static void _gillespie_record(const model_t* model, gillespie_path_t* path, double time, const uint32_t* x)
+{
+    if (path == NULL || path->num_points == path->max_points)
+        return;
+    path->times[path->num_points] = time;
+    memcpy(path->states + path->num_points * model->num_compartments, x, model->num_compartments * sizeof(uint32_t));
+    path->num_points++;
+}
+
+
+static void _gillespie_apply(const model_t* model, uint32_t event, uint32_t* x)
+{
+    INSTRUMENT_COUNT(EVENTS, 1);
+    for (uint32_t k = 0; k < model->num_compartments; k++)
+    {
+        x[k] += model->stoichiometry[event][k];
+    }
+}
+
+
+static double _gillespie_direct(const gillespie_t* gillespie, philox_t* philox, uint32_t* x, gillespie_path_t* path)
+{
+    const model_t* model = gillespie->model;
+    double rates[MODEL_MAX_TRANSITIONS];
+    double time = 0.0;
+    _gillespie_record(model, path, time, x);
+
+    while (model->active(x))
+    {
+        double total = model->rates(x, &gillespie->params, rates);
+        if (total <= 0.0)
+            break;
+        double next = time + _gillespie_exponential(philox) / total;
+        if (next >= gillespie->horizon)
+            return INFINITY;
+        time = next;
+
+        double target = philox_uniform(philox) * total;
+        double cumulative = 0.0;
+        uint32_t event = 0;
+        for (; event + 1 < model->num_transitions; event++)
+        {
+            cumulative += rates[event];
+            if (target < cumulative)
+                break;
+        }
+        /* Rounding can leave the target past the last rate, skip empty channels */
+        while (rates[event] <= 0.0)
+            event--;
+        _gillespie_apply(model, event, x);
+        _gillespie_record(model, path, time, x);
+    }
+    return time;
+}
+
+
+static double _gillespie_next_reaction(const gillespie_t* gillespie, philox_t* philox, event_heap_t* heap, uint32_t* x, gillespie_path_t* path)
+{
+    const model_t* model = gillespie->model;
+    double rates[MODEL_MAX_TRANSITIONS];
+    double time = 0.0;
+    _gillespie_record(model, path, time, x);
+
+    for (uint32_t t = 0; t < model->num_transitions; t++)
+    {
+        rates[t] = model->rate[t](x, &gillespie->params);
+        heap->time[t] = rates[t] > 0.0 ? _gillespie_exponential(philox) / rates[t] : INFINITY;
+    }
+    event_heap_build(heap);
+
+    while (model->active(x))
+    {
+        uint32_t event = event_heap_top(heap);
+        double next = event_heap_time(heap, event);
+        if (isinf(next))
+            break;
+        if (next >= gillespie->horizon)
+            return INFINITY;
+        time = next;
+        _gillespie_apply(model, event, x);
+        _gillespie_record(model, path, time, x);
+
+        for (uint32_t d = gillespie->dependents_start[event]; d < gillespie->dependents_start[event + 1]; d++)
+        {
+            uint32_t t = gillespie->dependents[d];
+            double rate = model->rate[t](x, &gillespie->params);
+            double fires = INFINITY;
+            if (rate > 0.0)
+            {
+                /*
+                 * A transition that did not fire keeps its pending time,
+                 * rescaled to the new rate. The one that fired, or one that
+                 * was switched off, has nothing left to rescale.
+                 */
+                if (t != event && rates[t] > 0.0)
+                    fires = time + rates[t] / rate * (event_heap_time(heap, t) - time);
+                else
+                    fires = time + _gillespie_exponential(philox) / rate;
+            }
+            rates[t] = rate;
+            event_heap_set(heap, t, fires);
+        }
+    }
+    return time;
+}
+
+
+static void _gillespie_simulate(context_t* context, int next_reaction)
+{
+    printf("Model: %s\n", models[context->model].name);
+    printf("Infection Rate: %f\n", context->infection_rate);
+
+    gillespie_t gillespie;
+    _gillespie_init(&gillespie, context);
+
+    histogram_reset(&context->bins);
+    context->bins.bin_width = context->time_bin_width;
+
+    event_heap_t heap;
+    event_heap_init(&heap, gillespie.model->num_transitions);
+
+    /* Durations not yet handed to a watcher, if there is one */
+    histogram_t chunk;
+    histogram_init(&chunk, context->bins.limit);
+
+    for (uint64_t i = 0; i < context->iterations && !progress_cancelled(context->progress); i++)
+    {
+        /* Replica i draws from Philox stream i, as in modelling_simulate() */
+        philox_t philox;
+        philox_init(&philox, context->seed, i);
+        uint32_t x[MODEL_MAX_COMPARTMENTS];
+        model_initial_state(context->model, context->initial_susceptibles, context->initial_infectives, context->initial_removed, x);
+
+        double duration = next_reaction
+            ? _gillespie_next_reaction(&gillespie, &philox, &heap, x, NULL)
+            : _gillespie_direct(&gillespie, &philox, x, NULL);
+        histogram_add_real(&context->bins, duration);
+
+        if (context->progress == NULL)
+            continue;
+        chunk.bin_width = context->bins.bin_width;
+        histogram_add_real(&chunk, duration);
+        if (chunk.total == PROGRESS_CHUNK)
+        {
+            progress_add(context->progress, &chunk, chunk.total);
+            histogram_reset(&chunk);
+        }
+    }
+    if (chunk.total > 0)
+        progress_add(context->progress, &chunk, chunk.total);
+
+    histogram_free(&chunk);
+    event_heap_free(&heap);
+}
+
+
+void gillespie_simulate(context_t* context)
+{
+    _gillespie_simulate(context, 0);
+}
+
+
+void gillespie_next_reaction_simulate(context_t* context)
+{
+    _gillespie_simulate(context, 1);
+}
+
+
+static uint64_t _gillespie_trajectory(const context_t* context, int next_reaction, uint64_t replica,
+                                      uint64_t max_points, double* times, uint32_t* states)
+{
+    gillespie_t gillespie;
+    _gillespie_init(&gillespie, context);
+    event_heap_t heap;
+    event_heap_init(&heap, gillespie.model->num_transitions);
+
+    philox_t philox;
+    philox_init(&philox, context->seed, replica);
+    uint32_t x[MODEL_MAX_COMPARTMENTS];
+    model_initial_state(context->model, context->initial_susceptibles, context->initial_infectives, context->initial_removed, x);
+    gillespie_path_t path = { .max_points=max_points, .num_points=0, .times=times, .states=states };
+    if (next_reaction)
+        _gillespie_next_reaction(&gillespie, &philox, &heap, x, &path);
+    else
+        _gillespie_direct(&gillespie, &philox, x, &path);
+
+    event_heap_free(&heap);
+    return path.num_points;
+}
+
+
+uint64_t gillespie_trajectory(const context_t* context, uint64_t replica, uint64_t max_points, double* times, uint32_t* states)
+{
+    return _gillespie_trajectory(context, 0, replica, max_points, times, states);
+}
+
+
+uint64_t gillespie_next_reaction_trajectory(const context_t* context, uint64_t replica, uint64_t max_points, double* times, uint32_t* states)
+{
+    return _gillespie_trajectory(context, 1, replica, max_points, times, states);
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <inttypes.h>
 #include <math.h>
 
@@ -6,6 +7,7 @@
 #include <gtk/gtk.h>
 
 #include "common.h"
+#include "instrument.h"
 
 
 #define GRAPH_XMARGIN             60
@@ -15,52 +17,129 @@
 #define GRAPH_XLARGETICKS         5
 #define GRAPH_YLARGETICKS         5
 #define GRAPH_POINTRADIUS         3
-#define GRAPH_MAX_DATAPOINTS      1000
 #define GRAPH_XMIN_INTERVAL_SIZE  25
 #define GRAPH_YMIN_INTERVAL_SIZE  20
 
 
+/*
+ * The series is kept as plain counts, one per bin, however many there are.
+ * When there are more bins than pixel columns, each column draws the min to
+ * max envelope of the bins that fall in it and the mean joins the columns up,
+ * so drawing costs one pass over the bins and one stroke per column. Axes and
+ * data are drawn once into a surface that is only redrawn when the data or
+ * the widget size change; expose events just paint it.
+ */
 typedef struct
 {
-    float x;
-    float y;
-} graph_datapoint_t;
+    uint64_t*           counts;
+    uint64_t            size;
+    uint64_t            capacity;
+    uint64_t            yupper;
+} graph_series_t;
 
 
 typedef struct
 {
-    graph_datapoint_t   datapoints[GRAPH_MAX_DATAPOINTS];
-    uint16_t            size;
-    float               xupper;
-    float               xlower;
-    float               yupper;
-    float               ylower;
-} graph_point_array_t;
+    cairo_surface_t*    surface;
+    int                 width;
+    int                 height;
+    int                 valid;
+} graph_cache_t;
 
 
-static graph_point_array_t _graph_point_array = {0};
+static graph_series_t _graph_series = {0};
+static graph_cache_t _graph_cache = {0};
 
 
-gboolean graph_draw_cb(GtkWidget *widget, cairo_t *cr, gpointer user_data)
+static int _graph_tick_step(float interval, float min_size)
+{
+    /* Smallest of 1, 2, 5, 10, 20, 50... whose ticks are at least min_size apart */
+    int step = 1;
+    for (;;)
+    {
+        if (interval * step >= min_size)
+            return step;
+        if (interval * step * 2 >= min_size)
+            return step * 2;
+        if (interval * step * 5 >= min_size)
+            return step * 5;
+        if (step > INT32_MAX / 10)
+            return step * 10;
+        step *= 10;
+    }
+}
+
+
+static void _graph_draw_points(cairo_t* cr, float xinterval, float yinterval)
+{
+    /* Few enough bins for each to get its own point */
+    for (uint64_t k = 0; k < _graph_series.size; k++)
+    {
+        double x = xinterval * k;
+        double y = -yinterval * _graph_series.counts[k];
+        cairo_move_to(cr, x, y);
+        cairo_arc(cr, x, y, GRAPH_POINTRADIUS, 0, 2 * M_PI);
+        cairo_fill(cr);
+    }
+}
+
+
+static void _graph_draw_envelope(cairo_t* cr, float xinterval, float yinterval)
+{
+    /* Bins k with floor(xinterval · k) == column share a pixel column */
+    cairo_set_line_width(cr, 1.0);
+    cairo_set_source_rgb(cr, 0.6, 0.6, 0.9);
+    uint64_t k = 0;
+    while (k < _graph_series.size)
+    {
+        int64_t column = (int64_t)(xinterval * k);
+        uint64_t min = _graph_series.counts[k];
+        uint64_t max = min;
+        for (k++; k < _graph_series.size && (int64_t)(xinterval * k) == column; k++)
+        {
+            uint64_t count = _graph_series.counts[k];
+            if (count < min)
+                min = count;
+            if (count > max)
+                max = count;
+        }
+        cairo_move_to(cr, column + 0.5, -yinterval * min + 0.5);
+        cairo_line_to(cr, column + 0.5, -yinterval * max - 0.5);
+    }
+    cairo_stroke(cr);
+
+    cairo_set_line_width(cr, 1.5);
+    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+    k = 0;
+    while (k < _graph_series.size)
+    {
+        int64_t column = (int64_t)(xinterval * k);
+        double sum = 0.0;
+        uint64_t n = 0;
+        for (; k < _graph_series.size && (int64_t)(xinterval * k) == column; k++, n++)
+        {
+            sum += _graph_series.counts[k];
+        }
+        if (column == 0)
+            cairo_move_to(cr, column + 0.5, -yinterval * sum / n);
+        else
+            cairo_line_to(cr, column + 0.5, -yinterval * sum / n);
+    }
+    cairo_stroke(cr);
+}
+
+
+static void _graph_render(cairo_t* cr, int width, int height)
 {
-    GdkRectangle da;            /* GtkDrawingArea size */
     gdouble dx = 1.0, dy = 1.0; /* Pixels between each point */
     gdouble clip_x1 = 0.0, clip_y1 = 0.0, clip_x2 = 10.0, clip_y2 = 10.0;
-    GdkWindow *window = gtk_widget_get_window(widget);
-
-    /* Determine GtkDrawingArea dimensions */
-    gdk_window_get_geometry (window,
-            &da.x,
-            &da.y,
-            &da.width,
-            &da.height);
 
-    /* Draw on a black background */
+    /* Draw on a white background */
     cairo_set_source_rgb (cr, 1.0, 1.0, 1.0);
     cairo_paint (cr);
 
     /* Change the transformation matrix */
-    cairo_translate (cr, GRAPH_YMARGIN, da.height - GRAPH_XMARGIN);
+    cairo_translate (cr, GRAPH_YMARGIN, height - GRAPH_XMARGIN);
     cairo_scale (cr, 1., 1.);
 
     /* Determine the data points to calculate (ie. those in the clipping zone */
@@ -76,18 +155,17 @@ gboolean graph_draw_cb(GtkWidget *widget, cairo_t *cr, gpointer user_data)
     cairo_line_to (cr, 0.0, clip_y2);
     cairo_stroke (cr);
 
+    /* Both axes start at 0, with one unit of margin either side */
     float maxx, maxy, xinterval, yinterval;
     {
-        float minx = _graph_point_array.xlower - 1;
-        maxx = _graph_point_array.xupper + 1;
-        float xrange = maxx - minx;
-        xinterval = (da.width - GRAPH_XMARGIN) / xrange;
+        maxx = _graph_series.size;
+        float xrange = maxx + 1;
+        xinterval = (width - GRAPH_XMARGIN) / xrange;
     }
     {
-        float miny = _graph_point_array.ylower - 1;
-        maxy = _graph_point_array.yupper + 1;
-        float yrange = maxy - miny;
-        yinterval = (da.height - GRAPH_YMARGIN) / yrange;
+        maxy = (float)_graph_series.yupper + 1;
+        float yrange = maxy + 1;
+        yinterval = (height - GRAPH_YMARGIN) / yrange;
     }
 
     /* Writing in the foreground */
@@ -105,30 +183,16 @@ gboolean graph_draw_cb(GtkWidget *widget, cairo_t *cr, gpointer user_data)
     cairo_text_extents(cr, label, &te);
     cairo_show_text(cr, label);
 
-    int xinterval_div;
-    if (xinterval > GRAPH_XMIN_INTERVAL_SIZE)
-        xinterval_div = 1;
-    else if (xinterval * 2 > GRAPH_XMIN_INTERVAL_SIZE)
-        xinterval_div = 2;
-    else
-    {
-        xinterval_div = 5;
-        while (xinterval * xinterval_div < GRAPH_XMIN_INTERVAL_SIZE)
-            xinterval_div += 5;
-    }
-    for (int i = 0; i <= maxx + 2; i += xinterval_div)
+    int xinterval_div = _graph_tick_step(xinterval, GRAPH_XMIN_INTERVAL_SIZE);
+    for (int64_t i = xinterval_div; i <= maxx + 2; i += xinterval_div)
     {
-        if (!i)
-            continue;
         cairo_move_to(cr, i * xinterval , 0);
         float ticklen = GRAPH_XMARGIN/4.5;
         if ((i/xinterval_div) % GRAPH_XLARGETICKS == 0)
             ticklen *= 1.5;
         cairo_line_to(cr, i * xinterval , ticklen);
-        if (i < 0)
-            continue;
-        char label[11];
-        snprintf(label, 11, "%d", i);
+        char label[21];
+        snprintf(label, 21, "%" PRId64, i);
         cairo_text_extents(cr, label, &te);
         cairo_move_to(cr,
                       i * xinterval - te.x_bearing - te.width / 2,
@@ -136,30 +200,16 @@ gboolean graph_draw_cb(GtkWidget *widget, cairo_t *cr, gpointer user_data)
         cairo_show_text(cr, label);
     }
 
-    float yinterval_div;
-    if (yinterval > GRAPH_YMIN_INTERVAL_SIZE)
-        yinterval_div = 1;
-    else if (yinterval * 2 > GRAPH_YMIN_INTERVAL_SIZE)
-        yinterval_div = 2;
-    else
-    {
-        yinterval_div = 5;
-        while (yinterval * yinterval_div < GRAPH_YMIN_INTERVAL_SIZE)
-            yinterval_div += 5;
-    }
-    for (int j = 0; j <= maxy + 2; j += yinterval_div)
+    int yinterval_div = _graph_tick_step(yinterval, GRAPH_YMIN_INTERVAL_SIZE);
+    for (int64_t j = yinterval_div; j <= maxy + 2; j += yinterval_div)
     {
-        if (!j)
-            continue;
         cairo_move_to(cr, 0,            -j * yinterval);
         float ticklen = GRAPH_YMARGIN/4.5;
-        if ((int)(j/yinterval_div) % GRAPH_YLARGETICKS == 0)
+        if ((j/yinterval_div) % GRAPH_YLARGETICKS == 0)
             ticklen *= 1.5;
         cairo_line_to(cr, -ticklen,     -j * yinterval);
-        if (j < 0)
-            continue;
-        char label[11];
-        snprintf(label, 11, "%d", j);
+        char label[21];
+        snprintf(label, 21, "%" PRId64, j);
         cairo_text_extents(cr, label, &te);
         cairo_move_to(cr,
                       -GRAPH_YMARGIN/1.5    - te.x_bearing - te.width / 2,
@@ -168,41 +218,70 @@ gboolean graph_draw_cb(GtkWidget *widget, cairo_t *cr, gpointer user_data)
     }
     cairo_stroke (cr);
 
-    for (unsigned k = 0; k < _graph_point_array.size; k++)
+    if (xinterval >= 1.0f)
+        _graph_draw_points(cr, xinterval, yinterval);
+    else
+        _graph_draw_envelope(cr, xinterval, yinterval);
+}
+
+
+gboolean graph_draw_cb(GtkWidget *widget, cairo_t *cr, gpointer user_data)
+{
+    GdkRectangle da;            /* GtkDrawingArea size */
+    GdkWindow *window = gtk_widget_get_window(widget);
+
+    /* Determine GtkDrawingArea dimensions */
+    gdk_window_get_geometry (window,
+            &da.x,
+            &da.y,
+            &da.width,
+            &da.height);
+
+    if (_graph_cache.surface == NULL || _graph_cache.width != da.width || _graph_cache.height != da.height)
+    {
+        if (_graph_cache.surface != NULL)
+            cairo_surface_destroy(_graph_cache.surface);
+        _graph_cache.surface = gdk_window_create_similar_surface(window, CAIRO_CONTENT_COLOR, da.width, da.height);
+        _graph_cache.width = da.width;
+        _graph_cache.height = da.height;
+        _graph_cache.valid = 0;
+    }
+    if (!_graph_cache.valid)
     {
-        graph_datapoint_t* d = &_graph_point_array.datapoints[k];
-        cairo_move_to(cr, xinterval*d->x, -yinterval*d->y);
-        cairo_arc(cr, xinterval*d->x, -yinterval*d->y, GRAPH_POINTRADIUS, 0, 2 * M_PI);
-        cairo_fill (cr);
+        INSTRUMENT_PHASE_BEGIN(PLOT);
+        cairo_t* surface_cr = cairo_create(_graph_cache.surface);
+        _graph_render(surface_cr, da.width, da.height);
+        cairo_destroy(surface_cr);
+        INSTRUMENT_PHASE_END(PLOT);
+        _graph_cache.valid = 1;
     }
 
-    cairo_stroke (cr);
+    cairo_set_source_surface(cr, _graph_cache.surface, 0, 0);
+    cairo_paint(cr);
 
     return TRUE;
 }
 
 
-gboolean graph_set_points(bin_array_t bins)
+gboolean graph_set_points(const histogram_t* bins)
 {
-    if (bins.size > GRAPH_MAX_DATAPOINTS)
-        return FALSE;
-    _graph_point_array.size = bins.size;
-    _graph_point_array.xlower = INFINITY;
-    _graph_point_array.ylower = INFINITY;
-    _graph_point_array.xupper = -INFINITY;
-    _graph_point_array.yupper = -INFINITY;
-    for (unsigned i = 0; i < bins.size; i++)
+    if (bins->size > _graph_series.capacity)
+    {
+        uint64_t* counts = (uint64_t*)realloc(_graph_series.counts, bins->size * sizeof(uint64_t));
+        if (counts == NULL)
+            return FALSE;
+        _graph_series.counts = counts;
+        _graph_series.capacity = bins->size;
+    }
+    _graph_series.size = bins->size;
+    _graph_series.yupper = 0;
+    for (uint64_t i = 0; i < bins->size; i++)
     {
-        if (i < _graph_point_array.xlower)
-            _graph_point_array.xlower = i;
-        if (bins.array[i] < _graph_point_array.ylower)
-            _graph_point_array.ylower = bins.array[i];
-        if (i > _graph_point_array.xupper)
-            _graph_point_array.xupper = i;
-        if (bins.array[i] > _graph_point_array.yupper)
-            _graph_point_array.yupper = bins.array[i];
-        _graph_point_array.datapoints[i].x = i;
-        _graph_point_array.datapoints[i].y = bins.array[i];
+        uint64_t count = bins->counts[i];
+        if (count > _graph_series.yupper)
+            _graph_series.yupper = count;
+        _graph_series.counts[i] = count;
     }
+    _graph_cache.valid = 0;
     return TRUE;
 }
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
 
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
@@ -10,21 +11,62 @@
 #include "graph.h"
 #include "modelling.h"
 #include "data.h"
+#include "chart.h"
+#include "result.h"
+#include "exact.h"
+#include "tau_leap.h"
+#include "gillespie.h"
+#include "network.h"
+#include "metapopulation.h"
+#include "progress.h"
+#include "instrument.h"
+
+
+/* Shortest time between two redraws of a running simulation, in nanoseconds */
+#define GUI_REDRAW_INTERVAL         100000000
 
 
 typedef enum
 {
     SIMULATION_MARKOVIAN_SIR,
     SIMULATION_MARKOVIAN_SIS,
+    SIMULATION_MARKOVIAN_SEIR,
+    SIMULATION_MARKOVIAN_SIR_EXACT,
+    SIMULATION_MARKOVIAN_SIS_EXACT,
+    SIMULATION_MARKOVIAN_SEIR_EXACT,
+    SIMULATION_MARKOVIAN_SIR_TAU_LEAP,
+    SIMULATION_MARKOVIAN_SIR_GILLESPIE,
+    SIMULATION_MARKOVIAN_SIS_GILLESPIE,
+    SIMULATION_MARKOVIAN_SEIR_GILLESPIE,
+    SIMULATION_MARKOVIAN_SIR_NEXT_REACTION,
+    SIMULATION_MARKOVIAN_SIS_NEXT_REACTION,
+    SIMULATION_MARKOVIAN_SEIR_NEXT_REACTION,
+    SIMULATION_NETWORK_SIR,
+    SIMULATION_NETWORK_SIS,
+    SIMULATION_METAPOPULATION_SIR,
 } simulation_enum_t;
 
 
-#define SIMULATIONS_COUNT                                           2
-#define MAX_SIM_NAME_LEN                                            16
-#define SIMULATIONS                                                    \
-{                                                                      \
-    { SIMULATION_MARKOVIAN_SIR, "Markovian SIR", modelling_simulate }, \
-    { SIMULATION_MARKOVIAN_SIS, "Markovian SIS", modelling_simulate }, \
+#define SIMULATIONS_COUNT                                                                                                                                            16
+#define MAX_SIM_NAME_LEN                                                                                                                                             32
+#define SIMULATIONS                                                                                                                                                   \
+{                                                                                                                                                                     \
+    { SIMULATION_MARKOVIAN_SIR,                "Markovian SIR",                  MODEL_SIR,  modelling_simulate,               NULL                               },  \
+    { SIMULATION_MARKOVIAN_SIS,                "Markovian SIS",                  MODEL_SIS,  modelling_simulate,               NULL                               },  \
+    { SIMULATION_MARKOVIAN_SEIR,               "Markovian SEIR",                 MODEL_SEIR, modelling_simulate,               NULL                               },  \
+    { SIMULATION_MARKOVIAN_SIR_EXACT,          "Markovian SIR (exact)",          MODEL_SIR,  exact_simulate_model,             NULL                               },  \
+    { SIMULATION_MARKOVIAN_SIS_EXACT,          "Markovian SIS (exact)",          MODEL_SIS,  exact_simulate_model,             NULL                               },  \
+    { SIMULATION_MARKOVIAN_SEIR_EXACT,         "Markovian SEIR (exact)",         MODEL_SEIR, exact_simulate_model,             NULL                               },  \
+    { SIMULATION_MARKOVIAN_SIR_TAU_LEAP,       "Markovian SIR (tau-leap)",       MODEL_SIR,  tau_leap_simulate,                NULL                               },  \
+    { SIMULATION_MARKOVIAN_SIR_GILLESPIE,      "Markovian SIR (Gillespie)",      MODEL_SIR,  gillespie_simulate,               gillespie_trajectory               },  \
+    { SIMULATION_MARKOVIAN_SIS_GILLESPIE,      "Markovian SIS (Gillespie)",      MODEL_SIS,  gillespie_simulate,               gillespie_trajectory               },  \
+    { SIMULATION_MARKOVIAN_SEIR_GILLESPIE,     "Markovian SEIR (Gillespie)",     MODEL_SEIR, gillespie_simulate,               gillespie_trajectory               },  \
+    { SIMULATION_MARKOVIAN_SIR_NEXT_REACTION,  "Markovian SIR (next reaction)",  MODEL_SIR,  gillespie_next_reaction_simulate, gillespie_next_reaction_trajectory },  \
+    { SIMULATION_MARKOVIAN_SIS_NEXT_REACTION,  "Markovian SIS (next reaction)",  MODEL_SIS,  gillespie_next_reaction_simulate, gillespie_next_reaction_trajectory },  \
+    { SIMULATION_MARKOVIAN_SEIR_NEXT_REACTION, "Markovian SEIR (next reaction)", MODEL_SEIR, gillespie_next_reaction_simulate, gillespie_next_reaction_trajectory },  \
+    { SIMULATION_NETWORK_SIR,                  "Network SIR",                    MODEL_SIR,  network_simulate,                 NULL                               },  \
+    { SIMULATION_NETWORK_SIS,                  "Network SIS",                    MODEL_SIS,  network_simulate,                 NULL                               },  \
+    { SIMULATION_METAPOPULATION_SIR,           "Metapopulation SIR",             MODEL_SIR,  metapopulation_simulate,          NULL                               },  \
 }
 
 
@@ -32,7 +74,9 @@ typedef struct
 {
     simulation_enum_t   id;
     char                name[MAX_SIM_NAME_LEN];
+    model_enum_t        model;
     void                (*cb)(context_t* context);
+    data_trajectory_t   trajectory;     /* Replays replicas to save with the results, or NULL */
 } simulation_struct_t;
 
 
@@ -41,6 +85,23 @@ typedef struct
     context_t*          context;
     GObject*            sim_combo_box;
     GObject*            graph_container;
+    GObject*            progress_bar;
+    GObject*            simulate_btn;
+    GObject*            cancel_btn;
+    GObject*            window;
+    uint64_t            seed;
+    /*
+     * A simulation runs on its own thread, on a copy of the context so that
+     * the settings can be changed while it runs. Only that thread touches
+     * run until it has been joined.
+     */
+    context_t           run;
+    int                 sim_index;
+    int                 running;
+    pthread_t           thread;
+    progress_t          progress;
+    histogram_t         partial;        /* Snapshot being drawn while running */
+    gint64              begin;
 } gui_context_t;
 
 
@@ -92,7 +153,14 @@ static gboolean _gui_recovery_rate_cb(GtkSpinButton *spin_button, void* userdata
 
 static gboolean _gui_time_range_cb(GtkSpinButton *spin_button, void* userdata)
 {
-    gui_context.context->bins.size = gtk_spin_button_get_value_as_int(spin_button);
+    histogram_set_limit(&gui_context.context->bins, gtk_spin_button_get_value_as_int(spin_button));
+    return TRUE;
+}
+
+
+static gboolean _gui_incubation_rate_cb(GtkSpinButton *spin_button, void* userdata)
+{
+    gui_context.context->incubation_rate = gtk_spin_button_get_value(spin_button);
     return TRUE;
 }
 
@@ -104,31 +172,168 @@ static gboolean _gui_num_iterations_cb(GtkSpinButton *spin_button, void* userdat
 }
 
 
+static gboolean _gui_gmp_precision_cb(GtkToggleButton *toggle_button, void* userdata)
+{
+    gui_context.context->precision = gtk_toggle_button_get_active(toggle_button) ? PRECISION_GMP : PRECISION_NATIVE;
+    return TRUE;
+}
+
+
+static gboolean _gui_seed_cb(GtkSpinButton *spin_button, void* userdata)
+{
+    gui_context.seed = (uint64_t)gtk_spin_button_get_value(spin_button);
+    return TRUE;
+}
+
+
+static void _gui_set_running(int running)
+{
+    gui_context.running = running;
+    gtk_widget_set_sensitive(GTK_WIDGET(gui_context.simulate_btn), !running);
+    gtk_widget_set_sensitive(GTK_WIDGET(gui_context.cancel_btn), running);
+}
+
+
+static gboolean _gui_progress_cb(void* userdata)
+{
+    /* Runs on the main loop, at most once per GUI_REDRAW_INTERVAL */
+    if (!gui_context.running)
+        return G_SOURCE_REMOVE;
+
+    uint64_t completed = progress_snapshot(&gui_context.progress, &gui_context.partial);
+    uint64_t iterations = gui_context.run.iterations;
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(gui_context.progress_bar), iterations ? (double)completed / iterations : 1.0);
+    char text[64];
+    snprintf(text, sizeof(text), "%" PRIu64 " / %" PRIu64, completed, iterations);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(gui_context.progress_bar), text);
+
+    graph_set_points(&gui_context.partial);
+    gtk_widget_queue_draw(GTK_WIDGET(gui_context.graph_container));
+    return G_SOURCE_REMOVE;
+}
+
+
+static void _gui_progress_notify(void* data)
+{
+    /* Called on an engine thread, GTK may only be used from the main loop */
+    g_idle_add(_gui_progress_cb, NULL);
+}
+
+
+static gboolean _gui_finished_cb(void* userdata)
+{
+    pthread_join(gui_context.thread, NULL);
+    _gui_set_running(0);
+
+    context_t* run = &gui_context.run;
+    uint64_t completed = __atomic_load_n(&gui_context.progress.completed, __ATOMIC_RELAXED);
+    int cancelled = progress_cancelled(&gui_context.progress);
+
+    histogram_print_stats(&run->bins);
+    graph_set_points(&run->bins);
+    gtk_widget_queue_draw(GTK_WIDGET(gui_context.graph_container));
+
+    char text[64];
+    if (cancelled)
+    {
+        printf("Cancelled after %" PRIu64 " of %" PRIu64 " replicas\n", completed, run->iterations);
+        snprintf(text, sizeof(text), "Cancelled at %" PRIu64 " / %" PRIu64, completed, run->iterations);
+    }
+    else
+    {
+        //print_bin_array(bin_array);
+        data_save_data(simulations[gui_context.sim_index].name, run, &run->bins, simulations[gui_context.sim_index].trajectory);
+        chart_write(&run->bins, CHART_FREQUENCY, simulations[gui_context.sim_index].name, DATA_DIR"/graph.png");
+        chart_write(&run->bins, CHART_HISTOGRAM, simulations[gui_context.sim_index].name, DATA_DIR"/hist.png");
+        snprintf(text, sizeof(text), "%" PRIu64 " / %" PRIu64, run->iterations, run->iterations);
+        gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(gui_context.progress_bar), 1.0);
+    }
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(gui_context.progress_bar), text);
+
+    double time_spent = (g_get_monotonic_time() - gui_context.begin) / 1e6;
+    printf("Time spent: %f seconds\n", time_spent);
+    return G_SOURCE_REMOVE;
+}
+
+
+static void* _gui_simulation_thread(void* arg)
+{
+    INSTRUMENT_PHASE_BEGIN(SIMULATE);
+    simulations[gui_context.sim_index].cb(&gui_context.run);
+    INSTRUMENT_PHASE_END(SIMULATE);
+    g_idle_add(_gui_finished_cb, NULL);
+    return NULL;
+}
+
+
 static gboolean _gui_simulate_cb(GtkButton *button, void* userdata)
 {
     int sim_index = gtk_combo_box_get_active(GTK_COMBO_BOX(gui_context.sim_combo_box));
-    if (sim_index >= SIMULATIONS_COUNT)
+    if (sim_index >= SIMULATIONS_COUNT || gui_context.running)
         return FALSE;
-    clock_t begin = clock();
-    srand(time(NULL));
-
-    // simulations[sim_index].cb(gui_context->context);
-    modelling_simulate(gui_context.context);
+    gui_context.begin = g_get_monotonic_time();
+
+    /* A zero seed means a fresh one per run; it is printed so the run can be repeated */
+    gui_context.context->seed = gui_context.seed ? gui_context.seed : (uint64_t)time(NULL);
+    printf("Seed: %lu\n", (unsigned long)gui_context.context->seed);
+
+    gui_context.context->model = simulations[sim_index].model;
+
+    /* The run keeps its own histogram from one simulation to the next */
+    histogram_t bins = gui_context.run.bins;
+    gui_context.run = *gui_context.context;
+    gui_context.run.bins = bins;
+    histogram_set_limit(&gui_context.run.bins, gui_context.context->bins.limit);
+    gui_context.run.progress = &gui_context.progress;
+    progress_reset(&gui_context.progress, gui_context.context->bins.limit);
+    gui_context.sim_index = sim_index;
+
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(gui_context.progress_bar), 0.0);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(gui_context.progress_bar), NULL);
+    _gui_set_running(1);
+    if (pthread_create(&gui_context.thread, NULL, _gui_simulation_thread, NULL) != 0)
+    {
+        printf("Failed to start the simulation thread.\n");
+        _gui_set_running(0);
+        return FALSE;
+    }
+    return TRUE;
+}
 
-    graph_set_points(gui_context.context->bins);
 
-    //print_bin_array(bin_array);
-    data_save_data(gui_context.context->bins, gui_context.context->iterations);
-    data_make_graph_script();
-    data_draw_graph();
-    data_make_hist_script();
-    data_draw_hist();
+static gboolean _gui_cancel_cb(GtkButton *button, void* userdata)
+{
+    /* Engines stop at their next replica and hand back what they have */
+    if (gui_context.running)
+        __atomic_store_n(&gui_context.progress.cancelled, 1, __ATOMIC_RELAXED);
+    return TRUE;
+}
 
-    clock_t end = clock();
-    double time_spent = (double)(end - begin) / CLOCKS_PER_SEC;
-    printf("Time spent: %f seconds\n", time_spent);
 
-    //gtk_widget_queue_draw_area(GTK_WIDGET(gui_context->graph_container), 0, 0, 10, 10);
+static gboolean _gui_open_cb(GtkButton *button, void* userdata)
+{
+    /* Shows a saved result file; the counts are read straight from its mapping */
+    if (gui_context.running)
+        return FALSE;
+    GtkWidget* dialog = gtk_file_chooser_dialog_new("Open results", GTK_WINDOW(gui_context.window), GTK_FILE_CHOOSER_ACTION_OPEN,
+                                                    "_Cancel", GTK_RESPONSE_CANCEL, "_Open", GTK_RESPONSE_ACCEPT, NULL);
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
+    {
+        char* path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+        result_map_t map;
+        if (result_map(&map, path) == 0)
+        {
+            histogram_t view;
+            result_histogram(&map, &view);
+            printf("%s: %s, seed %" PRIu64 ", %s\n", path, map.header->simulation, map.header->seed, map.header->code_version);
+            histogram_print_stats(&view);
+            graph_set_points(&view);
+            gtk_widget_queue_draw(GTK_WIDGET(gui_context.graph_container));
+            result_unmap(&map);
+        }
+        g_free(path);
+    }
+    gtk_widget_destroy(dialog);
     return TRUE;
 }
 
@@ -167,6 +372,7 @@ void gui_init(context_t* context, int* argc, char*** argv)
     }
 
     window  = GTK_WIDGET(gtk_builder_get_object(builder,"window1"));
+    gui_context.window = G_OBJECT(window);
 
     gtk_builder_connect_signals(builder,NULL);
 
@@ -189,18 +395,41 @@ void gui_init(context_t* context, int* argc, char*** argv)
     GObject* recovery_rate_spin_btn = gtk_builder_get_object(builder, "recovery_rate_spin_btn");
     g_signal_connect(recovery_rate_spin_btn, "changed", G_CALLBACK(_gui_recovery_rate_cb), NULL);
 
+    GObject* incubation_rate_spin_btn = gtk_builder_get_object(builder, "incubation_rate_spin_btn");
+    g_signal_connect(incubation_rate_spin_btn, "changed", G_CALLBACK(_gui_incubation_rate_cb), NULL);
+
     GObject* time_range_spin_btn = gtk_builder_get_object(builder, "time_range_spin_btn");
     g_signal_connect(time_range_spin_btn, "changed", G_CALLBACK(_gui_time_range_cb), NULL);
 
     GObject* num_iterations_spin_btn = gtk_builder_get_object(builder, "num_iterations_spin_btn");
     g_signal_connect(num_iterations_spin_btn, "changed", G_CALLBACK(_gui_num_iterations_cb), NULL);
 
-    GObject* simulate_btn = gtk_builder_get_object(builder, "simulate_btn");
-    g_signal_connect(simulate_btn, "pressed", G_CALLBACK(_gui_simulate_cb), NULL);
+    GObject* gmp_precision_check_btn = gtk_builder_get_object(builder, "gmp_precision_check_btn");
+    g_signal_connect(gmp_precision_check_btn, "toggled", G_CALLBACK(_gui_gmp_precision_cb), NULL);
+
+    GObject* seed_spin_btn = gtk_builder_get_object(builder, "seed_spin_btn");
+    g_signal_connect(seed_spin_btn, "changed", G_CALLBACK(_gui_seed_cb), NULL);
+
+    gui_context.simulate_btn = gtk_builder_get_object(builder, "simulate_btn");
+    g_signal_connect(gui_context.simulate_btn, "pressed", G_CALLBACK(_gui_simulate_cb), NULL);
+
+    gui_context.cancel_btn = gtk_builder_get_object(builder, "cancel_btn");
+    g_signal_connect(gui_context.cancel_btn, "clicked", G_CALLBACK(_gui_cancel_cb), NULL);
+
+    GObject* open_btn = gtk_builder_get_object(builder, "open_btn");
+    g_signal_connect(open_btn, "clicked", G_CALLBACK(_gui_open_cb), NULL);
+
+    gui_context.progress_bar = gtk_builder_get_object(builder, "simulation_progress_bar");
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(gui_context.progress_bar), TRUE);
+
+    histogram_init(&gui_context.run.bins, context->bins.limit);
+    histogram_init(&gui_context.partial, context->bins.limit);
+    progress_init(&gui_context.progress, GUI_REDRAW_INTERVAL, _gui_progress_notify, NULL);
 
     gui_context.graph_container = gtk_builder_get_object(builder, "graph_container");
     g_signal_connect(gui_context.graph_container, "draw", G_CALLBACK (graph_draw_cb), NULL);
 
     gtk_widget_show_all(window);
+    _gui_set_running(0);
     gtk_main();
 }
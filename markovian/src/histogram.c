@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "histogram.h"
+
+
+/*
+ * Extinction times below the limit are counted exactly in a dense array that
+ * grows on demand. Anything at or past the limit lands in the overflow bucket
+ * and in a log bucketed sketch (DDSketch, Masson et al.), so quantiles that
+ * fall in the overflow are still known to within 1% relative error. Both
+ * parts merge by adding counts, so per-thread histograms combine exactly.
+ *
+ * Mean and variance cover every sample, overflow included. While only whole
+ * bins are added they follow from exact integer sums of the bins and their
+ * squares, so they do not depend on how the samples were split between
+ * histograms or in which order those were merged. Real valued samples, such
+ * as continuous epidemic durations, are counted in bins of bin_width but
+ * kept exactly in the mean and variance. The first one switches the
+ * histogram to Welford's update, combined with Chan's formula on merge. An
+ * infinite one is a replica cut off at the limit before it ended: it is
+ * counted as censored in the overflow, and left out of the mean and
+ * variance rather than given a made up value.
+ */
+
+
+#define HISTOGRAM_INITIAL_CAPACITY  64
+#define HISTOGRAM_SKETCH_GAMMA      (1.01 / 0.99)
+
+
+static uint32_t _histogram_sketch_index(uint64_t value)
+{
+    if (value == 0)
+        return 0;
+    uint32_t index = 1 + (uint32_t)ceil(log((double)value) / log(HISTOGRAM_SKETCH_GAMMA));
+    return index < HISTOGRAM_SKETCH_BUCKETS ? index : HISTOGRAM_SKETCH_BUCKETS - 1;
+}
+
+
+static uint64_t _histogram_sketch_value(uint32_t index)
+{
+    if (index == 0)
+        return 0;
+    /* Midpoint, in relative terms, of (gamma^(i-1), gamma^i] */
+    double value = 2.0 * pow(HISTOGRAM_SKETCH_GAMMA, index - 1) / (HISTOGRAM_SKETCH_GAMMA + 1.0);
+    return value < 0x1.0p64 ? (uint64_t)llround(value) : UINT64_MAX;
+}
+
+
+static void _histogram_reserve(histogram_t* histogram, uint64_t size)
+{
+    if (size <= histogram->capacity)
+        return;
+    uint64_t capacity = histogram->capacity ? histogram->capacity : HISTOGRAM_INITIAL_CAPACITY;
+    while (capacity < size)
+    {
+        capacity *= 2;
+    }
+    if (capacity > histogram->limit)
+        capacity = histogram->limit;
+
+    uint64_t* counts = (uint64_t*)realloc(histogram->counts, capacity * sizeof(uint64_t));
+    if (counts == NULL)
+    {
+        printf("Failed to grow histogram to %" PRIu64 " bins.\n", capacity);
+        exit(-1);
+    }
+    memset(counts + histogram->capacity, 0, (capacity - histogram->capacity) * sizeof(uint64_t));
+    histogram->counts = counts;
+    histogram->capacity = capacity;
+}
+
+
+void histogram_init(histogram_t* histogram, uint64_t limit)
+{
+    memset(histogram, 0, sizeof(histogram_t));
+    histogram->limit = limit;
+    histogram->bin_width = 1.0;
+    histogram->exact = 1;
+}
+
+
+void histogram_free(histogram_t* histogram)
+{
+    free(histogram->counts);
+    histogram->counts = NULL;
+    histogram->capacity = 0;
+    histogram_reset(histogram);
+}
+
+
+void histogram_reset(histogram_t* histogram)
+{
+    /* Keeps the storage and the limit for the next run */
+    if (histogram->counts)
+        memset(histogram->counts, 0, histogram->capacity * sizeof(uint64_t));
+    histogram->size = 0;
+    histogram->overflow = 0;
+    histogram->total = 0;
+    histogram->censored = 0;
+    histogram->bin_width = 1.0;
+    histogram->mean = 0.0;
+    histogram->m2 = 0.0;
+    histogram->exact = 1;
+    histogram->sum = 0;
+    histogram->sum_squares = 0;
+    memset(histogram->sketch, 0, sizeof(histogram->sketch));
+}
+
+
+void histogram_copy(histogram_t* dst, const histogram_t* src)
+{
+    /* Bit for bit, statistics included, into dst's own storage; limits must agree */
+    histogram_reset(dst);
+    if (src->size)
+    {
+        _histogram_reserve(dst, src->size);
+        memcpy(dst->counts, src->counts, src->size * sizeof(uint64_t));
+    }
+    dst->size = src->size;
+    dst->overflow = src->overflow;
+    dst->total = src->total;
+    dst->censored = src->censored;
+    dst->bin_width = src->bin_width;
+    dst->mean = src->mean;
+    dst->m2 = src->m2;
+    dst->exact = src->exact;
+    dst->sum = src->sum;
+    dst->sum_squares = src->sum_squares;
+    memcpy(dst->sketch, src->sketch, sizeof(dst->sketch));
+}
+
+
+void histogram_set_limit(histogram_t* histogram, uint64_t limit)
+{
+    /* Counts already past the new limit could not be moved, so start over */
+    histogram->limit = limit;
+    if (histogram->capacity > limit)
+    {
+        free(histogram->counts);
+        histogram->counts = NULL;
+        histogram->capacity = 0;
+    }
+    histogram_reset(histogram);
+}
+
+
+static void _histogram_count(histogram_t* histogram, uint64_t value, uint64_t count)
+{
+    if (value < histogram->limit)
+    {
+        _histogram_reserve(histogram, value + 1);
+        histogram->counts[value] += count;
+        if (value >= histogram->size)
+            histogram->size = value + 1;
+    }
+    else
+    {
+        histogram->overflow += count;
+        histogram->sketch[_histogram_sketch_index(value)] += count;
+    }
+}
+
+
+static void _histogram_accumulate(histogram_t* histogram, double value, uint64_t count)
+{
+    /* Welford, weighted by count */
+    histogram->total += count;
+    double delta = value - histogram->mean;
+    histogram->mean += delta * count / (histogram->total - histogram->censored);
+    histogram->m2 += delta * (value - histogram->mean) * count;
+}
+
+
+static void _histogram_moments(histogram_t* histogram)
+{
+    /*
+     * Mean and m2 from the exact sums, around the whole part p of the mean so
+     * that nothing cancels: sum = n·p + r, and the squared deviations from p
+     * total sum_squares - 2p·sum + n·p², which wraps back into range in 128
+     * bits. Subtracting n·(r/n)² moves them to the mean.
+     */
+    uint64_t n = histogram->total - histogram->censored;
+    if (n == 0)
+    {
+        histogram->mean = 0.0;
+        histogram->m2 = 0.0;
+        return;
+    }
+    histogram_sum_t p = histogram->sum / n;
+    uint64_t r = (uint64_t)(histogram->sum % n);
+    histogram_sum_t deviations = histogram->sum_squares - 2 * p * histogram->sum + n * p * p;
+    double width = histogram->bin_width;
+    histogram->mean = ((double)p + (double)r / n) * width;
+    histogram->m2 = ((double)deviations - (double)r * ((double)r / n)) * width * width;
+}
+
+
+void histogram_add(histogram_t* histogram, uint64_t value, uint64_t count)
+{
+    if (count == 0)
+        return;
+    _histogram_count(histogram, value, count);
+    if (!histogram->exact)
+    {
+        _histogram_accumulate(histogram, (double)value * histogram->bin_width, count);
+        return;
+    }
+    histogram->total += count;
+    histogram->sum += (histogram_sum_t)value * count;
+    histogram->sum_squares += (histogram_sum_t)value * value * count;
+    _histogram_moments(histogram);
+}
+
+
+void histogram_add_real(histogram_t* histogram, double value)
+{
+    if (isinf(value))
+    {
+        histogram->overflow++;
+        histogram->total++;
+        histogram->censored++;
+        histogram->exact = 0;
+        return;
+    }
+    double bin = floor(value / histogram->bin_width);
+    _histogram_count(histogram, bin < 0x1.0p64 ? (uint64_t)bin : UINT64_MAX, 1);
+    histogram->exact = 0;
+    _histogram_accumulate(histogram, value, 1);
+}
+
+
+uint64_t histogram_get(const histogram_t* histogram, uint64_t value)
+{
+    return value < histogram->size ? histogram->counts[value] : 0;
+}
+
+
+void histogram_merge(histogram_t* dst, const histogram_t* src)
+{
+    if (src->total == 0)
+        return;
+
+    /* Both sides are expected to share a limit, anything past dst's overflows */
+    for (uint64_t v = 0; v < src->size; v++)
+    {
+        if (src->counts[v] == 0)
+            continue;
+        if (v < dst->limit)
+        {
+            _histogram_reserve(dst, v + 1);
+            dst->counts[v] += src->counts[v];
+            if (v >= dst->size)
+                dst->size = v + 1;
+        }
+        else
+        {
+            dst->overflow += src->counts[v];
+            dst->sketch[_histogram_sketch_index(v)] += src->counts[v];
+        }
+    }
+    dst->overflow += src->overflow;
+    for (uint32_t b = 0; b < HISTOGRAM_SKETCH_BUCKETS; b++)
+    {
+        dst->sketch[b] += src->sketch[b];
+    }
+
+    if (dst->exact && src->exact)
+    {
+        dst->total += src->total;
+        dst->sum += src->sum;
+        dst->sum_squares += src->sum_squares;
+        _histogram_moments(dst);
+        return;
+    }
+    /* Censored replicas have no value to weigh in */
+    uint64_t n_dst = dst->total - dst->censored;
+    uint64_t n_src = src->total - src->censored;
+    dst->total += src->total;
+    dst->censored += src->censored;
+    dst->exact = 0;
+    if (n_src == 0)
+        return;
+    double delta = src->mean - dst->mean;
+    dst->mean += delta * n_src / (n_dst + n_src);
+    dst->m2 += src->m2 + delta * delta * ((double)n_dst * n_src / (n_dst + n_src));
+}
+
+
+int histogram_equal(const histogram_t* a, const histogram_t* b)
+{
+    if (a->size != b->size || a->overflow != b->overflow || a->total != b->total || a->censored != b->censored)
+        return 0;
+    if (a->size && memcmp(a->counts, b->counts, a->size * sizeof(uint64_t)) != 0)
+        return 0;
+    return memcmp(a->sketch, b->sketch, sizeof(a->sketch)) == 0;
+}
+
+
+double histogram_variance(const histogram_t* histogram)
+{
+    uint64_t n = histogram->total - histogram->censored;
+    return n > 1 ? histogram->m2 / (n - 1) : 0.0;
+}
+
+
+uint64_t histogram_quantile(const histogram_t* histogram, double q)
+{
+    if (histogram->total == 0)
+        return 0;
+
+    /* Nearest rank, exact while it falls in range */
+    uint64_t rank = (uint64_t)ceil(q * histogram->total);
+    if (rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    for (uint64_t v = 0; v < histogram->size; v++)
+    {
+        seen += histogram->counts[v];
+        if (seen >= rank)
+            return v;
+    }
+    for (uint32_t b = 0; b < HISTOGRAM_SKETCH_BUCKETS; b++)
+    {
+        seen += histogram->sketch[b];
+        if (seen >= rank)
+        {
+            uint64_t value = _histogram_sketch_value(b);
+            return value < histogram->limit ? histogram->limit : value;
+        }
+    }
+    return histogram->limit;
+}
+
+
+void histogram_print_stats(const histogram_t* histogram)
+{
+    double width = histogram->bin_width;
+    printf("Replicas: %" PRIu64 " (%" PRIu64 " past %.10g)\n",
+           histogram->total, histogram->overflow, histogram->limit * width);
+    if (histogram->censored)
+        printf("Censored: %" PRIu64 " still running at %.10g, left out of the mean and standard deviation\n",
+               histogram->censored, histogram->limit * width);
+    printf("Mean: %f, standard deviation: %f\n", histogram->mean, sqrt(histogram_variance(histogram)));
+    printf("p50: %.10g, p99: %.10g\n",
+           histogram_quantile(histogram, 0.5) * width, histogram_quantile(histogram, 0.99) * width);
+}
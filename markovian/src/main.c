@@ -2,24 +2,57 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 #include <gmp.h>
 
 #include "common.h"
 #include "gui.h"
+#include "instrument.h"
 
 
-static context_t _context = {.bins={.size=100, .array={0}},
-                             .iterations=1000,
-                             .infection_rate=0.01,
-                             .recovery_rate=0.1,
-                             .initial_susceptibles=99,
-                             .initial_infectives=1,
-                             .initial_removed=0,
-                            };
+static context_t _context;
 
 
 int main(int argc, char **argv)
 {
+    /* Before GTK starts any threads, so they all leave SIGUSR1 to the report */
+    INSTRUMENT_START(NULL);
+
+    context_defaults(&_context);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    _context.num_threads = cpus > 0 ? (uint32_t)cpus : 1;
+
+    histogram_init(&_context.bins, 100);
+
+    /*
+     * -c keeps the Markovian engines' progress in a checkpoint file every -i
+     * seconds, and carries on from it when started again with the same
+     * parameters. Set a seed in the GUI for that, a fresh one never matches.
+     */
+    int opt;
+    while ((opt = getopt(argc, argv, "c:i:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                _context.checkpoint_path = optarg;
+                break;
+            case 'i':
+                _context.checkpoint_interval = atof(optarg);
+                break;
+            default:
+                printf("Usage: %s [-c checkpoint] [-i seconds] [network.edges] [coupling.matrix]\n", argv[0]);
+                printf("A checkpoint only resumes a run with the seed set in the GUI, seed 0 picks a new one.\n");
+                return -1;
+        }
+    }
+
+    /* An edge list for the network simulations and a patch coupling matrix */
+    if (argc > optind)
+        _context.network_path = argv[optind];
+    if (argc > optind + 1)
+        _context.coupling_path = argv[optind + 1];
+
     gui_init(&_context, &argc, &argv);
     return 0;
 }
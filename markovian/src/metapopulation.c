@@ -0,0 +1,529 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "metapopulation.h"
+#include "data.h"
+#include "philox.h"
+#include "rng.h"
+#include "variates.h"
+#include "instrument.h"
+
+
+/*
+ * Markovian SIR on coupled patches.
+ *
+ * Within a patch the model is the continuous time SIR of gillespie.c, each
+ * susceptible infected at rate β while the patch has infectives and each
+ * infective recovering at rate γ. Individuals of every compartment move from
+ * patch p to q at rate coupling[p][q].
+ *
+ * Patches are split between worker threads and stepped independently up to
+ * the next synchronisation point, coupling_interval apart. Movement is then
+ * exchanged in one batch: each patch draws how many of its n individuals
+ * leave, Bin(n, 1 - e^(-leaving · interval)), which compartments they come
+ * from, and splits them between the destinations with conditional
+ * binomials. Moves happen at the synchronisation points rather than during
+ * the interval, an error that shrinks with the interval.
+ *
+ * Each patch of replica i draws from its own generator, seeded from Philox
+ * stream i · patches + p, so results do not depend on the thread count.
+ *
+ * Without a coupling file every patch starts with the initial susceptibles
+ * and removed, infectives are seeded in patch 0 only, and every pair of
+ * patches is coupled at coupling_rate / (patches - 1).
+ */
+
+
+/* Fewer leavers than this pick their destinations one by one */
+#define METAPOPULATION_DIRECT_MOVES     32
+#define METAPOPULATION_MAX_MOVES(n)     (3 * ((uint64_t)(n) + METAPOPULATION_DIRECT_MOVES))
+
+
+/* Individuals of one compartment moving to one patch */
+typedef struct
+{
+    uint32_t    destination;
+    uint32_t    compartment;
+    uint32_t    count;
+} metapopulation_move_t;
+
+
+typedef struct metapopulation_worker_s metapopulation_worker_t;
+
+
+typedef struct
+{
+    context_t*                  context;
+    metapopulation_t*           metapopulation;
+    metapopulation_worker_t*    workers;
+    pthread_barrier_t           barrier;
+    double                      horizon;
+    uint32_t                    num_threads;
+    metapopulation_move_t*      moves;          /* METAPOPULATION_MAX_MOVES(num_patches) per source patch */
+    uint32_t*                   num_moves;      /* Per source patch, this interval */
+    rng_t*                      rngs;           /* One per patch */
+    histogram_t*                durations;      /* Per patch */
+    histogram_t*                final_sizes;    /* Per patch */
+    histogram_t                 final_size;     /* All patches together */
+    histogram_t                 chunk;          /* The last replica, when progress is watched */
+    int                         cancelled;      /* Read by every worker after each replica */
+} metapopulation_run_t;
+
+
+struct metapopulation_worker_s
+{
+    metapopulation_run_t*   run;
+    uint32_t                first;          /* Patches first .. last - 1 */
+    uint32_t                last;
+    uint64_t                infectives;     /* In this worker's patches, after the last exchange */
+};
+
+
+static void* _metapopulation_alloc(size_t count, size_t size)
+{
+    void* ptr = calloc(count ? count : 1, size);
+    if (ptr == NULL)
+    {
+        printf("Failed to allocate %zu patch values.\n", count);
+        exit(-1);
+    }
+    return ptr;
+}
+
+
+static int _metapopulation_load_coupling(metapopulation_t* metapopulation, const char* path)
+{
+    /* The number of patches, then that many rows of rates, row p to column q */
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        printf("Cannot open coupling matrix %s.\n", path);
+        return -1;
+    }
+    uint32_t num_patches;
+    if (fscanf(fp, "%u", &num_patches) != 1 || num_patches == 0)
+    {
+        printf("Coupling matrix %s does not start with the number of patches.\n", path);
+        fclose(fp);
+        return -1;
+    }
+    metapopulation->num_patches = num_patches;
+    metapopulation->coupling = (double*)_metapopulation_alloc((size_t)num_patches * num_patches, sizeof(double));
+    for (uint64_t k = 0; k < (uint64_t)num_patches * num_patches; k++)
+    {
+        if (fscanf(fp, "%lf", &metapopulation->coupling[k]) != 1 || metapopulation->coupling[k] < 0.0)
+        {
+            printf("Bad coupling rate %" PRIu64 " in %s.\n", k, path);
+            fclose(fp);
+            free(metapopulation->coupling);
+            metapopulation->coupling = NULL;
+            return -1;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+
+int metapopulation_init(metapopulation_t* metapopulation, const context_t* context)
+{
+    memset(metapopulation, 0, sizeof(metapopulation_t));
+    if (context->coupling_path != NULL)
+    {
+        if (_metapopulation_load_coupling(metapopulation, context->coupling_path) != 0)
+            return -1;
+    }
+    else
+    {
+        uint32_t num_patches = context->num_patches > 0 ? context->num_patches : 1;
+        double rate = num_patches > 1 ? context->coupling_rate / (num_patches - 1) : 0.0;
+        metapopulation->num_patches = num_patches;
+        metapopulation->coupling = (double*)_metapopulation_alloc((size_t)num_patches * num_patches, sizeof(double));
+        for (uint64_t k = 0; k < (uint64_t)num_patches * num_patches; k++)
+        {
+            metapopulation->coupling[k] = rate;
+        }
+    }
+
+    uint32_t n = metapopulation->num_patches;
+    metapopulation->susceptibles = (uint32_t*)_metapopulation_alloc(n, sizeof(uint32_t));
+    metapopulation->infectives = (uint32_t*)_metapopulation_alloc(n, sizeof(uint32_t));
+    metapopulation->removed = (uint32_t*)_metapopulation_alloc(n, sizeof(uint32_t));
+    metapopulation->infections = (uint32_t*)_metapopulation_alloc(n, sizeof(uint32_t));
+    metapopulation->last_active = (double*)_metapopulation_alloc(n, sizeof(double));
+    metapopulation->cumulative = (double*)_metapopulation_alloc((size_t)n * n, sizeof(double));
+    metapopulation->leaving = (double*)_metapopulation_alloc(n, sizeof(double));
+    for (uint32_t p = 0; p < n; p++)
+    {
+        /* Staying put is not a move */
+        metapopulation->coupling[(uint64_t)p * n + p] = 0.0;
+        for (uint32_t q = 0; q < n; q++)
+        {
+            metapopulation->leaving[p] += metapopulation->coupling[(uint64_t)p * n + q];
+            metapopulation->cumulative[(uint64_t)p * n + q] = metapopulation->leaving[p];
+        }
+    }
+    return 0;
+}
+
+
+void metapopulation_free(metapopulation_t* metapopulation)
+{
+    free(metapopulation->susceptibles);
+    free(metapopulation->infectives);
+    free(metapopulation->removed);
+    free(metapopulation->infections);
+    free(metapopulation->last_active);
+    free(metapopulation->coupling);
+    free(metapopulation->cumulative);
+    free(metapopulation->leaving);
+    memset(metapopulation, 0, sizeof(metapopulation_t));
+}
+
+
+static void _metapopulation_step(metapopulation_t* metapopulation, rng_t* rng, uint32_t p,
+                                 double time, double until, double beta, double gamma)
+{
+    /* Gillespie's direct method within one patch, up to the next synchronisation */
+    uint32_t susceptibles = metapopulation->susceptibles[p];
+    uint32_t infectives = metapopulation->infectives[p];
+    uint32_t infections = 0;
+    uint32_t recoveries = 0;
+
+    while (infectives > 0)
+    {
+        double infection = beta * susceptibles;
+        double total = infection + gamma * infectives;
+        if (total <= 0.0)
+            break;
+        time -= log1p(-rng_uniform(rng)) / total;
+        if (time >= until)
+            break;
+        if (rng_uniform(rng) * total < infection)
+        {
+            susceptibles--;
+            infectives++;
+            infections++;
+        }
+        else
+        {
+            infectives--;
+            recoveries++;
+            if (infectives == 0)
+                metapopulation->last_active[p] = time;
+        }
+    }
+
+    metapopulation->susceptibles[p] = susceptibles;
+    metapopulation->infectives[p] = infectives;
+    metapopulation->removed[p] += recoveries;
+    metapopulation->infections[p] += infections;
+    INSTRUMENT_COUNT(EVENTS, infections + recoveries);
+}
+
+
+static void _metapopulation_emigrate(metapopulation_run_t* run, uint32_t p, double time)
+{
+    metapopulation_t* metapopulation = run->metapopulation;
+    uint32_t n = metapopulation->num_patches;
+    uint32_t* counts[3] = { metapopulation->susceptibles, metapopulation->infectives, metapopulation->removed };
+    double p_leave = -expm1(-metapopulation->leaving[p] * run->context->coupling_interval);
+    const double* row = &metapopulation->coupling[(uint64_t)p * n];
+    const double* cumulative = &metapopulation->cumulative[(uint64_t)p * n];
+    metapopulation_move_t* moves = &run->moves[p * METAPOPULATION_MAX_MOVES(n)];
+    uint32_t num_moves = 0;
+    int active = metapopulation->infectives[p] > 0;
+
+    /*
+     * One binomial for everyone leaving, then which compartments they came
+     * from, drawn without replacement. Usually nobody leaves, so this is one
+     * draw per patch rather than one per compartment.
+     */
+    uint32_t population = counts[0][p] + counts[1][p] + counts[2][p];
+    uint32_t leaving = population > 0 && p_leave > 0.0 ? variates_binomial(&run->rngs[p], population, p_leave) : 0;
+    uint32_t leavers[3] = { 0, 0, 0 };
+    for (uint32_t k = 0; k < leaving; k++)
+    {
+        uint64_t r = rng_bounded(&run->rngs[p], population - k);
+        uint32_t c = r < counts[0][p] ? 0 : r < (uint64_t)counts[0][p] + counts[1][p] ? 1 : 2;
+        counts[c][p]--;
+        leavers[c]++;
+    }
+
+    for (uint32_t c = 0; c < 3; c++)
+    {
+        uint32_t remaining = leavers[c];
+
+        /* A few leavers each pick a destination by bisecting the row */
+        if (remaining < METAPOPULATION_DIRECT_MOVES)
+        {
+            for (; remaining > 0; remaining--)
+            {
+                double u = rng_uniform(&run->rngs[p]) * metapopulation->leaving[p];
+                uint32_t lower = 0;
+                uint32_t upper = n - 1;
+                while (lower < upper)
+                {
+                    uint32_t middle = lower + (upper - lower) / 2;
+                    if (cumulative[middle] > u)
+                        upper = middle;
+                    else
+                        lower = middle + 1;
+                }
+                moves[num_moves].destination = lower;
+                moves[num_moves].compartment = c;
+                moves[num_moves].count = 1;
+                num_moves++;
+            }
+            continue;
+        }
+
+        /* Otherwise a multinomial split over destinations, stopping once everyone is placed */
+        double rate_left = metapopulation->leaving[p];
+        for (uint32_t q = 0; q < n && remaining > 0; q++)
+        {
+            if (row[q] <= 0.0)
+                continue;
+            uint32_t moved = row[q] >= rate_left ? remaining : variates_binomial(&run->rngs[p], remaining, row[q] / rate_left);
+            if (moved > 0)
+            {
+                moves[num_moves].destination = q;
+                moves[num_moves].compartment = c;
+                moves[num_moves].count = moved;
+                num_moves++;
+            }
+            remaining -= moved;
+            rate_left -= row[q];
+        }
+    }
+    run->num_moves[p] = num_moves;
+
+    /* A patch can also lose its last infective by emigration */
+    if (active && metapopulation->infectives[p] == 0)
+        metapopulation->last_active[p] = time;
+}
+
+
+static void _metapopulation_immigrate(metapopulation_run_t* run, uint32_t first, uint32_t last)
+{
+    /* Moves are sparse, so every worker reads all of them and keeps its own */
+    metapopulation_t* metapopulation = run->metapopulation;
+    uint32_t n = metapopulation->num_patches;
+    uint32_t* counts[3] = { metapopulation->susceptibles, metapopulation->infectives, metapopulation->removed };
+
+    for (uint32_t p = 0; p < n; p++)
+    {
+        const metapopulation_move_t* moves = &run->moves[p * METAPOPULATION_MAX_MOVES(n)];
+        for (uint32_t m = 0; m < run->num_moves[p]; m++)
+        {
+            if (moves[m].destination >= first && moves[m].destination < last)
+                counts[moves[m].compartment][moves[m].destination] += moves[m].count;
+        }
+    }
+}
+
+
+static uint64_t _metapopulation_count(const uint32_t* counts, uint32_t first, uint32_t last)
+{
+    uint64_t total = 0;
+    for (uint32_t p = first; p < last; p++)
+    {
+        total += counts[p];
+    }
+    return total;
+}
+
+
+static void _metapopulation_record(metapopulation_run_t* run)
+{
+    /* Aggregate results of one replica, once every patch has finished */
+    metapopulation_t* metapopulation = run->metapopulation;
+    uint32_t n = metapopulation->num_patches;
+    double duration = 0.0;
+    for (uint32_t p = 0; p < n; p++)
+    {
+        duration = fmax(duration, metapopulation->last_active[p]);
+    }
+    if (_metapopulation_count(metapopulation->infectives, 0, n) > 0)
+        duration = INFINITY;
+    histogram_add_real(&run->context->bins, duration);
+    histogram_add(&run->final_size, _metapopulation_count(metapopulation->infections, 0, n), 1);
+
+    if (run->context->progress != NULL)
+    {
+        histogram_reset(&run->chunk);
+        run->chunk.bin_width = run->context->time_bin_width;
+        histogram_add_real(&run->chunk, duration);
+        progress_add(run->context->progress, &run->chunk, 1);
+        run->cancelled = progress_cancelled(run->context->progress);
+    }
+}
+
+
+static void* _metapopulation_worker(void* arg)
+{
+    metapopulation_worker_t* worker = (metapopulation_worker_t*)arg;
+    metapopulation_run_t* run = worker->run;
+    context_t* context = run->context;
+    metapopulation_t* metapopulation = run->metapopulation;
+    uint32_t n = metapopulation->num_patches;
+    double beta = context->infection_rate;
+    double gamma = context->recovery_rate;
+    double interval = context->coupling_interval > 0.0 ? context->coupling_interval : run->horizon;
+
+    for (uint64_t i = 0; i < context->iterations; i++)
+    {
+        for (uint32_t p = worker->first; p < worker->last; p++)
+        {
+            metapopulation->susceptibles[p] = context->initial_susceptibles;
+            metapopulation->infectives[p] = p == 0 ? context->initial_infectives : 0;
+            metapopulation->removed[p] = context->initial_removed;
+            metapopulation->infections[p] = 0;
+            metapopulation->last_active[p] = 0.0;
+            philox_t philox;
+            philox_init(&philox, context->seed, i * n + p);
+            rng_seed(&run->rngs[p], philox_next64(&philox));
+        }
+        worker->infectives = _metapopulation_count(metapopulation->infectives, worker->first, worker->last);
+
+        /*
+         * Three barriers per interval: after stepping, after emigration and
+         * after immigration. Each worker then sums the infective counts the
+         * others left behind, so all agree on when the epidemic is over.
+         */
+        double time = 0.0;
+        for (;;)
+        {
+            pthread_barrier_wait(&run->barrier);
+            uint64_t infectives = 0;
+            for (uint32_t t = 0; t < run->num_threads; t++)
+            {
+                infectives += run->workers[t].infectives;
+            }
+            if (infectives == 0 || time >= run->horizon)
+                break;
+
+            double until = fmin(time + interval, run->horizon);
+            for (uint32_t p = worker->first; p < worker->last; p++)
+            {
+                _metapopulation_step(metapopulation, &run->rngs[p], p, time, until, beta, gamma);
+            }
+            pthread_barrier_wait(&run->barrier);
+            if (until < run->horizon)
+            {
+                for (uint32_t p = worker->first; p < worker->last; p++)
+                {
+                    _metapopulation_emigrate(run, p, until);
+                }
+                pthread_barrier_wait(&run->barrier);
+                _metapopulation_immigrate(run, worker->first, worker->last);
+            }
+            pthread_barrier_wait(&run->barrier);
+            worker->infectives = _metapopulation_count(metapopulation->infectives, worker->first, worker->last);
+            time = until;
+        }
+
+        /* Patches still running at the horizon are censored, counted past it with no duration */
+        for (uint32_t p = worker->first; p < worker->last; p++)
+        {
+            double duration = metapopulation->infectives[p] > 0 ? INFINITY : metapopulation->last_active[p];
+            histogram_add_real(&run->durations[p], duration);
+            histogram_add(&run->final_sizes[p], metapopulation->infections[p], 1);
+        }
+        pthread_barrier_wait(&run->barrier);
+        if (worker == &run->workers[0])
+            _metapopulation_record(run);
+        pthread_barrier_wait(&run->barrier);
+        /* Worker 0 decides for everyone, so all stop after the same replica */
+        if (run->cancelled)
+            break;
+    }
+    return NULL;
+}
+
+
+void metapopulation_simulate(context_t* context)
+{
+    printf("Infection Rate: %f\n", context->infection_rate);
+
+    histogram_reset(&context->bins);
+    context->bins.bin_width = context->time_bin_width;
+
+    metapopulation_t metapopulation;
+    if (metapopulation_init(&metapopulation, context) != 0)
+        return;
+    uint32_t n = metapopulation.num_patches;
+    printf("Patches: %u\n", n);
+
+    metapopulation_run_t run;
+    run.context = context;
+    run.metapopulation = &metapopulation;
+    run.horizon = context->bins.limit * context->time_bin_width;
+    run.num_threads = context->num_threads == 0 ? 1 : context->num_threads < n ? context->num_threads : n;
+    run.moves = (metapopulation_move_t*)_metapopulation_alloc(n * METAPOPULATION_MAX_MOVES(n), sizeof(metapopulation_move_t));
+    run.num_moves = (uint32_t*)_metapopulation_alloc(n, sizeof(uint32_t));
+    run.rngs = (rng_t*)_metapopulation_alloc(n, sizeof(rng_t));
+    run.durations = (histogram_t*)_metapopulation_alloc(n, sizeof(histogram_t));
+    run.final_sizes = (histogram_t*)_metapopulation_alloc(n, sizeof(histogram_t));
+    uint64_t patch_size = (uint64_t)context->initial_susceptibles + context->initial_infectives + context->initial_removed;
+    for (uint32_t p = 0; p < n; p++)
+    {
+        histogram_init(&run.durations[p], context->bins.limit);
+        run.durations[p].bin_width = context->time_bin_width;
+        histogram_init(&run.final_sizes[p], patch_size + 1);
+    }
+    histogram_init(&run.final_size, n * patch_size + 1);
+    histogram_init(&run.chunk, context->bins.limit);
+    run.cancelled = 0;
+    run.workers = (metapopulation_worker_t*)_metapopulation_alloc(run.num_threads, sizeof(metapopulation_worker_t));
+    pthread_t* threads = (pthread_t*)_metapopulation_alloc(run.num_threads, sizeof(pthread_t));
+    pthread_barrier_init(&run.barrier, NULL, run.num_threads);
+
+    for (uint32_t t = 0; t < run.num_threads; t++)
+    {
+        run.workers[t].run = &run;
+        run.workers[t].first = (uint32_t)((uint64_t)n * t / run.num_threads);
+        run.workers[t].last = (uint32_t)((uint64_t)n * (t + 1) / run.num_threads);
+    }
+    for (uint32_t t = 1; t < run.num_threads; t++)
+    {
+        if (pthread_create(&threads[t], NULL, _metapopulation_worker, &run.workers[t]) != 0)
+        {
+            printf("Failed to start worker thread %u.\n", t);
+            exit(-1);
+        }
+    }
+    /* The calling thread is worker 0 */
+    _metapopulation_worker(&run.workers[0]);
+    for (uint32_t t = 1; t < run.num_threads; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+
+    printf("Final size:\n");
+    histogram_print_stats(&run.final_size);
+    printf("Duration:\n");
+    data_save_patches(run.durations, run.final_sizes, n);
+
+    pthread_barrier_destroy(&run.barrier);
+    for (uint32_t p = 0; p < n; p++)
+    {
+        histogram_free(&run.durations[p]);
+        histogram_free(&run.final_sizes[p]);
+    }
+    histogram_free(&run.final_size);
+    histogram_free(&run.chunk);
+    free(run.moves);
+    free(run.num_moves);
+    free(run.rngs);
+    free(run.durations);
+    free(run.final_sizes);
+    free(run.workers);
+    free(threads);
+    metapopulation_free(&metapopulation);
+}
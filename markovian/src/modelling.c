@@ -2,10 +2,26 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
+#include <math.h>
+#include <pthread.h>
 #include <gmp.h>
 
 
 #include "modelling.h"
+#include "models.h"
+#include "philox.h"
+#include "checkpoint.h"
+#include "instrument.h"
+
+
+/* Replicas handed to a worker at a time */
+#define MODELLING_REPLICA_CHUNK     256
+/* Uniforms generated per refill of a replica's buffer */
+#define MODELLING_UNIFORM_BLOCK     16
+/* Steps of a run checked one by one before bisecting on the closed form */
+#define MODELLING_RUN_SCAN          8
+/* A 53 bit uniform rescaled past this has fewer than 32 bits left */
+#define MODELLING_MIN_UNIFORM_WIDTH 0x1.0p-21
 
 
 typedef struct
@@ -16,24 +32,52 @@ typedef struct
 } modelling_markovian_frame_t;
 
 
-static uint16_t _modelling_generate_random_integer(uint16_t start, uint16_t end)
+typedef struct
+{
+    philox_t        philox;
+    uint32_t        next;
+    double          uniforms[MODELLING_UNIFORM_BLOCK];
+} modelling_rng_t;
+
+
+typedef struct
+{
+    context_t*      context;
+    uint64_t*       next_replica;
+    uint64_t        deadline;       /* Monotonic ns after which no chunk is claimed, 0 for none */
+    histogram_t     bins;
+    histogram_t     chunk;          /* Counts of the last chunk, when progress is watched */
+} modelling_worker_t;
+
+
+static uint64_t _modelling_now(void)
 {
-    uint16_t rand_int = rand() % (end + 1 - start) + start;
-    return rand_int;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
 }
 
 
-static void _modelling_generate_random_mpf(mpf_t* rand_float)
+static double _modelling_generate_random_double(modelling_rng_t* rng)
 {
-    uint64_t step = 10000;
-    uint16_t rand_int = _modelling_generate_random_integer(0, step);
-    mpf_set_ui(*rand_float, step);
-    mpf_ui_div(*rand_float, 1, *rand_float);
-    mpf_mul_ui(*rand_float, *rand_float, rand_int);
+    /* Uniforms are produced a block at a time so the event loop only indexes */
+    if (rng->next == MODELLING_UNIFORM_BLOCK)
+    {
+        philox_fill_uniform(&rng->philox, rng->uniforms, MODELLING_UNIFORM_BLOCK);
+        rng->next = 0;
+    }
+    return rng->uniforms[rng->next++];
 }
 
 
-static void _modelling_markovian_SIR_timestep(modelling_markovian_frame_t* frame, double* infection_rate, double* recovery_rate)
+static void _modelling_generate_random_mpf(modelling_rng_t* rng, mpf_t* rand_float)
+{
+    /* Same draw as _modelling_generate_random_double(), 53 bits are exact in an mpf */
+    mpf_set_d(*rand_float, _modelling_generate_random_double(rng));
+}
+
+
+static void _modelling_markovian_SIR_timestep(modelling_rng_t* rng, modelling_markovian_frame_t* frame, double* infection_rate, double* recovery_rate)
 {
     /*
      * Avg Infected  = Infection Rate · Number of Susceptibles
@@ -65,8 +109,9 @@ static void _modelling_markovian_SIR_timestep(modelling_markovian_frame_t* frame
 
     mpf_t rand_float;
     mpf_init(rand_float);
+    INSTRUMENT_COUNT(MPF_INITS, 4);
 
-    _modelling_generate_random_mpf(&rand_float);
+    _modelling_generate_random_mpf(rng, &rand_float);
     if (mpf_cmp(rand_float, prob_infection) < 0)
     {
         frame->susceptibles--;
@@ -82,58 +127,210 @@ static void _modelling_markovian_SIR_timestep(modelling_markovian_frame_t* frame
 }
 
 
-void _modelling_markovian_SIS_timestep(modelling_markovian_frame_t* frame, double* infection_rate, double* recovery_rate)
+/*
+ * Event skipping. From (S, I) the chain makes M further infections in a row
+ * with probability
+ *
+ *     P(M >= m) = prod_{j<m} β(S-j) / (β(S-j) + γ(I+j))
+ *
+ * and R further recoveries in a row with
+ *
+ *     P(R >= m) = prod_{j<m} γ(I-j) / (γ(I-j) + βS)
+ *
+ * A run ends with the other transition, so inverting one uniform against these
+ * survival products gives a whole run, and the event after it, for one draw.
+ * The first few factors are multiplied out directly. Past that the products
+ * are ratios of gamma functions, and the run length is found by bisection on
+ * their logarithm.
+ *
+ * Most runs are short, so a short run does not spend its uniform: where u fell
+ * within the interval of the chosen outcome is itself uniform, and is reused
+ * for the next run. A fresh draw is taken once the intervals used up leave
+ * the recycled uniform coarser than about 2^-32.
+ */
+
+
+typedef struct
 {
-    mpf_t avg_infected;
-    mpf_init(avg_infected);
+    modelling_rng_t*    rng;
+    double              u;
+    double              width;      /* Product of the intervals u was rescaled from */
+} modelling_run_uniform_t;
 
-    mpf_t avg_recovered;
-    mpf_init(avg_recovered);
 
-    mpf_t prob_infection;
-    mpf_init(prob_infection);
+static double _modelling_lgamma_ratio(double x, double m)
+{
+    /* log(Γ(x + m) / Γ(x)), without the cancellation of two large lgamma() */
+    if (x < 10.0)
+        return lgamma(x + m) - lgamma(x);
+    double y = x + m;
+    double correction_x = 1.0 / (12.0 * x) - 1.0 / (360.0 * x * x * x);
+    double correction_y = 1.0 / (12.0 * y) - 1.0 / (360.0 * y * y * y);
+    return (x - 0.5) * log1p(m / x) + m * log(y) - m + correction_y - correction_x;
+}
 
-    mpf_set_d(avg_infected, *infection_rate);
-    mpf_set_d(avg_recovered, *recovery_rate);
 
-    mpf_mul_ui(avg_infected, avg_infected, frame->susceptibles);
-    mpf_mul_ui(avg_recovered, avg_recovered, frame->infectives);
-    mpf_add(prob_infection, avg_infected, avg_recovered);
-    mpf_div(prob_infection, avg_infected, prob_infection);
+static double _modelling_log_infection_run(uint32_t s, uint32_t i, double r, uint32_t m)
+{
+    /* With r = γ/β the j-th denominator, over β, is S + rI + (r - 1)j */
+    double log_numerator = _modelling_lgamma_ratio(s - m + 1.0, m);
+    double log_denominator;
+    if (r > 1.0)
+    {
+        double a = (s + r * i) / (r - 1.0);
+        log_denominator = m * log(r - 1.0) + _modelling_lgamma_ratio(a, m);
+    }
+    else if (r < 1.0)
+    {
+        double b = (s + r * i) / (1.0 - r);
+        log_denominator = m * log(1.0 - r) + _modelling_lgamma_ratio(b - m + 1.0, m);
+    }
+    else
+    {
+        log_denominator = m * log((double)s + i);
+    }
+    return log_numerator - log_denominator;
+}
 
-    mpf_clear(avg_infected);
-    mpf_clear(avg_recovered);
 
-    mpf_t rand_float;
-    mpf_init(rand_float);
+static double _modelling_log_recovery_run(uint32_t i, double c, uint32_t m)
+{
+    /* With c = βS/γ the j-th factor is (I - j) / (I - j + c) */
+    return _modelling_lgamma_ratio(i - m + 1.0, m) - _modelling_lgamma_ratio(i + c - m + 1.0, m);
+}
 
-    _modelling_generate_random_mpf(&rand_float);
-    if (mpf_cmp(rand_float, prob_infection) < 0)
+
+static double _modelling_run_uniform(modelling_run_uniform_t* uniform)
+{
+    if (uniform->width < MODELLING_MIN_UNIFORM_WIDTH)
     {
-        frame->susceptibles--;
-        frame->infectives++;
+        uniform->u = _modelling_generate_random_double(uniform->rng);
+        uniform->width = 1.0;
     }
-    else
+    return uniform->u;
+}
+
+
+static void _modelling_run_uniform_recycle(modelling_run_uniform_t* uniform, double lower, double upper)
+{
+    /* Given lower <= u < upper, the position of u within it is a fresh uniform */
+    double residual = (uniform->u - lower) / (upper - lower);
+    uniform->width *= upper - lower;
+    uniform->u = residual;
+    if (!(residual > 0.0 && residual < 1.0))
+        uniform->width = 0.0;
+}
+
+
+static uint32_t _modelling_infection_run(modelling_run_uniform_t* uniform, uint32_t s, uint32_t i, double beta, double gamma)
+{
+    double u = _modelling_run_uniform(uniform);
+    double survival = 1.0;
+    uint32_t m = 0;
+    for (; m < MODELLING_RUN_SCAN; m++)
     {
-        frame->infectives--;
-        frame->susceptibles++;
+        if (m == s)
+        {
+            _modelling_run_uniform_recycle(uniform, 0.0, survival);
+            return s;
+        }
+        double next = survival * beta * (s - m) / (beta * (s - m) + gamma * (i + m));
+        if (next <= u)
+        {
+            _modelling_run_uniform_recycle(uniform, next, survival);
+            return m;
+        }
+        survival = next;
     }
-    mpf_clear(rand_float);
-    mpf_clear(prob_infection);
+
+    /* P(M >= lower) > u, find the largest such lower. The uniform is spent. */
+    uniform->width = 0.0;
+    double r = gamma / beta;
+    double log_u = log(u);
+    uint32_t lower = m;
+    uint32_t upper = s;
+    if (_modelling_log_infection_run(s, i, r, upper) > log_u)
+        return s;
+    while (upper - lower > 1)
+    {
+        uint32_t mid = lower + (upper - lower) / 2;
+        if (_modelling_log_infection_run(s, i, r, mid) > log_u)
+            lower = mid;
+        else
+            upper = mid;
+    }
+    return lower;
 }
 
 
-static timestep_t _modelling_simulate_markovian(double* infection_rate, double* recovery_rate, uint32_t initial_susceptibles, uint32_t initial_infectives)
+static uint32_t _modelling_recovery_run(modelling_run_uniform_t* uniform, uint32_t s, uint32_t i, double beta, double gamma)
 {
-    modelling_markovian_frame_t frame;
-    frame.susceptibles = initial_susceptibles;
-    frame.infectives = initial_infectives;
-    frame.removed = 0;
+    if (s == 0)
+        return i;
+
+    double u = _modelling_run_uniform(uniform);
+    double survival = 1.0;
+    uint32_t m = 0;
+    for (; m < MODELLING_RUN_SCAN; m++)
+    {
+        if (m == i)
+        {
+            _modelling_run_uniform_recycle(uniform, 0.0, survival);
+            return i;
+        }
+        double next = survival * gamma * (i - m) / (gamma * (i - m) + beta * s);
+        if (next <= u)
+        {
+            _modelling_run_uniform_recycle(uniform, next, survival);
+            return m;
+        }
+        survival = next;
+    }
+
+    uniform->width = 0.0;
+    double c = beta * s / gamma;
+    double log_u = log(u);
+    uint32_t lower = m;
+    uint32_t upper = i;
+    if (_modelling_log_recovery_run(i, c, upper) > log_u)
+        return i;
+    while (upper - lower > 1)
+    {
+        uint32_t mid = lower + (upper - lower) / 2;
+        if (_modelling_log_recovery_run(i, c, mid) > log_u)
+            lower = mid;
+        else
+            upper = mid;
+    }
+    return lower;
+}
+
+
+static timestep_t _modelling_simulate_markovian_runs(modelling_rng_t* rng, double beta, double gamma, uint32_t initial_susceptibles, uint32_t initial_infectives)
+{
+    uint32_t s = initial_susceptibles;
+    uint32_t i = initial_infectives;
     timestep_t timestep = 0;
+    modelling_run_uniform_t uniform = {.rng=rng, .u=0.0, .width=0.0};
 
-    while (frame.infectives > 0)
+    while (i > 0)
     {
-        _modelling_markovian_SIR_timestep(&frame, infection_rate, recovery_rate);
+        /* Infections, then the recovery that ended the run */
+        uint32_t infections = _modelling_infection_run(&uniform, s, i, beta, gamma);
+        s -= infections;
+        i += infections - 1;
+        timestep += infections + 1;
+        if (i == 0)
+            break;
+
+        /* Recoveries, then the infection that ended the run */
+        uint32_t recoveries = _modelling_recovery_run(&uniform, s, i, beta, gamma);
+        i -= recoveries;
+        timestep += recoveries;
+        if (i == 0)
+            break;
+        s--;
+        i++;
         timestep++;
     }
 
@@ -141,21 +338,240 @@ static timestep_t _modelling_simulate_markovian(double* infection_rate, double*
 }
 
 
+/*
+ * One event loop per model, expanded from its table in models.h. Rates,
+ * stoichiometry and the number of compartments and transitions are all
+ * constants here, so the compiler unrolls the loops and folds the updates.
+ * Events are chosen by comparing u against cumulative shares of the total
+ * rate, which for two events is the u < a / (a + b) test of the GMP kernel.
+ * Models that need not die out are stopped after max_steps events.
+ */
+#define MODELLING_DEFINE_KERNEL(id)                                                         \
+static timestep_t _modelling_simulate_##id(modelling_rng_t* rng, const model_params_t* params, uint32_t* x, timestep_t max_steps) \
+{                                                                                           \
+    static const int8_t stoichiometry[][MODEL_NUM_COMPARTMENTS(id)] = {                     \
+        MODEL_##id##_TRANSITIONS(MODEL_STOICHIOMETRY, id)                                   \
+    };                                                                                      \
+    MODEL_LOAD_PARAMS(params)                                                               \
+    timestep_t timestep = 0;                                                                \
+    for (; timestep < max_steps; timestep++)                                                \
+    {                                                                                       \
+        MODEL_LOAD_STATE(id)                                                                \
+        if (!(MODEL_##id##_ACTIVE))                                                         \
+            break;                                                                          \
+        const double rates[] = { MODEL_##id##_TRANSITIONS(MODEL_RATE, id) };                \
+        double total = 0.0;                                                                 \
+        for (uint32_t t = 0; t < MODEL_NUM_TRANSITIONS(id); t++)                            \
+        {                                                                                   \
+            total += rates[t];                                                              \
+        }                                                                                   \
+        if (!(total > 0.0))                                                                 \
+            break;                                                                          \
+                                                                                            \
+        double u = _modelling_generate_random_double(rng);                                  \
+        double cumulative = 0.0;                                                            \
+        uint32_t event = MODEL_NUM_TRANSITIONS(id) - 1;                                     \
+        for (uint32_t t = 0; t + 1 < MODEL_NUM_TRANSITIONS(id); t++)                        \
+        {                                                                                   \
+            cumulative += rates[t];                                                         \
+            if (u < cumulative / total)                                                     \
+            {                                                                               \
+                event = t;                                                                  \
+                break;                                                                      \
+            }                                                                               \
+        }                                                                                   \
+        for (uint32_t k = 0; k < MODEL_NUM_COMPARTMENTS(id); k++)                           \
+        {                                                                                   \
+            x[k] += stoichiometry[event][k];                                                \
+        }                                                                                   \
+    }                                                                                       \
+    return timestep;                                                                        \
+}
+
+MODELS(MODELLING_DEFINE_KERNEL)
+
+
+#define MODELLING_KERNEL_CASE(id)                                                           \
+    case MODEL_##id:                                                                        \
+        return _modelling_simulate_##id(rng, &params, x, max_steps);
+
+
+static timestep_t _modelling_simulate_markovian(modelling_rng_t* rng, const context_t* context)
+{
+    timestep_t max_steps = context->bins.limit;
+
+    if (context->model == MODEL_SIR && context->precision == PRECISION_GMP)
+    {
+        /* Arbitrary precision reference, stepped event by event */
+        modelling_markovian_frame_t frame;
+        frame.susceptibles = context->initial_susceptibles;
+        frame.infectives = context->initial_infectives;
+        frame.removed = context->initial_removed;
+        timestep_t timestep = 0;
+        double infection_rate = context->infection_rate;
+        double recovery_rate = context->recovery_rate;
+        while (frame.infectives > 0 && timestep < max_steps)
+        {
+            _modelling_markovian_SIR_timestep(rng, &frame, &infection_rate, &recovery_rate);
+            timestep++;
+        }
+        return timestep;
+    }
+
+    if (context->model == MODEL_SIR && context->sampler == SAMPLER_RUNS)
+        return _modelling_simulate_markovian_runs(rng, context->infection_rate, context->recovery_rate, context->initial_susceptibles, context->initial_infectives);
+
+    uint32_t x[MODEL_MAX_COMPARTMENTS];
+    model_initial_state(context->model, context->initial_susceptibles, context->initial_infectives, context->initial_removed, x);
+    model_params_t params = {.beta=context->infection_rate, .gamma=context->recovery_rate, .sigma=context->incubation_rate};
+
+    switch (context->model)
+    {
+        MODELS(MODELLING_KERNEL_CASE)
+        default:
+            return 0;
+    }
+}
+
+
+void modelling_simulate_replicas(const context_t* context, uint64_t first, uint64_t last, histogram_t* bins)
+{
+    for (uint64_t i = first; i < last; i++)
+    {
+        modelling_rng_t rng;
+        philox_init(&rng.philox, context->seed, i);
+        rng.next = MODELLING_UNIFORM_BLOCK;
+        timestep_t age = _modelling_simulate_markovian(&rng, context);
+        histogram_add(bins, age, 1);
+        INSTRUMENT_COUNT(EVENTS, age);
+    }
+}
+
+
+static void* _modelling_worker(void* arg)
+{
+    modelling_worker_t* worker = (modelling_worker_t*)arg;
+    context_t* context = worker->context;
+
+    /*
+     * Replica i always draws from Philox stream i of the seed, so which
+     * worker claims a chunk, and when, cannot change the result. A claimed
+     * chunk is always finished, so replicas below next_replica are all done.
+     */
+    for (;;)
+    {
+        if (progress_cancelled(context->progress))
+            break;
+        uint64_t first = __atomic_fetch_add(worker->next_replica, MODELLING_REPLICA_CHUNK, __ATOMIC_RELAXED);
+        if (first >= context->iterations)
+            break;
+        uint64_t last = first + MODELLING_REPLICA_CHUNK;
+        if (last > context->iterations)
+            last = context->iterations;
+
+        if (context->progress == NULL)
+        {
+            modelling_simulate_replicas(context, first, last, &worker->bins);
+        }
+        else
+        {
+            histogram_reset(&worker->chunk);
+            modelling_simulate_replicas(context, first, last, &worker->chunk);
+            histogram_merge(&worker->bins, &worker->chunk);
+            progress_add(context->progress, &worker->chunk, last - first);
+        }
+
+        /* Checked after a chunk, so every round makes progress */
+        if (worker->deadline && _modelling_now() >= worker->deadline)
+            break;
+    }
+    return NULL;
+}
+
+
 void modelling_simulate(context_t* context)
 {
+    printf("Model: %s\n", models[context->model].name);
     printf("Infection Rate: %f\n", context->infection_rate);
+    if (context->model != MODEL_SIR && context->precision == PRECISION_GMP)
+        printf("GMP precision is only implemented for SIR, running in double precision.\n");
 
-    for (int i = 0; i < context->bins.size; i++)
+    histogram_reset(&context->bins);
+
+    /* A checkpoint of this run puts back the histogram and where to carry on from */
+    uint64_t next_replica = 0;
+    if (context->checkpoint_path != NULL
+        && checkpoint_load(context->checkpoint_path, context, &context->bins, &next_replica) == 0)
+        progress_add(context->progress, &context->bins, next_replica);
+
+    uint32_t num_threads = context->num_threads > 0 ? context->num_threads : 1;
+    modelling_worker_t* workers = (modelling_worker_t*)calloc(num_threads, sizeof(modelling_worker_t));
+    pthread_t* threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+
+    for (uint32_t t = 0; t < num_threads; t++)
     {
-        context->bins.array[i] = 0;
+        workers[t].context = context;
+        workers[t].next_replica = &next_replica;
+        histogram_init(&workers[t].bins, context->bins.limit);
+        histogram_init(&workers[t].chunk, context->bins.limit);
     }
 
-    for (uint64_t i = 0; i < context->iterations; i++)
+    /*
+     * Without a checkpoint path this is one round to the end. With one, each
+     * round stops claiming chunks after checkpoint_interval seconds, and its
+     * replicas are merged and saved before the next round starts.
+     */
+    uint64_t interval = 0;
+    if (context->checkpoint_path != NULL)
     {
-        timestep_t age = _modelling_simulate_markovian(&context->infection_rate, &context->recovery_rate, context->initial_susceptibles, context->initial_infectives);
-        if (context->bins.size > age)
+        double seconds = context->checkpoint_interval > 0.0 ? context->checkpoint_interval : CHECKPOINT_DEFAULT_INTERVAL;
+        interval = (uint64_t)(seconds * 1e9);
+    }
+    while (next_replica < context->iterations && !progress_cancelled(context->progress))
+    {
+        uint64_t deadline = interval ? _modelling_now() + interval : 0;
+        for (uint32_t t = 0; t < num_threads; t++)
+        {
+            workers[t].deadline = deadline;
+        }
+        for (uint32_t t = 1; t < num_threads; t++)
         {
-            context->bins.array[age] += 1;
+            if (pthread_create(&threads[t], NULL, _modelling_worker, &workers[t]) != 0)
+            {
+                printf("Failed to start worker thread %u.\n", t);
+                exit(-1);
+            }
         }
+        /* The calling thread is worker 0 */
+        _modelling_worker(&workers[0]);
+        for (uint32_t t = 1; t < num_threads; t++)
+        {
+            pthread_join(threads[t], NULL);
+        }
+
+        /*
+         * Counts add up the same whichever worker ran a replica. The merge runs in
+         * worker order after the join, so it needs no locking.
+         */
+        for (uint32_t t = 0; t < num_threads; t++)
+        {
+            histogram_merge(&context->bins, &workers[t].bins);
+            histogram_reset(&workers[t].bins);
+        }
+
+        /* Workers overshoot iterations by up to a chunk each */
+        if (next_replica > context->iterations)
+            next_replica = context->iterations;
+        if (context->checkpoint_path != NULL
+            && checkpoint_save(context->checkpoint_path, context, &context->bins, next_replica) != 0)
+            printf("Failed to save checkpoint %s.\n", context->checkpoint_path);
+    }
+
+    for (uint32_t t = 0; t < num_threads; t++)
+    {
+        histogram_free(&workers[t].bins);
+        histogram_free(&workers[t].chunk);
     }
+    free(threads);
+    free(workers);
 }
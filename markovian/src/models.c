@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "models.h"
+
+
+/*
+ * In the reads column compartment names stand for their bit, in table order.
+ * The names are reused between models, so each model's bits are an enum local
+ * to its own function.
+ */
+#define MODELS_POSITION(P, name)        MODELS_##P##_POSITION_##name,
+#define MODELS_BIT(P, name)             name = 1u << MODELS_##P##_POSITION_##name,
+#define MODELS_READS(P, name, rate, reads, ...)     (reads),
+
+/* One function per transition, for engines that only update some rates */
+#define MODELS_RATE_FUNCTION(P, name, rate, reads, ...)                                     \
+static double _models_##P##_##name(const uint32_t* x, const model_params_t* params)        \
+{                                                                                           \
+    MODEL_LOAD_STATE(P)                                                                     \
+    MODEL_LOAD_PARAMS(params)                                                               \
+    return (rate);                                                                          \
+}
+#define MODELS_RATE_POINTER(P, name, rate, reads, ...)      _models_##P##_##name,
+
+
+/* Expands one model table into its state walking functions */
+#define MODELS_DEFINE(id)                                                                   \
+enum { MODEL_##id##_COMPARTMENTS(MODELS_POSITION, id) };                                    \
+                                                                                            \
+static int _models_##id##_active(const uint32_t* x)                                         \
+{                                                                                           \
+    MODEL_LOAD_STATE(id)                                                                    \
+    return MODEL_##id##_ACTIVE;                                                             \
+}                                                                                           \
+                                                                                            \
+static double _models_##id##_rates(const uint32_t* x, const model_params_t* params, double* rates) \
+{                                                                                           \
+    MODEL_LOAD_STATE(id)                                                                    \
+    MODEL_LOAD_PARAMS(params)                                                               \
+    const double values[] = { MODEL_##id##_TRANSITIONS(MODEL_RATE, id) };                   \
+    double total = 0.0;                                                                     \
+    for (uint32_t t = 0; t < MODEL_NUM_TRANSITIONS(id); t++)                                \
+    {                                                                                       \
+        rates[t] = values[t];                                                               \
+        total += values[t];                                                                 \
+    }                                                                                       \
+    return total;                                                                           \
+}                                                                                           \
+                                                                                            \
+static void _models_##id##_reads(uint32_t* reads)                                           \
+{                                                                                           \
+    enum { MODEL_##id##_COMPARTMENTS(MODELS_BIT, id) };                                     \
+    const uint32_t values[] = { MODEL_##id##_TRANSITIONS(MODELS_READS, id) };               \
+    for (uint32_t t = 0; t < MODEL_NUM_TRANSITIONS(id); t++)                                \
+    {                                                                                       \
+        reads[t] = values[t];                                                               \
+    }                                                                                       \
+}                                                                                           \
+                                                                                            \
+MODEL_##id##_TRANSITIONS(MODELS_RATE_FUNCTION, id)
+
+
+#define MODELS_NAME(P, name)        #name,
+#define MODELS_DESCRIPTOR(id)                                                               \
+    [MODEL_##id] = {                                                                        \
+        .name = #id,                                                                        \
+        .num_compartments = MODEL_NUM_COMPARTMENTS(id),                                     \
+        .num_transitions = MODEL_NUM_TRANSITIONS(id),                                       \
+        .compartment_names = { MODEL_##id##_COMPARTMENTS(MODELS_NAME, id) },                \
+        .stoichiometry = { MODEL_##id##_TRANSITIONS(MODEL_STOICHIOMETRY, id) },             \
+        .active = _models_##id##_active,                                                    \
+        .rates = _models_##id##_rates,                                                      \
+        .reads = _models_##id##_reads,                                                      \
+        .rate = { MODEL_##id##_TRANSITIONS(MODELS_RATE_POINTER, id) },                      \
+    },
+
+
+MODELS(MODELS_DEFINE)
+
+
+const model_t models[MODEL_COUNT] = {
+    MODELS(MODELS_DESCRIPTOR)
+};
+
+
+#define MODELS_INITIAL(P, name)     x[k++] = MODEL_INITIAL_##name(susceptibles, infectives, removed);
+#define MODELS_INITIAL_CASE(id)                                                             \
+    case MODEL_##id:                                                                        \
+        MODEL_##id##_COMPARTMENTS(MODELS_INITIAL, id)                                       \
+        break;
+
+
+void model_initial_state(model_enum_t model, uint32_t susceptibles, uint32_t infectives, uint32_t removed, uint32_t* x)
+{
+    uint32_t k = 0;
+    switch (model)
+    {
+        MODELS(MODELS_INITIAL_CASE)
+        default:
+            printf("Unknown model %d.\n", model);
+            break;
+    }
+}
+
+
+int models_parse(const char* name, model_enum_t* model)
+{
+    /* By the name in the table, as the GUI lists it */
+    for (uint32_t m = 0; m < MODEL_COUNT; m++)
+    {
+        if (strcmp(name, models[m].name) == 0)
+        {
+            *model = (model_enum_t)m;
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,571 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "network.h"
+#include "event_heap.h"
+#include "philox.h"
+#include "instrument.h"
+
+
+/*
+ * SIR and SIS on an explicit contact network, in continuous time.
+ *
+ * Every edge between a susceptible and an infective transmits at rate β and
+ * every infective recovers at rate γ, so a susceptible with k infected
+ * neighbours is infected at rate β·k. Each node keeps the time it next changes
+ * state in an indexed heap, as in the next reaction method of gillespie.c.
+ * When a node changes state only its own time and those of its susceptible
+ * neighbours move, and the neighbours' pending times are rescaled to their new
+ * rates rather than redrawn. An event therefore costs O(degree · log n),
+ * however large the network.
+ *
+ * The population is the network: the initial infectives and removed are
+ * picked uniformly from its nodes and every other node starts susceptible.
+ * Durations are counted in real time, as for the Gillespie engine.
+ */
+
+
+/* Bytes read from the edge list at a time */
+#define NETWORK_READ_BUFFER         (1 << 20)
+#define NETWORK_INITIAL_NODES       1024
+#define NETWORK_MATRIX_MARKET       "%%MatrixMarket"
+
+
+typedef enum
+{
+    NETWORK_SUSCEPTIBLE,
+    NETWORK_INFECTIVE,
+    NETWORK_REMOVED,
+} network_state_enum_t;
+
+
+typedef struct
+{
+    FILE*       fp;
+    size_t      length;
+    size_t      position;
+    uint64_t    line;
+    int         matrix_market;  /* 1-based ids, after a size line that is skipped */
+    int         sized;          /* The size line has been skipped */
+    char        buffer[NETWORK_READ_BUFFER];
+} network_reader_t;
+
+
+/* Per-node state of one replica, one array per field so sweeps stay dense */
+typedef struct
+{
+    uint8_t*        state;
+    uint32_t*       infected_neighbours;
+    event_heap_t    heap;
+} network_replica_t;
+
+
+typedef struct
+{
+    context_t*          context;
+    const network_t*    network;
+    uint64_t*           next_replica;
+    histogram_t         bins;
+    histogram_t         chunk;          /* The last replica, when progress is watched */
+} network_worker_t;
+
+
+/* The last network loaded, kept between runs */
+static network_t _network;
+static char* _network_path = NULL;
+
+
+static int _network_getc(network_reader_t* reader)
+{
+    if (reader->position == reader->length)
+    {
+        reader->length = fread(reader->buffer, 1, NETWORK_READ_BUFFER, reader->fp);
+        reader->position = 0;
+        if (reader->length == 0)
+            return EOF;
+    }
+    return (unsigned char)reader->buffer[reader->position++];
+}
+
+
+static void _network_rewind(network_reader_t* reader)
+{
+    /* To the start of the file, noting whether it is a Matrix Market one */
+    rewind(reader->fp);
+    reader->length = fread(reader->buffer, 1, NETWORK_READ_BUFFER, reader->fp);
+    reader->position = 0;
+    reader->line = 0;
+    reader->matrix_market = reader->length >= strlen(NETWORK_MATRIX_MARKET)
+                            && memcmp(reader->buffer, NETWORK_MATRIX_MARKET, strlen(NETWORK_MATRIX_MARKET)) == 0;
+    reader->sized = 0;
+}
+
+
+static int _network_read_node(network_reader_t* reader, int* c, uint32_t* node)
+{
+    while (*c == ' ' || *c == '\t' || *c == '\r')
+    {
+        *c = _network_getc(reader);
+    }
+    if (*c < '0' || *c > '9')
+        return -1;
+    uint64_t value = 0;
+    while (*c >= '0' && *c <= '9')
+    {
+        value = value * 10 + (uint64_t)(*c - '0');
+        if (value >= UINT32_MAX)
+            return -1;
+        *c = _network_getc(reader);
+    }
+    *node = (uint32_t)value;
+    return 0;
+}
+
+
+static int _network_read_edge(network_reader_t* reader, uint32_t* u, uint32_t* v)
+{
+    /*
+     * One "u v" pair per line, anything after the pair is ignored so weighted
+     * lists load too. Blank lines and lines starting with # or % are comments.
+     * Matrix Market coordinate files have a size line first and count from 1.
+     * Returns 1 for an edge, 0 at the end of the file and -1 on a bad line.
+     */
+    for (;;)
+    {
+        int c = _network_getc(reader);
+        if (c == EOF)
+            return 0;
+        reader->line++;
+        while (c == ' ' || c == '\t' || c == '\r')
+        {
+            c = _network_getc(reader);
+        }
+        int comment = c == '\n' || c == EOF || c == '#' || c == '%';
+        if (!comment && (_network_read_node(reader, &c, u) != 0 || _network_read_node(reader, &c, v) != 0))
+            return -1;
+        while (c != '\n' && c != EOF)
+        {
+            c = _network_getc(reader);
+        }
+        if (comment)
+            continue;
+        if (!reader->matrix_market)
+            return 1;
+        if (!reader->sized)
+        {
+            reader->sized = 1;
+            continue;
+        }
+        if (*u == 0 || *v == 0)
+            return -1;
+        (*u)--;
+        (*v)--;
+        return 1;
+    }
+}
+
+
+static int _network_compare(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+static uint32_t* _network_count_degrees(network_reader_t* reader, uint32_t* num_nodes, uint64_t* num_edges)
+{
+    uint32_t capacity = NETWORK_INITIAL_NODES;
+    uint32_t* degrees = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+    if (degrees == NULL)
+    {
+        printf("Failed to allocate degrees for %u nodes.\n", capacity);
+        exit(-1);
+    }
+    *num_nodes = 0;
+    *num_edges = 0;
+
+    uint32_t u, v;
+    int ret;
+    while ((ret = _network_read_edge(reader, &u, &v)) == 1)
+    {
+        /* Self loops cannot transmit */
+        if (u == v)
+            continue;
+        uint32_t largest = u > v ? u : v;
+        if (largest >= capacity)
+        {
+            uint32_t grown = capacity;
+            while (largest >= grown)
+            {
+                grown = grown > UINT32_MAX / 2 ? UINT32_MAX : grown * 2;
+            }
+            degrees = (uint32_t*)realloc(degrees, (size_t)grown * sizeof(uint32_t));
+            if (degrees == NULL)
+            {
+                printf("Failed to allocate degrees for %u nodes.\n", grown);
+                exit(-1);
+            }
+            memset(degrees + capacity, 0, (size_t)(grown - capacity) * sizeof(uint32_t));
+            capacity = grown;
+        }
+        if (largest >= *num_nodes)
+            *num_nodes = largest + 1;
+        degrees[u]++;
+        degrees[v]++;
+        *num_edges += 2;
+    }
+    if (ret < 0)
+    {
+        printf("Bad edge on line %" PRIu64 ".\n", reader->line);
+        free(degrees);
+        return NULL;
+    }
+    return degrees;
+}
+
+
+int network_load(network_t* network, const char* path)
+{
+    /*
+     * Two passes over the file: the first counts degrees, the second writes
+     * each neighbour straight into its CSR slot. Peak memory is the CSR arrays
+     * themselves, with no intermediate list of edges.
+     */
+    memset(network, 0, sizeof(network_t));
+    network_reader_t* reader = (network_reader_t*)malloc(sizeof(network_reader_t));
+    if (reader == NULL)
+    {
+        printf("Failed to allocate edge list reader.\n");
+        exit(-1);
+    }
+    reader->fp = fopen(path, "r");
+    if (reader->fp == NULL)
+    {
+        printf("Cannot open edge list %s.\n", path);
+        free(reader);
+        return -1;
+    }
+    _network_rewind(reader);
+
+    uint32_t* degrees = _network_count_degrees(reader, &network->num_nodes, &network->num_edges);
+    if (degrees == NULL)
+    {
+        printf("Failed to load edge list %s.\n", path);
+        fclose(reader->fp);
+        free(reader);
+        return -1;
+    }
+
+    network->offsets = (uint64_t*)malloc(((size_t)network->num_nodes + 1) * sizeof(uint64_t));
+    network->neighbours = (uint32_t*)malloc(network->num_edges * sizeof(uint32_t));
+    if (network->offsets == NULL || (network->num_edges && network->neighbours == NULL))
+    {
+        printf("Failed to allocate a network of %u nodes and %" PRIu64 " edges.\n",
+               network->num_nodes, network->num_edges / 2);
+        exit(-1);
+    }
+
+    /* offsets[u] starts at the end of u's range and counts down as it fills */
+    uint64_t end = 0;
+    for (uint32_t u = 0; u < network->num_nodes; u++)
+    {
+        end += degrees[u];
+        network->offsets[u] = end;
+    }
+    network->offsets[network->num_nodes] = end;
+    free(degrees);
+
+    _network_rewind(reader);
+    uint32_t u, v;
+    while (_network_read_edge(reader, &u, &v) == 1)
+    {
+        if (u == v)
+            continue;
+        network->neighbours[--network->offsets[u]] = v;
+        network->neighbours[--network->offsets[v]] = u;
+    }
+    fclose(reader->fp);
+    free(reader);
+
+    /* Repeated or reciprocal lines give a pair more than once, it must only transmit at β */
+    uint64_t kept = 0;
+    for (uint32_t u = 0; u < network->num_nodes; u++)
+    {
+        uint64_t first = network->offsets[u];
+        uint64_t last = network->offsets[u + 1];
+        qsort(network->neighbours + first, last - first, sizeof(uint32_t), _network_compare);
+        network->offsets[u] = kept;
+        for (uint64_t e = first; e < last; e++)
+        {
+            if (kept == network->offsets[u] || network->neighbours[kept - 1] != network->neighbours[e])
+                network->neighbours[kept++] = network->neighbours[e];
+        }
+    }
+    network->offsets[network->num_nodes] = kept;
+    network->num_edges = kept;
+    return 0;
+}
+
+
+void network_free(network_t* network)
+{
+    free(network->offsets);
+    free(network->neighbours);
+    memset(network, 0, sizeof(network_t));
+}
+
+
+static double _network_exponential(philox_t* philox)
+{
+    /* philox_uniform() is never 0 */
+    return -log(philox_uniform(philox));
+}
+
+
+static void _network_reschedule(network_replica_t* replica, philox_t* philox, uint32_t node, double time, double old_rate, double new_rate)
+{
+    double fires = INFINITY;
+    if (new_rate > 0.0)
+    {
+        /* A pending time is rescaled to the new rate, Gibson & Bruck (2000) */
+        if (old_rate > 0.0)
+            fires = time + old_rate / new_rate * (event_heap_time(&replica->heap, node) - time);
+        else
+            fires = time + _network_exponential(philox) / new_rate;
+    }
+    event_heap_set(&replica->heap, node, fires);
+}
+
+
+static void _network_notify_neighbours(const network_t* network, network_replica_t* replica, philox_t* philox,
+                                       uint32_t node, double time, double beta, int change)
+{
+    /* Only susceptible neighbours have a rate that depends on node */
+    for (uint64_t e = network->offsets[node]; e < network->offsets[node + 1]; e++)
+    {
+        uint32_t neighbour = network->neighbours[e];
+        uint32_t before = replica->infected_neighbours[neighbour];
+        replica->infected_neighbours[neighbour] = before + change;
+        if (replica->state[neighbour] == NETWORK_SUSCEPTIBLE)
+            _network_reschedule(replica, philox, neighbour, time, beta * before, beta * (before + change));
+    }
+}
+
+
+static void _network_infect(const network_t* network, network_replica_t* replica, philox_t* philox,
+                            uint32_t node, double time, double beta, double gamma)
+{
+    replica->state[node] = NETWORK_INFECTIVE;
+    event_heap_set(&replica->heap, node, gamma > 0.0 ? time + _network_exponential(philox) / gamma : INFINITY);
+    _network_notify_neighbours(network, replica, philox, node, time, beta, +1);
+}
+
+
+static double _network_simulate_replica(const network_t* network, network_replica_t* replica, philox_t* philox,
+                                        const context_t* context, double horizon)
+{
+    double beta = context->infection_rate;
+    double gamma = context->recovery_rate;
+    uint32_t n = network->num_nodes;
+
+    memset(replica->state, NETWORK_SUSCEPTIBLE, n * sizeof(uint8_t));
+    memset(replica->infected_neighbours, 0, n * sizeof(uint32_t));
+    event_heap_reset(&replica->heap);
+
+    /* Initial cases are drawn without replacement by rejection */
+    uint32_t infectives = context->initial_infectives < n ? context->initial_infectives : n;
+    uint32_t removed = context->initial_removed < n - infectives ? context->initial_removed : n - infectives;
+    for (uint32_t i = 0; i < removed; i++)
+    {
+        uint32_t node;
+        do
+        {
+            node = philox_bounded(philox, n);
+        } while (replica->state[node] != NETWORK_SUSCEPTIBLE);
+        replica->state[node] = NETWORK_REMOVED;
+    }
+    for (uint32_t i = 0; i < infectives; i++)
+    {
+        uint32_t node;
+        do
+        {
+            node = philox_bounded(philox, n);
+        } while (replica->state[node] != NETWORK_SUSCEPTIBLE);
+        _network_infect(network, replica, philox, node, 0.0, beta, gamma);
+    }
+
+    double time = 0.0;
+    while (infectives > 0)
+    {
+        uint32_t node = event_heap_top(&replica->heap);
+        double next = event_heap_time(&replica->heap, node);
+        if (next >= horizon)
+        {
+            /* Censored, with no duration to count */
+            time = INFINITY;
+            break;
+        }
+        time = next;
+        INSTRUMENT_COUNT(EVENTS, 1);
+
+        if (replica->state[node] == NETWORK_SUSCEPTIBLE)
+        {
+            _network_infect(network, replica, philox, node, time, beta, gamma);
+            infectives++;
+            continue;
+        }
+
+        /* Recovery, back to susceptible under SIS */
+        infectives--;
+        if (context->model == MODEL_SIS)
+        {
+            replica->state[node] = NETWORK_SUSCEPTIBLE;
+            _network_reschedule(replica, philox, node, time, 0.0, beta * replica->infected_neighbours[node]);
+        }
+        else
+        {
+            replica->state[node] = NETWORK_REMOVED;
+            event_heap_set(&replica->heap, node, INFINITY);
+        }
+        _network_notify_neighbours(network, replica, philox, node, time, beta, -1);
+    }
+    return time;
+}
+
+
+static void* _network_worker(void* arg)
+{
+    network_worker_t* worker = (network_worker_t*)arg;
+    context_t* context = worker->context;
+    const network_t* network = worker->network;
+    double horizon = context->bins.limit * context->time_bin_width;
+
+    network_replica_t replica;
+    replica.state = (uint8_t*)malloc(network->num_nodes * sizeof(uint8_t));
+    replica.infected_neighbours = (uint32_t*)malloc(network->num_nodes * sizeof(uint32_t));
+    if (replica.state == NULL || replica.infected_neighbours == NULL)
+    {
+        printf("Failed to allocate state for %u nodes.\n", network->num_nodes);
+        exit(-1);
+    }
+    event_heap_init(&replica.heap, network->num_nodes);
+
+    /* Replica i draws from Philox stream i, whichever worker runs it */
+    for (;;)
+    {
+        if (progress_cancelled(context->progress))
+            break;
+        uint64_t i = __atomic_fetch_add(worker->next_replica, 1, __ATOMIC_RELAXED);
+        if (i >= context->iterations)
+            break;
+        philox_t philox;
+        philox_init(&philox, context->seed, i);
+        double duration = _network_simulate_replica(network, &replica, &philox, context, horizon);
+        histogram_add_real(&worker->bins, duration);
+
+        /* A replica on a large graph is slow enough to report one at a time */
+        if (context->progress != NULL)
+        {
+            histogram_reset(&worker->chunk);
+            worker->chunk.bin_width = context->time_bin_width;
+            histogram_add_real(&worker->chunk, duration);
+            progress_add(context->progress, &worker->chunk, 1);
+        }
+    }
+
+    event_heap_free(&replica.heap);
+    free(replica.state);
+    free(replica.infected_neighbours);
+    return NULL;
+}
+
+
+static const network_t* _network_get(const char* path)
+{
+    if (_network_path != NULL && strcmp(_network_path, path) == 0)
+        return &_network;
+
+    if (_network_path != NULL)
+    {
+        network_free(&_network);
+        free(_network_path);
+        _network_path = NULL;
+    }
+    if (network_load(&_network, path) != 0)
+        return NULL;
+    _network_path = strdup(path);
+    printf("Loaded %s: %u nodes, %" PRIu64 " edges\n", path, _network.num_nodes, _network.num_edges / 2);
+    return &_network;
+}
+
+
+void network_simulate(context_t* context)
+{
+    printf("Model: %s network\n", models[context->model].name);
+    printf("Infection Rate: %f\n", context->infection_rate);
+
+    histogram_reset(&context->bins);
+    context->bins.bin_width = context->time_bin_width;
+
+    if (context->model != MODEL_SIR && context->model != MODEL_SIS)
+    {
+        printf("Networks only support SIR and SIS.\n");
+        return;
+    }
+    if (context->network_path == NULL)
+    {
+        printf("No network given, start with an edge list: main <edge list>\n");
+        return;
+    }
+    const network_t* network = _network_get(context->network_path);
+    if (network == NULL || network->num_nodes == 0)
+        return;
+
+    /* Each worker holds its own copy of the node state */
+    uint32_t num_threads = context->num_threads > 0 ? context->num_threads : 1;
+    if (num_threads > context->iterations)
+        num_threads = context->iterations > 0 ? (uint32_t)context->iterations : 1;
+    uint64_t next_replica = 0;
+    network_worker_t* workers = (network_worker_t*)calloc(num_threads, sizeof(network_worker_t));
+    pthread_t* threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+
+    for (uint32_t t = 0; t < num_threads; t++)
+    {
+        workers[t].context = context;
+        workers[t].network = network;
+        workers[t].next_replica = &next_replica;
+        histogram_init(&workers[t].bins, context->bins.limit);
+        workers[t].bins.bin_width = context->time_bin_width;
+        histogram_init(&workers[t].chunk, context->bins.limit);
+    }
+    for (uint32_t t = 1; t < num_threads; t++)
+    {
+        if (pthread_create(&threads[t], NULL, _network_worker, &workers[t]) != 0)
+        {
+            printf("Failed to start worker thread %u.\n", t);
+            exit(-1);
+        }
+    }
+    /* The calling thread is worker 0 */
+    _network_worker(&workers[0]);
+    for (uint32_t t = 1; t < num_threads; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+
+    for (uint32_t t = 0; t < num_threads; t++)
+    {
+        histogram_merge(&context->bins, &workers[t].bins);
+        histogram_free(&workers[t].bins);
+        histogram_free(&workers[t].chunk);
+    }
+
+    free(threads);
+    free(workers);
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "progress.h"
+
+
+static uint64_t _progress_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+
+void progress_init(progress_t* progress, uint64_t interval, void (*notify)(void* data), void* data)
+{
+    progress->completed = 0;
+    progress->cancelled = 0;
+    pthread_mutex_init(&progress->lock, NULL);
+    histogram_init(&progress->snapshot, 0);
+    progress->interval = interval;
+    progress->notified = 0;
+    progress->pending = 0;
+    progress->notify = notify;
+    progress->data = data;
+}
+
+
+void progress_free(progress_t* progress)
+{
+    histogram_free(&progress->snapshot);
+    pthread_mutex_destroy(&progress->lock);
+}
+
+
+void progress_reset(progress_t* progress, uint64_t limit)
+{
+    /* Only called while no engine is running */
+    histogram_set_limit(&progress->snapshot, limit);
+    progress->completed = 0;
+    progress->cancelled = 0;
+    progress->notified = 0;
+    progress->pending = 0;
+}
+
+
+void progress_add(progress_t* progress, const histogram_t* bins, uint64_t replicas)
+{
+    if (progress == NULL)
+        return;
+
+    pthread_mutex_lock(&progress->lock);
+    if (bins != NULL)
+    {
+        progress->snapshot.bin_width = bins->bin_width;
+        histogram_merge(&progress->snapshot, bins);
+    }
+    __atomic_add_fetch(&progress->completed, replicas, __ATOMIC_RELAXED);
+
+    int notify = 0;
+    if (!progress->pending && progress->notify != NULL)
+    {
+        uint64_t now = _progress_now();
+        if (now - progress->notified >= progress->interval)
+        {
+            progress->notified = now;
+            progress->pending = 1;
+            notify = 1;
+        }
+    }
+    pthread_mutex_unlock(&progress->lock);
+
+    if (notify)
+        progress->notify(progress->data);
+}
+
+
+uint64_t progress_snapshot(progress_t* progress, histogram_t* bins)
+{
+    /* Copies the counts so far and lets the next progress_add() notify again */
+    pthread_mutex_lock(&progress->lock);
+    histogram_set_limit(bins, progress->snapshot.limit);
+    histogram_merge(bins, &progress->snapshot);
+    bins->bin_width = progress->snapshot.bin_width;
+    uint64_t completed = __atomic_load_n(&progress->completed, __ATOMIC_RELAXED);
+    progress->pending = 0;
+    pthread_mutex_unlock(&progress->lock);
+    return completed;
+}
@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "result.h"
+#include "models.h"
+#include "instrument.h"
+
+
+#ifndef GIT_VERSION
+#define GIT_VERSION             "unknown"
+#endif
+
+
+_Static_assert(sizeof(result_header_t) == RESULT_HEADER_SIZE, "result_header_t must keep its size");
+_Static_assert(sizeof(result_trajectory_t) % 8 == 0, "trajectory blocks must stay 8 byte aligned");
+
+
+static uint64_t _result_align(uint64_t offset)
+{
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+
+static int _result_write(result_writer_t* writer, const void* data, size_t size)
+{
+    INSTRUMENT_COUNT(BYTES_WRITTEN, size);
+    return fwrite(data, 1, size, writer->fp) == size ? 0 : -1;
+}
+
+
+static void _result_discard(result_writer_t* writer)
+{
+    fclose(writer->fp);
+    unlink(writer->temp_path);
+    free(writer->path);
+    free(writer->temp_path);
+}
+
+
+int result_create(result_writer_t* writer, const char* path, const char* simulation, const context_t* context, const histogram_t* bins)
+{
+    /* Everything goes to path.tmp, which result_close() renames into place */
+    writer->path = strdup(path);
+    writer->temp_path = (char*)malloc(strlen(path) + 5);
+    if (writer->path == NULL || writer->temp_path == NULL)
+    {
+        printf("Failed to allocate result paths.\n");
+        exit(-1);
+    }
+    sprintf(writer->temp_path, "%s.tmp", path);
+    writer->fp = fopen(writer->temp_path, "wb");
+    if (writer->fp == NULL)
+    {
+        printf("Cannot open result file %s.\n", writer->temp_path);
+        free(writer->path);
+        free(writer->temp_path);
+        return -1;
+    }
+
+    result_header_t* header = &writer->header;
+    memset(header, 0, sizeof(result_header_t));
+    memcpy(header->magic, RESULT_MAGIC, sizeof(header->magic));
+    header->version = RESULT_VERSION;
+    header->byte_order = RESULT_BYTE_ORDER;
+    const char* code_version = GIT_VERSION;
+    size_t length = strlen(code_version);
+    memcpy(header->code_version, code_version, length < sizeof(header->code_version) ? length : sizeof(header->code_version) - 1);
+    snprintf(header->simulation, sizeof(header->simulation), "%s", simulation);
+    snprintf(header->model, sizeof(header->model), "%s", models[context->model].name);
+    header->model_id = context->model;
+    header->sampler = context->sampler;
+    header->precision = context->precision;
+    header->num_patches = context->num_patches;
+    header->initial_susceptibles = context->initial_susceptibles;
+    header->initial_infectives = context->initial_infectives;
+    header->initial_removed = context->initial_removed;
+    header->sketch_buckets = HISTOGRAM_SKETCH_BUCKETS;
+    header->infection_rate = context->infection_rate;
+    header->recovery_rate = context->recovery_rate;
+    header->incubation_rate = context->incubation_rate;
+    header->tau_epsilon = context->tau_epsilon;
+    header->coupling_rate = context->coupling_rate;
+    header->coupling_interval = context->coupling_interval;
+    header->seed = context->seed;
+    header->iterations = context->iterations;
+    header->completed = context->iterations;
+    header->limit = bins->limit;
+    header->size = bins->size;
+    header->overflow = bins->overflow;
+    header->total = bins->total;
+    header->censored = bins->censored;
+    header->bin_width = bins->bin_width;
+    header->mean = bins->mean;
+    header->m2 = bins->m2;
+    header->exact = bins->exact;
+    if (bins->exact)
+    {
+        header->sum[0] = (uint64_t)bins->sum;
+        header->sum[1] = (uint64_t)(bins->sum >> 64);
+        header->sum_squares[0] = (uint64_t)bins->sum_squares;
+        header->sum_squares[1] = (uint64_t)(bins->sum_squares >> 64);
+    }
+    header->counts_offset = RESULT_HEADER_SIZE;
+    header->sketch_offset = header->counts_offset + bins->size * sizeof(uint64_t);
+    header->trajectories_offset = header->sketch_offset + sizeof(bins->sketch);
+
+    if (_result_write(writer, header, sizeof(result_header_t)) != 0
+        || _result_write(writer, bins->counts, bins->size * sizeof(uint64_t)) != 0
+        || _result_write(writer, bins->sketch, sizeof(bins->sketch)) != 0)
+    {
+        printf("Cannot write result file %s.\n", writer->temp_path);
+        _result_discard(writer);
+        return -1;
+    }
+    return 0;
+}
+
+
+int result_add_trajectory(result_writer_t* writer, uint64_t replica, uint32_t num_compartments, uint64_t num_points, const double* times, const uint32_t* states)
+{
+    uint64_t states_size = num_points * num_compartments * sizeof(uint32_t);
+    result_trajectory_t trajectory = {
+        .replica=replica,
+        .num_points=num_points,
+        .num_compartments=num_compartments,
+        .reserved=0,
+        .block_size=sizeof(result_trajectory_t) + num_points * sizeof(double) + _result_align(states_size),
+    };
+    static const uint8_t padding[8] = {0};
+    if (_result_write(writer, &trajectory, sizeof(trajectory)) != 0
+        || _result_write(writer, times, num_points * sizeof(double)) != 0
+        || _result_write(writer, states, states_size) != 0
+        || _result_write(writer, padding, _result_align(states_size) - states_size) != 0)
+    {
+        printf("Cannot write a trajectory to %s.\n", writer->temp_path);
+        return -1;
+    }
+    writer->header.num_trajectories++;
+    return 0;
+}
+
+
+int result_close(result_writer_t* writer)
+{
+    /* The header is rewritten with the trajectory count before the rename */
+    int ret = fseek(writer->fp, 0, SEEK_SET) == 0 ? 0 : -1;
+    if (ret == 0)
+        ret = _result_write(writer, &writer->header, sizeof(result_header_t));
+    if (ret == 0)
+        ret = fflush(writer->fp) == 0 && fsync(fileno(writer->fp)) == 0 ? 0 : -1;
+    if (ret != 0)
+    {
+        printf("Cannot write result file %s.\n", writer->temp_path);
+        _result_discard(writer);
+        return -1;
+    }
+    fclose(writer->fp);
+    if (rename(writer->temp_path, writer->path) != 0)
+    {
+        printf("Cannot move %s into place.\n", writer->temp_path);
+        ret = -1;
+    }
+    free(writer->path);
+    free(writer->temp_path);
+    return ret;
+}
+
+
+int result_save(const char* path, const char* simulation, const context_t* context, const histogram_t* bins)
+{
+    result_writer_t writer;
+    if (result_create(&writer, path, simulation, context, bins) != 0)
+        return -1;
+    return result_close(&writer);
+}
+
+
+int result_map(result_map_t* map, const char* path)
+{
+    memset(map, 0, sizeof(result_map_t));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        printf("Cannot open result file %s.\n", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < RESULT_HEADER_SIZE)
+    {
+        printf("%s is too short for a result file.\n", path);
+        close(fd);
+        return -1;
+    }
+    void* base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        printf("Cannot map result file %s.\n", path);
+        return -1;
+    }
+
+    const result_header_t* header = (const result_header_t*)base;
+    const char* error = NULL;
+    if (memcmp(header->magic, RESULT_MAGIC, sizeof(header->magic)) != 0)
+        error = "is not a result file";
+    else if (header->byte_order != RESULT_BYTE_ORDER)
+        error = "was written with the other byte order";
+    else if (header->version != RESULT_VERSION)
+        error = "has an unknown version";
+    else if (header->sketch_buckets != HISTOGRAM_SKETCH_BUCKETS
+             || header->counts_offset % 8 != 0 || header->sketch_offset % 8 != 0 || header->trajectories_offset % 8 != 0
+             || header->size > (uint64_t)st.st_size / sizeof(uint64_t)
+             || header->counts_offset + header->size * sizeof(uint64_t) > header->sketch_offset
+             || header->sketch_offset + HISTOGRAM_SKETCH_BUCKETS * sizeof(uint64_t) > header->trajectories_offset
+             || header->trajectories_offset > (uint64_t)st.st_size)
+        error = "is truncated or corrupt";
+    if (error != NULL)
+    {
+        printf("%s %s.\n", path, error);
+        munmap(base, st.st_size);
+        return -1;
+    }
+
+    map->base = base;
+    map->length = st.st_size;
+    map->header = header;
+    map->counts = (const uint64_t*)((const uint8_t*)base + header->counts_offset);
+    map->sketch = (const uint64_t*)((const uint8_t*)base + header->sketch_offset);
+    return 0;
+}
+
+
+void result_unmap(result_map_t* map)
+{
+    if (map->base != NULL)
+        munmap(map->base, map->length);
+    memset(map, 0, sizeof(result_map_t));
+}
+
+
+void result_histogram(const result_map_t* map, histogram_t* view)
+{
+    /*
+     * The view's counts are the mapped ones, so it is read only and valid
+     * until the map goes. It must not be freed, added to or merged into.
+     */
+    const result_header_t* header = map->header;
+    view->counts = (uint64_t*)map->counts;
+    view->size = header->size;
+    view->capacity = header->size;
+    view->limit = header->limit;
+    view->overflow = header->overflow;
+    view->total = header->total;
+    view->censored = header->censored;
+    view->bin_width = header->bin_width;
+    view->mean = header->mean;
+    view->m2 = header->m2;
+    /* Without the exact sums only the mean and m2 are kept, which merge with Chan's formula */
+    view->exact = header->exact;
+    view->sum = view->exact ? (histogram_sum_t)header->sum[1] << 64 | header->sum[0] : 0;
+    view->sum_squares = view->exact ? (histogram_sum_t)header->sum_squares[1] << 64 | header->sum_squares[0] : 0;
+    memcpy(view->sketch, map->sketch, sizeof(view->sketch));
+}
+
+
+const result_trajectory_t* result_next_trajectory(const result_map_t* map, const result_trajectory_t* trajectory)
+{
+    /* NULL gives the first block, and NULL comes back after the last */
+    uint64_t offset = trajectory == NULL
+        ? map->header->trajectories_offset
+        : (uint64_t)((const uint8_t*)trajectory - (const uint8_t*)map->base) + trajectory->block_size;
+    if (offset + sizeof(result_trajectory_t) > map->length)
+        return NULL;
+    const result_trajectory_t* next = (const result_trajectory_t*)((const uint8_t*)map->base + offset);
+    if (next->block_size < sizeof(result_trajectory_t) || next->block_size % 8 != 0 || offset + next->block_size > map->length)
+        return NULL;
+
+    /* The times and the padded states must fit in the block, without overflowing on the way */
+    uint64_t room = next->block_size - sizeof(result_trajectory_t);
+    if (next->num_points > room / sizeof(double))
+        return NULL;
+    room -= next->num_points * sizeof(double);
+    if (next->num_compartments != 0 && next->num_points > room / sizeof(uint32_t) / next->num_compartments)
+        return NULL;
+    return next;
+}
+
+
+int result_export_text(const result_map_t* map, const char* path)
+{
+    /* One "time frequency" line per bin, for gnuplot */
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        printf("Cannot open %s.\n", path);
+        return -1;
+    }
+    const result_header_t* header = map->header;
+    double total = header->total ? (double)header->total : 1.0;
+    for (uint64_t i = 0; i < header->size; i++)
+    {
+        int written = fprintf(fp, "%g %.10g\n", i * header->bin_width, map->counts[i] / total);
+        INSTRUMENT_COUNT(BYTES_WRITTEN, written > 0 ? written : 0);
+    }
+    int ret = ferror(fp) ? -1 : 0;
+    if (fclose(fp) != 0)
+        ret = -1;
+    return ret;
+}
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "result.h"
+
+
+/*
+ * Reads a binary result file in place.
+ *
+ *     build/results <file> [text output]
+ *
+ * Prints the run it came from, its statistics and where each saved
+ * trajectory ends, and with a second path exports the "time frequency" text
+ * gnuplot reads.
+ */
+
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <result file> [text output]\n", argv[0]);
+        return -1;
+    }
+
+    result_map_t map;
+    if (result_map(&map, argv[1]) != 0)
+        return -1;
+    const result_header_t* header = map.header;
+
+    printf("Simulation: %s\n", header->simulation);
+    printf("Model: %s\n", header->model);
+    printf("Code version: %s\n", header->code_version);
+    printf("Seed: %" PRIu64 ", iterations: %" PRIu64 "\n", header->seed, header->iterations);
+    if (header->block_replicas != 0)
+        printf("Shard of replicas %" PRIu64 " to %" PRIu64 "\n",
+               header->first_replica, header->first_replica + header->completed);
+    else if (header->completed < header->iterations)
+        printf("Checkpoint at %" PRIu64 " replicas\n", header->completed);
+    printf("Infection rate: %g, recovery rate: %g, incubation rate: %g\n",
+           header->infection_rate, header->recovery_rate, header->incubation_rate);
+    printf("Initial susceptibles: %u, infectives: %u, removed: %u\n",
+           header->initial_susceptibles, header->initial_infectives, header->initial_removed);
+
+    histogram_t view;
+    result_histogram(&map, &view);
+    histogram_print_stats(&view);
+
+    uint64_t num_trajectories = 0;
+    for (const result_trajectory_t* t = result_next_trajectory(&map, NULL); t != NULL; t = result_next_trajectory(&map, t))
+    {
+        num_trajectories++;
+    }
+    printf("Trajectories: %" PRIu64 "\n", num_trajectories);
+    for (const result_trajectory_t* t = result_next_trajectory(&map, NULL); t != NULL; t = result_next_trajectory(&map, t))
+    {
+        if (t->num_points == 0 || t->num_compartments == 0)
+            continue;
+        const uint32_t* last = result_trajectory_states(t) + (t->num_points - 1) * t->num_compartments;
+        printf("  Replica %" PRIu64 ": %" PRIu64 " states to time %g, ending at", t->replica, t->num_points,
+               result_trajectory_times(t)[t->num_points - 1]);
+        for (uint32_t k = 0; k < t->num_compartments; k++)
+        {
+            printf(" %u", last[k]);
+        }
+        printf("\n");
+    }
+
+    int ret = 0;
+    if (argc > 2)
+        ret = result_export_text(&map, argv[2]);
+    result_unmap(&map);
+    return ret;
+}
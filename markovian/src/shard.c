@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "shard.h"
+#include "modelling.h"
+#include "models.h"
+#include "result.h"
+#include "instrument.h"
+
+
+typedef struct
+{
+    const context_t*    context;
+    uint64_t            last_block;
+    uint64_t*           next_block;
+    histogram_t         bins;
+} shard_worker_t;
+
+
+static void* _shard_worker(void* arg)
+{
+    shard_worker_t* worker = (shard_worker_t*)arg;
+    const context_t* context = worker->context;
+
+    for (;;)
+    {
+        uint64_t b = __atomic_fetch_add(worker->next_block, 1, __ATOMIC_RELAXED);
+        if (b >= worker->last_block)
+            break;
+        uint64_t first = b * SHARD_BLOCK_REPLICAS;
+        uint64_t last = first + SHARD_BLOCK_REPLICAS;
+        if (last > context->iterations)
+            last = context->iterations;
+        modelling_simulate_replicas(context, first, last, &worker->bins);
+    }
+    return NULL;
+}
+
+
+int shard_simulate(context_t* context, uint32_t shard, uint32_t num_shards, const char* path)
+{
+    if (num_shards == 0 || shard >= num_shards)
+    {
+        printf("Shard %u of %u does not exist.\n", shard, num_shards);
+        return -1;
+    }
+    uint64_t total_blocks = (context->iterations + SHARD_BLOCK_REPLICAS - 1) / SHARD_BLOCK_REPLICAS;
+    uint64_t first_block = total_blocks * shard / num_shards;
+    uint64_t last_block = total_blocks * (shard + 1) / num_shards;
+    uint64_t first_replica = first_block * SHARD_BLOCK_REPLICAS;
+    uint64_t last_replica = last_block * SHARD_BLOCK_REPLICAS;
+    if (last_replica > context->iterations)
+        last_replica = context->iterations;
+    printf("Shard %u of %u: replicas %" PRIu64 " to %" PRIu64 " of %" PRIu64 "\n",
+           shard, num_shards, first_replica, last_replica, context->iterations);
+
+    histogram_reset(&context->bins);
+    uint32_t num_threads = context->num_threads > 0 ? context->num_threads : 1;
+    shard_worker_t* workers = (shard_worker_t*)calloc(num_threads, sizeof(shard_worker_t));
+    pthread_t* threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+    if (workers == NULL || threads == NULL)
+    {
+        printf("Failed to allocate %u shard workers.\n", num_threads);
+        exit(-1);
+    }
+
+    INSTRUMENT_PHASE_BEGIN(SIMULATE);
+    uint64_t next_block = first_block;
+    for (uint32_t t = 0; t < num_threads; t++)
+    {
+        workers[t].context = context;
+        workers[t].last_block = last_block;
+        workers[t].next_block = &next_block;
+        histogram_init(&workers[t].bins, context->bins.limit);
+    }
+    for (uint32_t t = 1; t < num_threads; t++)
+    {
+        if (pthread_create(&threads[t], NULL, _shard_worker, &workers[t]) != 0)
+        {
+            printf("Failed to start worker thread %u.\n", t);
+            exit(-1);
+        }
+    }
+    /* The calling thread is worker 0 */
+    _shard_worker(&workers[0]);
+    for (uint32_t t = 1; t < num_threads; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+    for (uint32_t t = 0; t < num_threads; t++)
+    {
+        histogram_merge(&context->bins, &workers[t].bins);
+        histogram_free(&workers[t].bins);
+    }
+    INSTRUMENT_PHASE_END(SIMULATE);
+
+    INSTRUMENT_PHASE_BEGIN(SAVE);
+    result_writer_t writer;
+    int ret = result_create(&writer, path, SHARD_SIMULATION, context, &context->bins);
+    if (ret == 0)
+    {
+        writer.header.completed = last_replica - first_replica;
+        writer.header.first_replica = first_replica;
+        writer.header.block_replicas = SHARD_BLOCK_REPLICAS;
+        ret = result_close(&writer);
+    }
+    INSTRUMENT_PHASE_END(SAVE);
+
+    free(threads);
+    free(workers);
+    return ret;
+}
+
+
+static const char* _shard_check(const result_header_t* header)
+{
+    if (strcmp(header->simulation, SHARD_SIMULATION) != 0)
+        return "is not a shard";
+    if (header->block_replicas == 0
+        || header->first_replica % header->block_replicas != 0
+        || !header->exact
+        || header->total != header->completed
+        || header->first_replica + header->completed > header->iterations)
+        return "is inconsistent";
+    return NULL;
+}
+
+
+static const char* _shard_mismatch(const result_header_t* a, const result_header_t* b)
+{
+    /* Everything that went into the replicas, and the build that ran them */
+    if (memcmp(a->code_version, b->code_version, sizeof(a->code_version)) != 0)
+        return "was run by another build";
+    if (a->model_id != b->model_id
+        || a->sampler != b->sampler
+        || a->precision != b->precision
+        || a->num_patches != b->num_patches
+        || a->initial_susceptibles != b->initial_susceptibles
+        || a->initial_infectives != b->initial_infectives
+        || a->initial_removed != b->initial_removed
+        || a->infection_rate != b->infection_rate
+        || a->recovery_rate != b->recovery_rate
+        || a->incubation_rate != b->incubation_rate
+        || a->tau_epsilon != b->tau_epsilon
+        || a->coupling_rate != b->coupling_rate
+        || a->coupling_interval != b->coupling_interval
+        || a->iterations != b->iterations
+        || a->limit != b->limit
+        || a->bin_width != b->bin_width
+        || a->block_replicas != b->block_replicas)
+        return "has other parameters";
+    if (a->seed != b->seed)
+        return "has another seed";
+    return NULL;
+}
+
+
+static int _shard_compare(const void* a, const void* b)
+{
+    const result_header_t* x = (*(const result_map_t* const*)a)->header;
+    const result_header_t* y = (*(const result_map_t* const*)b)->header;
+    if (x->first_replica != y->first_replica)
+        return x->first_replica < y->first_replica ? -1 : 1;
+    return (x->completed > y->completed) - (x->completed < y->completed);
+}
+
+
+static int _shard_merge_mapped(const char* path, const char* const* shard_paths, result_map_t** order, uint32_t num_shards)
+{
+    const result_header_t* first = order[0]->header;
+    for (uint32_t s = 0; s < num_shards; s++)
+    {
+        const char* error = _shard_check(order[s]->header);
+        if (error == NULL)
+            error = _shard_mismatch(first, order[s]->header);
+        if (error != NULL)
+        {
+            printf("%s %s.\n", shard_paths[s], error);
+            return -1;
+        }
+    }
+
+    /* In replica order, every replica exactly once */
+    qsort(order, num_shards, sizeof(result_map_t*), _shard_compare);
+    uint64_t covered = 0;
+    for (uint32_t s = 0; s < num_shards; s++)
+    {
+        const result_header_t* header = order[s]->header;
+        if (header->first_replica != covered)
+        {
+            printf("Shards %s replica %" PRIu64 ".\n", header->first_replica > covered ? "skip" : "repeat", covered);
+            return -1;
+        }
+        covered += header->completed;
+    }
+    if (covered != first->iterations)
+    {
+        printf("Shards stop at replica %" PRIu64 " of %" PRIu64 ".\n", covered, first->iterations);
+        return -1;
+    }
+
+    histogram_t merged;
+    histogram_init(&merged, first->limit);
+    merged.bin_width = first->bin_width;
+    for (uint32_t s = 0; s < num_shards; s++)
+    {
+        histogram_t view;
+        result_histogram(order[s], &view);
+        histogram_merge(&merged, &view);
+    }
+
+    /* The merged file is the shards' run, down to the build that ran it */
+    context_t context = {
+        .iterations             = first->iterations,
+        .infection_rate         = first->infection_rate,
+        .recovery_rate          = first->recovery_rate,
+        .incubation_rate        = first->incubation_rate,
+        .initial_susceptibles   = first->initial_susceptibles,
+        .initial_infectives     = first->initial_infectives,
+        .initial_removed        = first->initial_removed,
+        .model                  = (model_enum_t)first->model_id,
+        .precision              = (precision_enum_t)first->precision,
+        .sampler                = (sampler_enum_t)first->sampler,
+        .tau_epsilon            = first->tau_epsilon,
+        .num_patches            = first->num_patches,
+        .coupling_rate          = first->coupling_rate,
+        .coupling_interval      = first->coupling_interval,
+        .seed                   = first->seed,
+    };
+    char simulation[32];
+    snprintf(simulation, sizeof(simulation), "Markovian %s", first->model);
+    result_writer_t writer;
+    int ret = result_create(&writer, path, simulation, &context, &merged);
+    if (ret == 0)
+    {
+        memcpy(writer.header.code_version, first->code_version, sizeof(writer.header.code_version));
+        ret = result_close(&writer);
+    }
+    if (ret == 0)
+        histogram_print_stats(&merged);
+    histogram_free(&merged);
+    return ret;
+}
+
+
+int shard_merge(const char* path, const char* const* shard_paths, uint32_t num_shards)
+{
+    if (num_shards == 0)
+    {
+        printf("No shards to merge.\n");
+        return -1;
+    }
+    result_map_t* maps = (result_map_t*)calloc(num_shards, sizeof(result_map_t));
+    result_map_t** order = (result_map_t**)malloc(num_shards * sizeof(result_map_t*));
+    if (maps == NULL || order == NULL)
+    {
+        printf("Failed to allocate %u shards.\n", num_shards);
+        exit(-1);
+    }
+
+    INSTRUMENT_PHASE_BEGIN(SAVE);
+    int ret = 0;
+    for (uint32_t s = 0; s < num_shards && ret == 0; s++)
+    {
+        ret = result_map(&maps[s], shard_paths[s]);
+        order[s] = &maps[s];
+    }
+    if (ret == 0)
+        ret = _shard_merge_mapped(path, shard_paths, order, num_shards);
+    INSTRUMENT_PHASE_END(SAVE);
+
+    for (uint32_t s = 0; s < num_shards; s++)
+    {
+        result_unmap(&maps[s]);
+    }
+    free(order);
+    free(maps);
+    return ret;
+}
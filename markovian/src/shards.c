@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "shard.h"
+#include "instrument.h"
+
+
+/*
+ * Splits one Markovian run across processes or batch queue jobs.
+ *
+ *     build/shards run -k shard -n shards [options] <shard file>
+ *     build/shards merge <result file> <shard file>...
+ *
+ * run takes the parameters of the run, which every shard must be given
+ * alike:
+ *
+ *     -m SIR       model, SIR, SIS or SEIR
+ *     -a runs      sampler, runs or events
+ *     -G           GMP precision, SIR only
+ *     -b 0.01      infection rate
+ *     -g 0.1       recovery rate
+ *     -e 0.2       incubation rate
+ *     -S 99        initial susceptibles
+ *     -I 1         initial infectives
+ *     -R 0         initial removed
+ *     -r 1000      iterations, the replicas of the whole run
+ *     -l 1000      histogram limit
+ *     -s 1         seed
+ *     -t threads   worker threads, one per CPU by default
+ *
+ * A shard file is only written when the shard finishes, there is no
+ * checkpoint within a shard. Split a long run into shards short enough to
+ * lose, and run again any whose file is missing.
+ *
+ * merge checks that the shards are of one run by one build and cover each
+ * replica once, then writes the result file of the whole run. It is the
+ * same file for any number of shards.
+ */
+
+
+#define SHARDS_DEFAULT_LIMIT        1000
+
+
+static void _shards_usage(const char* prog)
+{
+    printf("Usage: %s run -k shard -n shards [-m model] [-a sampler] [-G] [-b beta] [-g gamma] [-e sigma]\n", prog);
+    printf("           [-S susceptibles] [-I infectives] [-R removed] [-r iterations] [-l limit] [-s seed] [-t threads] <shard file>\n");
+    printf("       %s merge <result file> <shard file>...\n", prog);
+    printf("Shards do not checkpoint, a shard that did not finish is run again.\n");
+}
+
+
+static int _shards_run(int argc, char** argv)
+{
+    context_t context;
+    context_defaults(&context);
+    context.seed = 1;
+    uint64_t limit = SHARDS_DEFAULT_LIMIT;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    context.num_threads = cpus > 0 ? (uint32_t)cpus : 1;
+    uint32_t shard = 0;
+    uint32_t num_shards = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "k:n:m:a:Gb:g:e:S:I:R:r:l:s:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'k':
+                shard = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                num_shards = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                if (models_parse(optarg, &context.model) != 0)
+                {
+                    printf("Unknown model %s.\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'a':
+                if (strcmp(optarg, "runs") == 0)
+                    context.sampler = SAMPLER_RUNS;
+                else if (strcmp(optarg, "events") == 0)
+                    context.sampler = SAMPLER_EVENTS;
+                else
+                {
+                    printf("Unknown sampler %s.\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'G':
+                context.precision = PRECISION_GMP;
+                break;
+            case 'b':
+                context.infection_rate = atof(optarg);
+                break;
+            case 'g':
+                context.recovery_rate = atof(optarg);
+                break;
+            case 'e':
+                context.incubation_rate = atof(optarg);
+                break;
+            case 'S':
+                context.initial_susceptibles = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'I':
+                context.initial_infectives = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'R':
+                context.initial_removed = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                context.iterations = strtoull(optarg, NULL, 10);
+                break;
+            case 'l':
+                limit = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                context.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                context.num_threads = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            default:
+                _shards_usage(argv[0]);
+                return -1;
+        }
+    }
+    if (optind != argc - 1 || num_shards == 0 || limit == 0)
+    {
+        _shards_usage(argv[0]);
+        return -1;
+    }
+
+    histogram_init(&context.bins, limit);
+    int ret = shard_simulate(&context, shard, num_shards, argv[optind]);
+    histogram_free(&context.bins);
+    return ret;
+}
+
+
+int main(int argc, char** argv)
+{
+    INSTRUMENT_START(NULL);
+
+    if (argc > 1 && strcmp(argv[1], "run") == 0)
+        return _shards_run(argc - 1, argv + 1);
+    if (argc > 3 && strcmp(argv[1], "merge") == 0)
+        return shard_merge(argv[2], (const char* const*)&argv[3], (uint32_t)(argc - 3));
+    _shards_usage(argv[0]);
+    return -1;
+}
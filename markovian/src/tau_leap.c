@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "tau_leap.h"
+#include "rng.h"
+#include "philox.h"
+#include "variates.h"
+#include "instrument.h"
+
+
+/*
+ * Approximate Markovian SIR for large populations.
+ *
+ * In continuous time every susceptible is infected at rate β and every
+ * infective recovers at rate γ, which gives the jump probabilities of
+ * _modelling_markovian_SIR_timestep(). Rather than one event at a time a
+ * leap of length τ draws
+ *
+ *      infections ~ Bin(S, 1 - e^(-βτ))
+ *      recoveries ~ Bin(I, 1 - e^(-γτ))
+ *
+ * which can never drive a compartment negative. τ is chosen so the expected
+ * change and standard deviation of S and I stay within ε of their size
+ * (Cao, Gillespie & Petzold, 2006). Individuals infected during a leap cannot
+ * also recover in it, the error this introduces shrinks with ε.
+ *
+ * Extinction is decided by exact single events: while S or I is below
+ * TAU_LEAP_CRITICAL_COUNT, or a leap would cover fewer than
+ * TAU_LEAP_MIN_LEAP_EVENTS events, events are stepped one at a time.
+ *
+ * ε trades accuracy for speed. At the default of 0.03 a leap covers roughly
+ * 3% of the smaller compartment, so an outbreak in a population of N takes
+ * O(log N / ε) leaps rather than 2N events.
+ */
+
+
+#define TAU_LEAP_CRITICAL_COUNT     10
+#define TAU_LEAP_MIN_LEAP_EVENTS    10.0
+#define TAU_LEAP_EXACT_BURST        100
+#define TAU_LEAP_REPLICA_CHUNK      256
+#define TAU_LEAP_UNIFORM_BLOCK      16
+
+
+typedef struct
+{
+    rng_t           rng;
+    uint32_t        next;
+    double          uniforms[TAU_LEAP_UNIFORM_BLOCK];
+} tau_leap_rng_t;
+
+
+typedef struct
+{
+    context_t*      context;
+    uint64_t*       next_replica;
+    histogram_t     bins;
+    histogram_t     chunk;          /* The claimed replicas, merged into bins and shown */
+} tau_leap_worker_t;
+
+
+static double _tau_leap_select(double susceptibles, double infectives, double beta, double gamma, double epsilon)
+{
+    /* Infection moves S by -1 and I by +1, recovery moves I by -1 */
+    double avg_infected = beta * susceptibles;
+    double avg_recovered = gamma * infectives;
+
+    double mu_s = -avg_infected;
+    double var_s = avg_infected;
+    double mu_i = avg_infected - avg_recovered;
+    double var_i = avg_infected + avg_recovered;
+
+    double bound_s = fmax(epsilon * susceptibles, 1.0);
+    double bound_i = fmax(epsilon * infectives, 1.0);
+
+    double tau = INFINITY;
+    if (mu_s != 0.0)
+        tau = fmin(tau, bound_s / fabs(mu_s));
+    if (var_s > 0.0)
+        tau = fmin(tau, bound_s * bound_s / var_s);
+    if (mu_i != 0.0)
+        tau = fmin(tau, bound_i / fabs(mu_i));
+    if (var_i > 0.0)
+        tau = fmin(tau, bound_i * bound_i / var_i);
+    return tau;
+}
+
+
+static double _tau_leap_uniform(tau_leap_rng_t* rng)
+{
+    /* The exact steps take one uniform each, drawn a block at a time */
+    if (rng->next == TAU_LEAP_UNIFORM_BLOCK)
+    {
+        rng_fill_uniform(&rng->rng, rng->uniforms, TAU_LEAP_UNIFORM_BLOCK);
+        rng->next = 0;
+    }
+    return rng->uniforms[rng->next++];
+}
+
+
+static uint64_t _tau_leap_simulate_markovian(context_t* context, tau_leap_rng_t* rng)
+{
+    uint32_t susceptibles = context->initial_susceptibles;
+    uint32_t infectives = context->initial_infectives;
+    double beta = context->infection_rate;
+    double gamma = context->recovery_rate;
+    uint64_t age = 0;
+    uint32_t exact_burst = 0;
+
+    while (infectives > 0)
+    {
+        if (!exact_burst
+            && susceptibles >= TAU_LEAP_CRITICAL_COUNT
+            && infectives >= TAU_LEAP_CRITICAL_COUNT)
+        {
+            double tau = _tau_leap_select(susceptibles, infectives, beta, gamma, context->tau_epsilon);
+            double expected_events = tau * (beta * susceptibles + gamma * infectives);
+            if (expected_events >= TAU_LEAP_MIN_LEAP_EVENTS)
+            {
+                uint32_t infections = variates_binomial(&rng->rng, susceptibles, -expm1(-beta * tau));
+                uint32_t recoveries = variates_binomial(&rng->rng, infectives, -expm1(-gamma * tau));
+                susceptibles -= infections;
+                infectives = infectives - recoveries + infections;
+                age += infections + recoveries;
+                continue;
+            }
+            /* Leaping no longer pays, step exactly for a while */
+            exact_burst = TAU_LEAP_EXACT_BURST;
+        }
+
+        double avg_infected = beta * susceptibles;
+        double avg_recovered = gamma * infectives;
+        double prob_infection = avg_infected / (avg_infected + avg_recovered);
+        if (_tau_leap_uniform(rng) < prob_infection)
+        {
+            susceptibles--;
+            infectives++;
+        }
+        else
+        {
+            infectives--;
+        }
+        age++;
+        if (exact_burst)
+            exact_burst--;
+    }
+
+    return age;
+}
+
+
+static void* _tau_leap_worker(void* arg)
+{
+    tau_leap_worker_t* worker = (tau_leap_worker_t*)arg;
+    context_t* context = worker->context;
+
+    /*
+     * Replica i seeds its generator from Philox stream i of the seed, as the
+     * metapopulation patches do, so which worker claims a chunk cannot change
+     * the result.
+     */
+    for (;;)
+    {
+        if (progress_cancelled(context->progress))
+            break;
+        uint64_t first = __atomic_fetch_add(worker->next_replica, TAU_LEAP_REPLICA_CHUNK, __ATOMIC_RELAXED);
+        if (first >= context->iterations)
+            break;
+        uint64_t last = first + TAU_LEAP_REPLICA_CHUNK;
+        if (last > context->iterations)
+            last = context->iterations;
+
+        histogram_reset(&worker->chunk);
+        for (uint64_t i = first; i < last; i++)
+        {
+            philox_t philox;
+            philox_init(&philox, context->seed, i);
+            tau_leap_rng_t rng;
+            rng_seed(&rng.rng, philox_next64(&philox));
+            rng.next = TAU_LEAP_UNIFORM_BLOCK;
+            uint64_t age = _tau_leap_simulate_markovian(context, &rng);
+            histogram_add(&worker->chunk, age, 1);
+            INSTRUMENT_COUNT(EVENTS, age);
+        }
+        histogram_merge(&worker->bins, &worker->chunk);
+        if (context->progress != NULL)
+            progress_add(context->progress, &worker->chunk, last - first);
+    }
+    return NULL;
+}
+
+
+void tau_leap_simulate(context_t* context)
+{
+    printf("Infection Rate: %f\n", context->infection_rate);
+
+    histogram_reset(&context->bins);
+
+    uint32_t num_threads = context->num_threads > 0 ? context->num_threads : 1;
+    uint64_t next_replica = 0;
+    tau_leap_worker_t* workers = (tau_leap_worker_t*)calloc(num_threads, sizeof(tau_leap_worker_t));
+    pthread_t* threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+
+    for (uint32_t t = 0; t < num_threads; t++)
+    {
+        workers[t].context = context;
+        workers[t].next_replica = &next_replica;
+        histogram_init(&workers[t].bins, context->bins.limit);
+        histogram_init(&workers[t].chunk, context->bins.limit);
+    }
+    for (uint32_t t = 1; t < num_threads; t++)
+    {
+        if (pthread_create(&threads[t], NULL, _tau_leap_worker, &workers[t]) != 0)
+        {
+            printf("Failed to start worker thread %u.\n", t);
+            exit(-1);
+        }
+    }
+    /* The calling thread is worker 0 */
+    _tau_leap_worker(&workers[0]);
+    for (uint32_t t = 1; t < num_threads; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+
+    /* Counts add up the same whichever worker ran a replica */
+    for (uint32_t t = 0; t < num_threads; t++)
+    {
+        histogram_merge(&context->bins, &workers[t].bins);
+        histogram_free(&workers[t].bins);
+        histogram_free(&workers[t].chunk);
+    }
+
+    free(threads);
+    free(workers);
+}
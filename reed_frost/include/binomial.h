@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+#include <gmp.h>
+
+#include "common.h"
+#include "rng.h"
+
+
+// Reference arbitrary precision path
+void factorial(unsigned long x, mpz_t x_fact);
+void binomial_distribution(mpf_t probability, int n, mpf_t p, int k);
+void cumulative_binomial_distribution(prob_t* cum_bin_dist, int n, mpf_t p);
+void cumulative_uniform_random_float(rng_t* rng, mpf_t cumulative_probabilty);
+bin_t random_binomial_integer(rng_t* rng, int n, prob_t* cum_prob_arr);
+
+// Native sampler validation
+int binomial_validate(rng_t* rng, uint64_t draws);
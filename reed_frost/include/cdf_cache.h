@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <gmp.h>
+
+#include "common.h"
+#include "rng.h"
+
+
+typedef struct cdf_cache_entry_t
+{
+    int                         n;
+    int                         z;
+    mpf_t                       indiv_probability;
+    prob_t*                     cdf;
+    size_t                      bytes;
+    struct cdf_cache_entry_t*   hash_next;
+    struct cdf_cache_entry_t*   lru_prev;
+    struct cdf_cache_entry_t*   lru_next;
+} cdf_cache_entry_t;
+
+
+typedef struct
+{
+    cdf_cache_entry_t**         buckets;
+    size_t                      num_buckets;
+    size_t                      num_entries;
+    cdf_cache_entry_t*          lru_head;       // Most recently used
+    cdf_cache_entry_t*          lru_tail;       // Next to be evicted
+    size_t                      bytes;
+    size_t                      max_bytes;
+    uint64_t                    hits;
+    uint64_t                    misses;
+    uint64_t                    evictions;
+} cdf_cache_t;
+
+
+cdf_cache_t* cdf_cache_new(size_t max_bytes);
+void cdf_cache_free(cdf_cache_t* cache);
+prob_t* cdf_cache_get(cdf_cache_t* cache, int n, int z, mpf_t indiv_probability);
+bin_t cdf_cache_sample(rng_t* rng, int n, prob_t* cdf);
+void cdf_cache_print_stats(cdf_cache_t* cache);
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "common.h"
+#include "rng.h"
+#include "histogram.h"
+
+
+// Checkpoint files, native byte order apart from the rng state:
+//
+//     checkpoint_header_t
+//     per thread, in thread order:
+//         checkpoint_thread_t
+//         num_keys (uint32_t total size, bin_t count) pairs, by total size
+//
+// Each thread runs a fixed share of the replicas on its own stream, so its
+// completed count, stream state and histogram are all it needs to carry on.
+
+
+#define CHECKPOINT_MAGIC                "RFCHKPT"
+#define CHECKPOINT_VERSION              1
+#define CHECKPOINT_BYTE_ORDER           0x01020304u
+#define CHECKPOINT_DEFAULT_INTERVAL     60.0        // Seconds between checkpoints
+
+
+typedef struct
+{
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    byte_order;
+    char        code_version[128];      // GIT_VERSION of the program that ran, cut to fit
+    uint32_t    sampler;
+    uint32_t    cached;                 // GMP sampler with a CDF cache, whose tables may round differently
+    int32_t     iterations;
+    int32_t     initial_susceptibles;
+    int32_t     initial_infectives;
+    int32_t     num_threads;
+    double      indiv_probability;
+    uint64_t    seed;
+} checkpoint_header_t;
+
+
+typedef struct
+{
+    int32_t     completed;
+    uint32_t    num_keys;
+    uint8_t     rng[RNG_STATE_BYTES];
+} checkpoint_thread_t;
+
+
+// What a worker hands over to be saved, or gets back on resume
+typedef struct
+{
+    int             completed;
+    rng_t           rng;
+    histogram_t*    total_size_bins;
+} checkpoint_stream_t;
+
+
+int checkpoint_save(const char* path, const context_t* context, const checkpoint_stream_t* streams);
+int checkpoint_load(const char* path, const context_t* context, checkpoint_stream_t* streams);
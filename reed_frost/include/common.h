@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <gmp.h>
+
+
+typedef uint32_t bin_t;
+typedef mpf_t prob_t;
+
+
+typedef enum
+{
+    SAMPLER_NATIVE,     // Double precision inversion / BTPE sampler
+    SAMPLER_GMP,        // Reference arbitrary precision CDF scan
+} sampler_enum_t;
+
+
+typedef struct
+{
+    int iterations;
+    int initial_susceptibles;
+    int initial_infectives;
+    mpf_t indiv_probability;
+    sampler_enum_t sampler;
+    size_t cache_bytes;         // Per run, split evenly between threads
+    uint64_t seed;
+    int num_threads;
+    const char* checkpoint_path;    // NULL for none, see checkpoint.h
+    double checkpoint_interval;     // Seconds between checkpoints
+} context_t;
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <gmp.h>
+
+#include "common.h"
+#include "histogram.h"
+
+
+double* exact_final_size_native(int initial_susceptibles, int initial_infectives, double indiv_probability);
+double* exact_final_size_gmp(int initial_susceptibles, int initial_infectives, mpf_t indiv_probability);
+histogram_t* exact_final_size(context_t* context);
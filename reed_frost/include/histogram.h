@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+
+typedef struct
+{
+    uint32_t*   keys;           // Total size + 1, 0 marks an empty slot
+    bin_t*      counts;
+    size_t      capacity;
+    size_t      size;
+} histogram_t;
+
+
+void histogram_init(histogram_t* histogram);
+void histogram_free(histogram_t* histogram);
+void histogram_add(histogram_t* histogram, uint32_t key, bin_t count);
+bin_t histogram_get(histogram_t* histogram, uint32_t key);
+void histogram_merge(histogram_t* dst, histogram_t* src);
+uint64_t histogram_total(histogram_t* histogram);
+size_t histogram_sorted_keys(histogram_t* histogram, uint32_t* keys);
+void histogram_print(histogram_t* histogram, uint32_t num_bins);
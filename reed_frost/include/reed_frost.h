@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+#include <gmp.h>
+
+#include "common.h"
+#include "cdf_cache.h"
+#include "rng.h"
+#include "histogram.h"
+
+
+int check(histogram_t* histogram, int sum);
+void get_infection_probability(mpf_t infection_probability, int infectives, mpf_t indiv_probability);
+int reed_frost_model_timestep(rng_t* rng, int susceptibles, int infectives, mpf_t indiv_probability, prob_t* cum_bin_dist, cdf_cache_t* cache);
+int reed_frost_model(rng_t* rng, int initial_susceptibles, int initial_infectives, mpf_t indiv_probability, prob_t* cum_bin_dist, cdf_cache_t* cache);
+int reed_frost_model_native_timestep(rng_t* rng, int susceptibles, int infectives, double indiv_probability);
+int reed_frost_model_native(rng_t* rng, int initial_susceptibles, int initial_infectives, double indiv_probability);
+histogram_t* reed_frost_model_simulate(context_t* context);
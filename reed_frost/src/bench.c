@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <gmp.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "binomial.h"
+#include "reed_frost.h"
+#include "cdf_cache.h"
+#include "rng.h"
+#include "histogram.h"
+#include "bench.h"
+
+
+#define BENCH_SEED                  1
+#define BENCH_SUSCEPTIBLES          49
+#define BENCH_INFECTIVES            1
+#define BENCH_INDIV_PROBABILITY     0.1
+#define BENCH_NATIVE_REPLICAS       100000
+#define BENCH_GMP_REPLICAS          20000
+#define BENCH_CACHE_MIB             64
+
+
+// Canonical parameters every case runs on, the defaults of build/main
+typedef struct
+{
+    rng_t           rng;
+    int             n;
+    int             z;
+    double          p;
+    mpf_t           p_f;
+    prob_t*         cdf;
+    cdf_cache_t*    cache;
+} bench_case_t;
+
+
+static void _bench_binomial_distribution(void* arg, uint64_t ops)
+{
+    bench_case_t* c = (bench_case_t*)arg;
+    mpf_t probability;
+    mpf_init(probability);
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        binomial_distribution(probability, c->n, c->p_f, 5);
+    }
+    bench_sink = (uint64_t)(mpf_get_d(probability) * 1e9);
+    mpf_clear(probability);
+}
+
+
+static void _bench_cumulative_binomial_distribution(void* arg, uint64_t ops)
+{
+    bench_case_t* c = (bench_case_t*)arg;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        cumulative_binomial_distribution(c->cdf, c->n, c->p_f);
+    }
+    bench_sink = (uint64_t)(mpf_get_d(c->cdf[c->n]) * 1e9);
+}
+
+
+static void _bench_random_binomial_integer(void* arg, uint64_t ops)
+{
+    bench_case_t* c = (bench_case_t*)arg;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        sum += random_binomial_integer(&c->rng, c->n, c->cdf);
+    }
+    bench_sink = sum;
+}
+
+
+static void _bench_cdf_cache_sample(void* arg, uint64_t ops)
+{
+    bench_case_t* c = (bench_case_t*)arg;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        sum += cdf_cache_sample(&c->rng, c->n, c->cdf);
+    }
+    bench_sink = sum;
+}
+
+
+static void _bench_native_timestep(void* arg, uint64_t ops)
+{
+    bench_case_t* c = (bench_case_t*)arg;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        sum += reed_frost_model_native_timestep(&c->rng, c->n, c->z, c->p);
+    }
+    bench_sink = sum;
+}
+
+
+static void _bench_gmp_timestep(void* arg, uint64_t ops)
+{
+    bench_case_t* c = (bench_case_t*)arg;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        sum += reed_frost_model_timestep(&c->rng, c->n, c->z, c->p_f, c->cdf, c->cache);
+    }
+    bench_sink = sum;
+}
+
+
+static void _bench_native_replica(void* arg, uint64_t ops)
+{
+    bench_case_t* c = (bench_case_t*)arg;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        sum += reed_frost_model_native(&c->rng, c->n, c->z, c->p);
+    }
+    bench_sink = sum;
+}
+
+
+static void _bench_simulate(bench_t* bench, const char* name, sampler_enum_t sampler, int iterations, int num_threads, double p)
+{
+    context_t context = {
+        .iterations             = iterations,
+        .initial_susceptibles   = BENCH_SUSCEPTIBLES,
+        .initial_infectives     = BENCH_INFECTIVES,
+        .sampler                = sampler,
+        .cache_bytes            = (size_t)BENCH_CACHE_MIB << 20,
+        .seed                   = BENCH_SEED,
+        .num_threads            = num_threads,
+    };
+    mpf_init_set_d(context.indiv_probability, p);
+
+    double begin = bench_now();
+    histogram_t* bins = reed_frost_model_simulate(&context);
+    double seconds = bench_now() - begin;
+    bench_record(bench, name, iterations / seconds, "replicas/s", 1);
+    if (!check(bins, iterations))
+    {
+        printf("%s: unequal bin contents and iterations set mismatch.\n", name);
+        exit(-1);
+    }
+
+    histogram_free(bins);
+    free(bins);
+    mpf_clear(context.indiv_probability);
+}
+
+
+static void _bench_usage(const char* prog)
+{
+    printf("Usage: %s [-o results.tsv] [-b baseline.tsv] [-T tolerance] [-t threads]\n", prog);
+}
+
+
+int main(int argc, char** argv)
+{
+    const char* output_path = NULL;
+    const char* baseline_path = NULL;
+    double tolerance = BENCH_TOLERANCE;
+    int num_threads = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:b:T:t:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'b':
+                baseline_path = optarg;
+                break;
+            case 'T':
+                tolerance = atof(optarg);
+                break;
+            case 't':
+                num_threads = atoi(optarg);
+                break;
+            default:
+                _bench_usage(argv[0]);
+                return opt == 'h' ? 0 : -1;
+        }
+    }
+
+    bench_case_t c = {.n=BENCH_SUSCEPTIBLES, .z=BENCH_INFECTIVES, .p=BENCH_INDIV_PROBABILITY};
+    rng_seed(&c.rng, BENCH_SEED);
+    mpf_init_set_d(c.p_f, c.p);
+    c.cdf = (prob_t*)malloc((c.n + 2) * sizeof(prob_t));
+    for (int i = 0; i < c.n + 2; i++)
+    {
+        mpf_init(c.cdf[i]);
+    }
+
+    bench_t bench;
+    bench_init(&bench, "reed_frost");
+
+    // Building a CDF table, then scanning and bisecting it
+    bench_time(&bench, "binomial_distribution", _bench_binomial_distribution, &c);
+    bench_time(&bench, "cumulative_binomial_distribution", _bench_cumulative_binomial_distribution, &c);
+    bench_time(&bench, "random_binomial_integer", _bench_random_binomial_integer, &c);
+    bench_time(&bench, "cdf_cache_sample", _bench_cdf_cache_sample, &c);
+
+    // One generation, and one whole epidemic, from the initial state
+    bench_time(&bench, "native_timestep", _bench_native_timestep, &c);
+    bench_time(&bench, "gmp_timestep", _bench_gmp_timestep, &c);
+    c.cache = cdf_cache_new((size_t)BENCH_CACHE_MIB << 20);
+    bench_time(&bench, "gmp_timestep_cached", _bench_gmp_timestep, &c);
+    bench_time(&bench, "native_replica", _bench_native_replica, &c);
+    bench_rng(&bench);
+
+    _bench_simulate(&bench, "native_replicas", SAMPLER_NATIVE, BENCH_NATIVE_REPLICAS, num_threads, c.p);
+    _bench_simulate(&bench, "gmp_replicas", SAMPLER_GMP, BENCH_GMP_REPLICAS, num_threads, c.p);
+
+    cdf_cache_free(c.cache);
+    for (int i = 0; i < c.n + 2; i++)
+    {
+        mpf_clear(c.cdf[i]);
+    }
+    free(c.cdf);
+    mpf_clear(c.p_f);
+
+    bench_print(&bench);
+    if (output_path != NULL && bench_write(&bench, output_path) != 0)
+        return -1;
+    if (baseline_path != NULL && bench_compare(&bench, baseline_path, tolerance) > 0)
+        return 1;
+    return 0;
+}
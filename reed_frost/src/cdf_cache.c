@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <gmp.h>
+
+#include "cdf_cache.h"
+#include "binomial.h"
+#include "reed_frost.h"
+#include "instrument.h"
+
+
+/*
+ * The CDF of new infectives depends only on the susceptibles n, the
+ * infectives z and the individual probability p, and replicas keep revisiting
+ * the same few (n, z). Tables are built once with the GMP reference code and
+ * kept in a hash table threaded on an LRU list, evicting the least recently
+ * used table once the byte budget is exceeded.
+ */
+
+
+#define CDF_CACHE_INITIAL_BUCKETS   256
+
+
+static size_t _cdf_cache_table_bytes(int n)
+{
+    // n+2 mpf_t headers plus the limbs mpf_init allocates for each of them
+    size_t limbs = mpf_get_default_prec() / GMP_NUMB_BITS + 2;
+    return (n + 2) * (sizeof(prob_t) + limbs * sizeof(mp_limb_t)) + sizeof(cdf_cache_entry_t);
+}
+
+static uint64_t _cdf_cache_hash(int n, int z, mpf_t indiv_probability)
+{
+    double p = mpf_get_d(indiv_probability);
+    uint64_t p_bits;
+    memcpy(&p_bits, &p, sizeof(p_bits));
+
+    // splitmix64 finaliser over the packed key
+    uint64_t h = ((uint64_t)(uint32_t)n << 32 | (uint32_t)z) ^ p_bits;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static void _cdf_cache_lru_unlink(cdf_cache_t* cache, cdf_cache_entry_t* entry)
+{
+    if (entry->lru_prev)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        cache->lru_head = entry->lru_next;
+    if (entry->lru_next)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        cache->lru_tail = entry->lru_prev;
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void _cdf_cache_lru_push_front(cdf_cache_t* cache, cdf_cache_entry_t* entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head)
+        cache->lru_head->lru_prev = entry;
+    cache->lru_head = entry;
+    if (!cache->lru_tail)
+        cache->lru_tail = entry;
+}
+
+static void _cdf_cache_entry_free(cdf_cache_entry_t* entry)
+{
+    for (int i = 0; i <= entry->n + 1; i++)
+    {
+        mpf_clear(entry->cdf[i]);
+    }
+    free(entry->cdf);
+    mpf_clear(entry->indiv_probability);
+    free(entry);
+}
+
+static void _cdf_cache_rehash(cdf_cache_t* cache, size_t num_buckets)
+{
+    cdf_cache_entry_t** buckets = (cdf_cache_entry_t**)calloc(num_buckets, sizeof(cdf_cache_entry_t*));
+    for (cdf_cache_entry_t* entry = cache->lru_head; entry; entry = entry->lru_next)
+    {
+        size_t b = _cdf_cache_hash(entry->n, entry->z, entry->indiv_probability) & (num_buckets - 1);
+        entry->hash_next = buckets[b];
+        buckets[b] = entry;
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->num_buckets = num_buckets;
+}
+
+static void _cdf_cache_evict(cdf_cache_t* cache)
+{
+    cdf_cache_entry_t* victim = cache->lru_tail;
+    size_t b = _cdf_cache_hash(victim->n, victim->z, victim->indiv_probability) & (cache->num_buckets - 1);
+    cdf_cache_entry_t** link = &cache->buckets[b];
+    while (*link != victim)
+    {
+        link = &(*link)->hash_next;
+    }
+    *link = victim->hash_next;
+
+    _cdf_cache_lru_unlink(cache, victim);
+    cache->bytes -= victim->bytes;
+    cache->num_entries--;
+    cache->evictions++;
+    _cdf_cache_entry_free(victim);
+}
+
+cdf_cache_t* cdf_cache_new(size_t max_bytes)
+{
+    cdf_cache_t* cache = (cdf_cache_t*)calloc(1, sizeof(cdf_cache_t));
+    cache->max_bytes = max_bytes;
+    cache->num_buckets = CDF_CACHE_INITIAL_BUCKETS;
+    cache->buckets = (cdf_cache_entry_t**)calloc(cache->num_buckets, sizeof(cdf_cache_entry_t*));
+    return cache;
+}
+
+void cdf_cache_free(cdf_cache_t* cache)
+{
+    if (!cache)
+    {
+        return;
+    }
+    while (cache->lru_head)
+    {
+        cdf_cache_entry_t* entry = cache->lru_head;
+        cache->lru_head = entry->lru_next;
+        _cdf_cache_entry_free(entry);
+    }
+    free(cache->buckets);
+    free(cache);
+}
+
+prob_t* cdf_cache_get(cdf_cache_t* cache, int n, int z, mpf_t indiv_probability)
+{
+    size_t b = _cdf_cache_hash(n, z, indiv_probability) & (cache->num_buckets - 1);
+    for (cdf_cache_entry_t* entry = cache->buckets[b]; entry; entry = entry->hash_next)
+    {
+        if (entry->n == n && entry->z == z && mpf_cmp(entry->indiv_probability, indiv_probability) == 0)
+        {
+            cache->hits++;
+            _cdf_cache_lru_unlink(cache, entry);
+            _cdf_cache_lru_push_front(cache, entry);
+            return entry->cdf;
+        }
+    }
+    cache->misses++;
+
+    cdf_cache_entry_t* entry = (cdf_cache_entry_t*)calloc(1, sizeof(cdf_cache_entry_t));
+    entry->n = n;
+    entry->z = z;
+    mpf_init_set(entry->indiv_probability, indiv_probability);
+    entry->cdf = (prob_t*)malloc((n + 2) * sizeof(prob_t));
+    for (int i = 0; i <= n + 1; i++)
+    {
+        mpf_init(entry->cdf[i]);
+    }
+    entry->bytes = _cdf_cache_table_bytes(n);
+
+    mpf_t p;
+    mpf_init(p);
+    INSTRUMENT_COUNT(MPF_INITS, n + 4);
+    get_infection_probability(p, z, indiv_probability);
+    cumulative_binomial_distribution(entry->cdf, n, p);
+    mpf_clear(p);
+
+    // The newest table always stays, even when it alone is over budget
+    while (cache->lru_tail && cache->bytes + entry->bytes > cache->max_bytes)
+    {
+        _cdf_cache_evict(cache);
+    }
+
+    if (cache->num_entries >= 2 * cache->num_buckets)
+    {
+        _cdf_cache_rehash(cache, 2 * cache->num_buckets);
+    }
+    b = _cdf_cache_hash(n, z, indiv_probability) & (cache->num_buckets - 1);
+    entry->hash_next = cache->buckets[b];
+    cache->buckets[b] = entry;
+    _cdf_cache_lru_push_front(cache, entry);
+    cache->bytes += entry->bytes;
+    cache->num_entries++;
+    return entry->cdf;
+}
+
+bin_t cdf_cache_sample(rng_t* rng, int n, prob_t* cdf)
+{
+    // Same inversion as random_binomial_integer(), by bisection: the result
+    // is the k for which cdf[k] < u <= cdf[k+1]
+    mpf_t cum_uni_prob;
+    mpf_init(cum_uni_prob);
+    INSTRUMENT_COUNT(MPF_INITS, 1);
+    cumulative_uniform_random_float(rng, cum_uni_prob);
+
+    int lower = 1;
+    int upper = n + 1;
+    if (mpf_cmp(cum_uni_prob, cdf[upper]) > 0)
+    {
+        // u = 1 above a CDF that rounded to just under 1
+        mpf_clear(cum_uni_prob);
+        return n;
+    }
+    while (lower < upper)
+    {
+        int mid = lower + (upper - lower) / 2;
+        if (mpf_cmp(cum_uni_prob, cdf[mid]) > 0)
+            lower = mid + 1;
+        else
+            upper = mid;
+    }
+    mpf_clear(cum_uni_prob);
+    return lower - 1;
+}
+
+void cdf_cache_print_stats(cdf_cache_t* cache)
+{
+    uint64_t lookups = cache->hits + cache->misses;
+    printf("CDF cache: %"PRIu64" hits, %"PRIu64" misses (%.1f%% hit rate), %"PRIu64" evictions, %zu tables in %zu / %zu bytes\n",
+           cache->hits,
+           cache->misses,
+           lookups ? 100.0 * cache->hits / lookups : 0.0,
+           cache->evictions,
+           cache->num_entries,
+           cache->bytes,
+           cache->max_bytes);
+}
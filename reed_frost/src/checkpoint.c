@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <gmp.h>
+
+#include "checkpoint.h"
+
+
+#ifndef GIT_VERSION
+#define GIT_VERSION             "unknown"
+#endif
+
+
+static void _checkpoint_header(checkpoint_header_t* header, const context_t* context)
+{
+    memset(header, 0, sizeof(checkpoint_header_t));
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header->version = CHECKPOINT_VERSION;
+    header->byte_order = CHECKPOINT_BYTE_ORDER;
+    strncpy(header->code_version, GIT_VERSION, sizeof(header->code_version) - 1);
+    header->sampler = context->sampler;
+    header->iterations = context->iterations;
+    header->initial_susceptibles = context->initial_susceptibles;
+    header->initial_infectives = context->initial_infectives;
+    header->num_threads = context->num_threads;
+    header->indiv_probability = mpf_get_d(context->indiv_probability);
+    header->cached = context->sampler == SAMPLER_GMP && context->cache_bytes > 0;
+    header->seed = context->seed;
+}
+
+static int _checkpoint_write_thread(FILE* fp, const checkpoint_stream_t* stream)
+{
+    histogram_t* bins = stream->total_size_bins;
+    checkpoint_thread_t thread = {.completed=stream->completed, .num_keys=(uint32_t)bins->size};
+    rng_save(&stream->rng, thread.rng);
+    if (fwrite(&thread, sizeof(thread), 1, fp) != 1)
+    {
+        return -1;
+    }
+
+    uint32_t* keys = (uint32_t*)malloc((bins->size + 1) * sizeof(uint32_t));
+    size_t n = histogram_sorted_keys(bins, keys);
+    int ret = 0;
+    for (size_t i = 0; i < n && ret == 0; i++)
+    {
+        bin_t count = histogram_get(bins, keys[i]);
+        if (fwrite(&keys[i], sizeof(uint32_t), 1, fp) != 1 || fwrite(&count, sizeof(bin_t), 1, fp) != 1)
+        {
+            ret = -1;
+        }
+    }
+    free(keys);
+    return ret;
+}
+
+int checkpoint_save(const char* path, const context_t* context, const checkpoint_stream_t* streams)
+{
+    // Written beside path and renamed over it, so a crash leaves the last good one
+    char* temp_path = (char*)malloc(strlen(path) + 5);
+    sprintf(temp_path, "%s.tmp", path);
+    FILE* fp = fopen(temp_path, "wb");
+    if (fp == NULL)
+    {
+        printf("Cannot open checkpoint %s.\n", temp_path);
+        free(temp_path);
+        return -1;
+    }
+
+    checkpoint_header_t header;
+    _checkpoint_header(&header, context);
+    int ret = fwrite(&header, sizeof(header), 1, fp) == 1 ? 0 : -1;
+    for (int t = 0; t < context->num_threads && ret == 0; t++)
+    {
+        ret = _checkpoint_write_thread(fp, &streams[t]);
+    }
+    if (ret == 0)
+    {
+        ret = fflush(fp) == 0 && fsync(fileno(fp)) == 0 ? 0 : -1;
+    }
+    fclose(fp);
+    if (ret == 0 && rename(temp_path, path) != 0)
+    {
+        ret = -1;
+    }
+    if (ret != 0)
+    {
+        printf("Cannot write checkpoint %s.\n", temp_path);
+        unlink(temp_path);
+    }
+    free(temp_path);
+    return ret;
+}
+
+static const char* _checkpoint_mismatch(const checkpoint_header_t* saved, const context_t* context)
+{
+    // Anything that changes which numbers are drawn, or which thread draws them
+    checkpoint_header_t header;
+    _checkpoint_header(&header, context);
+    if (memcmp(saved->magic, header.magic, sizeof(header.magic)) != 0)
+    {
+        return "is not a checkpoint";
+    }
+    if (saved->byte_order != header.byte_order || saved->version != header.version)
+    {
+        return "has another version or byte order";
+    }
+    if (strncmp(saved->code_version, header.code_version, sizeof(header.code_version)) != 0)
+    {
+        return "was written by another build";
+    }
+    if (saved->num_threads != header.num_threads)
+    {
+        return "was run on another number of threads";
+    }
+    if (saved->sampler != header.sampler
+        || saved->iterations != header.iterations
+        || saved->initial_susceptibles != header.initial_susceptibles
+        || saved->initial_infectives != header.initial_infectives
+        || saved->indiv_probability != header.indiv_probability
+        || saved->cached != header.cached
+        || saved->seed != header.seed)
+    {
+        return "is for other parameters";
+    }
+    return NULL;
+}
+
+static int _checkpoint_read_thread(FILE* fp, const context_t* context, int index, checkpoint_stream_t* stream)
+{
+    checkpoint_thread_t thread;
+    if (fread(&thread, sizeof(thread), 1, fp) != 1 || rng_restore(&stream->rng, thread.rng) != 0)
+    {
+        return -1;
+    }
+    int share = context->iterations / context->num_threads + (index < context->iterations % context->num_threads);
+    if (thread.completed < 0 || thread.completed > share)
+    {
+        return -1;
+    }
+
+    uint64_t total = 0;
+    for (uint32_t k = 0; k < thread.num_keys; k++)
+    {
+        uint32_t key;
+        bin_t count;
+        if (fread(&key, sizeof(uint32_t), 1, fp) != 1 || fread(&count, sizeof(bin_t), 1, fp) != 1)
+        {
+            return -1;
+        }
+        histogram_add(stream->total_size_bins, key, count);
+        total += count;
+    }
+    stream->completed = thread.completed;
+    return total == (uint64_t)thread.completed ? 0 : -1;
+}
+
+int checkpoint_load(const char* path, const context_t* context, checkpoint_stream_t* streams)
+{
+    // 0 with every stream put back when path can be resumed, -1 to start afresh
+    if (access(path, F_OK) != 0)
+    {
+        return -1;
+    }
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        printf("Cannot open checkpoint %s, starting afresh.\n", path);
+        return -1;
+    }
+
+    checkpoint_header_t header;
+    const char* mismatch = fread(&header, sizeof(header), 1, fp) == 1 ? _checkpoint_mismatch(&header, context) : "is truncated";
+    for (int t = 0; t < context->num_threads && mismatch == NULL; t++)
+    {
+        if (_checkpoint_read_thread(fp, context, t, &streams[t]) != 0)
+        {
+            mismatch = "is truncated or inconsistent";
+        }
+    }
+    fclose(fp);
+    if (mismatch != NULL)
+    {
+        printf("Checkpoint %s %s, starting afresh.\n", path, mismatch);
+        return -1;
+    }
+
+    int completed = 0;
+    for (int t = 0; t < context->num_threads; t++)
+    {
+        completed += streams[t].completed;
+    }
+    printf("Resuming from %s at %d of %d replicas.\n", path, completed, context->iterations);
+    return 0;
+}
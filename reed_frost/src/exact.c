@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
+#include <gmp.h>
+
+#include "exact.h"
+#include "reed_frost.h"
+
+
+/*
+ * Rather than sampling epidemics, carry the probability mass of every
+ * (susceptibles, infectives) state through the chain binomial.
+ *
+ * From (n, z) the next generation infects k ~ Bin(n, 1 - (1 - p)^z) and moves
+ * to (n - k, k). Susceptibles never increase, so visiting n from the initial
+ * count downwards sees every state after all of its predecessors. As in
+ * reed_frost_model_timestep(), k = 0 and k = n both end the epidemic with a
+ * total size of initial_susceptibles - n.
+ *
+ * Past the initial state every state was reached by infecting z, from
+ * n + z <= initial_susceptibles, and n > 0 since k = n ends the epidemic. The
+ * probability of reaching (n, z) is kept in mass[_exact_index(n, z)], beside
+ * the other states reached from n + z, so that spreading one state's row is
+ * a run of adjacent additions.
+ */
+
+
+#define EXACT_MAX_SUSCEPTIBLES      5000        // About 25 s and 100 MB near R0 = 2.5 in doubles
+#define EXACT_ROW_CUTOFF            (DBL_EPSILON * DBL_EPSILON)
+
+
+static size_t _exact_moves(int n)
+{
+    // The states (n - k, k) reached from level n, for k = 1 .. n - 1, start here
+    return (size_t)n * (n - 1) / 2;
+}
+
+static size_t _exact_index(int n, int z)
+{
+    return _exact_moves(n + z) + z - 1;
+}
+
+static size_t _exact_num_states(int initial_susceptibles)
+{
+    return _exact_moves(initial_susceptibles + 1);
+}
+
+static void _exact_binomial_row_native(double* row, int n, double p, const double* reciprocal, int* first, int* last)
+{
+    // Fills row[*first .. *last], the terms of Bin(n, p) that matter in double precision
+    if (p <= 0.0 || p >= 1.0)
+    {
+        *first = *last = p <= 0.0 ? 0 : n;
+        row[*first] = 1.0;
+        return;
+    }
+
+    // Log space at the mode only, where the term is at least 1/(n+1) and cannot underflow
+    double q = 1.0 - p;
+    int mode = (int)((n + 1) * p);
+    mode = mode > n ? n : mode;
+    row[mode] = exp(lgamma(n + 1.0) - lgamma(mode + 1.0) - lgamma(n - mode + 1.0)
+                    + mode * log(p) + (n - mode) * log1p(-p));
+
+    // Outwards by f(k) = f(k-1) · (n-k+1)/k · p/q, the terms only shrink past the mode. Once under
+    // EXACT_ROW_CUTOFF of the mode's they are dropped, less than n · EXACT_ROW_CUTOFF of mass
+    double cutoff = row[mode] * EXACT_ROW_CUTOFF;
+    double ratio = p / q;
+    double inverse_ratio = q / p;
+    int k = mode;
+    while (k < n && row[k] >= cutoff)
+    {
+        row[k + 1] = row[k] * (ratio * (n - k) * reciprocal[k + 1]);
+        k++;
+    }
+    *last = k;
+    k = mode;
+    while (k > 0 && row[k] >= cutoff)
+    {
+        row[k - 1] = row[k] * (inverse_ratio * k * reciprocal[n - k + 1]);
+        k--;
+    }
+    *first = k;
+}
+
+double* exact_final_size_native(int initial_susceptibles, int initial_infectives, double indiv_probability)
+{
+    int num_bins = initial_susceptibles + initial_infectives + 1;
+    double* final_size = (double*)calloc(num_bins, sizeof(double));
+    size_t num_states = _exact_num_states(initial_susceptibles);
+    double* mass = (double*)calloc(num_states, sizeof(double));
+    double* row = (double*)malloc((initial_susceptibles + 1) * sizeof(double));
+    double* reciprocal = (double*)malloc((initial_susceptibles + 1) * sizeof(double));
+    if (final_size == NULL || (mass == NULL && num_states != 0) || row == NULL || reciprocal == NULL)
+    {
+        printf("Failed to allocate the exact state lattice.\n");
+        exit(-1);
+    }
+    // Multiplied rather than divided by in the rows, which are most of the work
+    for (int k = 1; k <= initial_susceptibles; k++)
+    {
+        reciprocal[k] = 1.0 / k;
+    }
+
+    double initial = 1.0;
+    final_size[0] = initial_infectives == 0 ? 1.0 : 0.0;
+
+    for (int n = initial_susceptibles; n >= 0; n--)
+    {
+        // The initial level holds only the initial state, and n = 0 is only reached by ending
+        int z_first = n == initial_susceptibles ? initial_infectives : 1;
+        int z_last = n == initial_susceptibles ? initial_infectives : n > 0 ? initial_susceptibles - n : 0;
+        for (int z = z_first; z <= z_last; z++)
+        {
+            double state = n == initial_susceptibles ? initial : mass[_exact_index(n, z)];
+            if (z == 0 || state == 0.0)
+            {
+                continue;
+            }
+            double p = -expm1(z * log1p(-indiv_probability));
+            int first, last;
+            _exact_binomial_row_native(row, n, p, reciprocal, &first, &last);
+
+            // k = 0 and k = n end the epidemic, anything between moves to (n - k, k)
+            if (first == 0)
+            {
+                final_size[initial_susceptibles - n] += state * row[0];
+                first = 1;
+            }
+            if (last == n && n > 0)
+            {
+                final_size[initial_susceptibles - n] += state * row[n];
+                last = n - 1;
+            }
+            double* next = &mass[_exact_moves(n)];
+            for (int k = first; k <= last; k++)
+            {
+                next[k - 1] += state * row[k];
+            }
+        }
+    }
+
+    free(reciprocal);
+    free(row);
+    free(mass);
+    return final_size;
+}
+
+static void _exact_binomial_row_gmp(prob_t* row, int n, mpf_t p)
+{
+    if (mpf_sgn(p) <= 0 || mpf_cmp_ui(p, 1) >= 0)
+    {
+        for (int k = 0; k <= n; k++)
+        {
+            mpf_set_ui(row[k], 0);
+        }
+        mpf_set_ui(row[mpf_sgn(p) <= 0 ? 0 : n], 1);
+        return;
+    }
+
+    // f(0) = q^n, f(k) = f(k-1) · (n-k+1)/k · p/q
+    mpf_t q;
+    mpf_init(q);
+    mpf_ui_sub(q, 1, p);
+
+    mpf_t ratio;
+    mpf_init(ratio);
+    mpf_div(ratio, p, q);
+
+    mpf_pow_ui(row[0], q, n);
+    for (int k = 1; k <= n; k++)
+    {
+        mpf_mul(row[k], row[k-1], ratio);
+        mpf_mul_ui(row[k], row[k], n - k + 1);
+        mpf_div_ui(row[k], row[k], k);
+    }
+
+    mpf_clear(ratio);
+    mpf_clear(q);
+}
+
+double* exact_final_size_gmp(int initial_susceptibles, int initial_infectives, mpf_t indiv_probability)
+{
+    int num_bins = initial_susceptibles + initial_infectives + 1;
+    size_t num_states = _exact_num_states(initial_susceptibles);
+
+    prob_t* final_size = (prob_t*)malloc(num_bins * sizeof(prob_t));
+    prob_t* mass = (prob_t*)malloc(num_states * sizeof(prob_t));
+    prob_t* row = (prob_t*)malloc((initial_susceptibles + 1) * sizeof(prob_t));
+    for (int b = 0; b < num_bins; b++)
+    {
+        mpf_init(final_size[b]);
+    }
+    for (size_t s = 0; s < num_states; s++)
+    {
+        mpf_init(mass[s]);
+    }
+    for (int k = 0; k <= initial_susceptibles; k++)
+    {
+        mpf_init(row[k]);
+    }
+
+    mpf_t p;
+    mpf_init(p);
+    mpf_t contribution;
+    mpf_init(contribution);
+    mpf_t initial;
+    mpf_init_set_ui(initial, 1);
+
+    if (initial_infectives == 0)
+    {
+        mpf_set_ui(final_size[0], 1);
+    }
+
+    for (int n = initial_susceptibles; n >= 0; n--)
+    {
+        // The initial level holds only the initial state, and n = 0 is only reached by ending
+        int z_first = n == initial_susceptibles ? initial_infectives : 1;
+        int z_last = n == initial_susceptibles ? initial_infectives : n > 0 ? initial_susceptibles - n : 0;
+        for (int z = z_first; z <= z_last; z++)
+        {
+            prob_t* state = n == initial_susceptibles ? &initial : &mass[_exact_index(n, z)];
+            if (z == 0 || mpf_sgn(*state) == 0)
+            {
+                continue;
+            }
+            get_infection_probability(p, z, indiv_probability);
+            _exact_binomial_row_gmp(row, n, p);
+
+            mpf_mul(contribution, *state, row[0]);
+            mpf_add(final_size[initial_susceptibles - n], final_size[initial_susceptibles - n], contribution);
+            for (int k = 1; k < n; k++)
+            {
+                prob_t* next = &mass[_exact_moves(n) + k - 1];
+                mpf_mul(contribution, *state, row[k]);
+                mpf_add(*next, *next, contribution);
+            }
+            if (n > 0)
+            {
+                mpf_mul(contribution, *state, row[n]);
+                mpf_add(final_size[initial_susceptibles - n], final_size[initial_susceptibles - n], contribution);
+            }
+        }
+    }
+
+    double* final_size_d = (double*)malloc(num_bins * sizeof(double));
+    for (int b = 0; b < num_bins; b++)
+    {
+        final_size_d[b] = mpf_get_d(final_size[b]);
+        mpf_clear(final_size[b]);
+    }
+    for (size_t s = 0; s < num_states; s++)
+    {
+        mpf_clear(mass[s]);
+    }
+    for (int k = 0; k <= initial_susceptibles; k++)
+    {
+        mpf_clear(row[k]);
+    }
+    mpf_clear(initial);
+    mpf_clear(contribution);
+    mpf_clear(p);
+    free(row);
+    free(mass);
+    free(final_size);
+    return final_size_d;
+}
+
+typedef struct
+{
+    uint32_t    size;
+    bin_t       count;
+    double      remainder;
+} exact_share_t;
+
+static int _exact_compare_shares(const void* a, const void* b)
+{
+    // Largest remainder first, smaller sizes first among equals
+    const exact_share_t* x = (const exact_share_t*)a;
+    const exact_share_t* y = (const exact_share_t*)b;
+    if (x->remainder != y->remainder)
+    {
+        return x->remainder > y->remainder ? -1 : 1;
+    }
+    return x->size < y->size ? -1 : x->size > y->size;
+}
+
+static histogram_t* _exact_histogram(const double* final_size, int num_bins, int iterations)
+{
+    // The expected count of each size over the replicas. Every count is rounded down, then the
+    // replicas left over go one each to the largest remainders, so the counts add up to iterations
+    exact_share_t* shares = (exact_share_t*)malloc(num_bins * sizeof(exact_share_t));
+    if (shares == NULL)
+    {
+        printf("Failed to allocate the exact histogram.\n");
+        exit(-1);
+    }
+    uint64_t assigned = 0;
+    for (int b = 0; b < num_bins; b++)
+    {
+        double expected = final_size[b] * iterations;
+        shares[b].size = b;
+        shares[b].count = (bin_t)expected;
+        shares[b].remainder = expected - shares[b].count;
+        assigned += shares[b].count;
+    }
+    qsort(shares, num_bins, sizeof(exact_share_t), _exact_compare_shares);
+    for (int b = 0; assigned < (uint64_t)iterations && b < num_bins; b++, assigned++)
+    {
+        shares[b].count++;
+    }
+
+    histogram_t* bins = (histogram_t*)malloc(sizeof(histogram_t));
+    histogram_init(bins);
+    for (int b = 0; b < num_bins; b++)
+    {
+        if (shares[b].count > 0)
+        {
+            histogram_add(bins, shares[b].size, shares[b].count);
+        }
+    }
+    free(shares);
+    return bins;
+}
+
+histogram_t* exact_final_size(context_t* context)
+{
+    int initial_susceptibles = context->initial_susceptibles;
+    int initial_infectives = context->initial_infectives;
+    if (initial_susceptibles > EXACT_MAX_SUSCEPTIBLES)
+    {
+        // The state lattice is quadratic in the population, sample instead
+        printf("Exact solver limited to %d susceptibles.\n", EXACT_MAX_SUSCEPTIBLES);
+        exit(-1);
+    }
+
+    double* final_size;
+    if (context->sampler == SAMPLER_GMP)
+    {
+        final_size = exact_final_size_gmp(initial_susceptibles,
+                                          initial_infectives,
+                                          context->indiv_probability);
+    }
+    else
+    {
+        final_size = exact_final_size_native(initial_susceptibles,
+                                             initial_infectives,
+                                             mpf_get_d(context->indiv_probability));
+    }
+
+    int num_bins = initial_susceptibles + initial_infectives + 1;
+    double total = 0;
+    for (int b = 0; b < num_bins; b++)
+    {
+        total += final_size[b];
+    }
+    if (fabs(total - 1.0) > 1e-9)
+    {
+        printf("Final size distribution sums to %.12f, not 1.\n", total);
+        exit(-1);
+    }
+
+    histogram_t* bins = _exact_histogram(final_size, num_bins, context->iterations);
+    free(final_size);
+    return bins;
+}
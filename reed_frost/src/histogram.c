@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "histogram.h"
+
+
+/*
+ * Final sizes are bimodal, a minor outbreak near zero or a major one within a
+ * few standard deviations of the deterministic size, so a run only ever sees a
+ * small fraction of the initial_susceptibles + 1 possible values. Counts are
+ * kept in an open addressing table holding just the sizes that occurred,
+ * bounding memory by the number of replicas rather than the population.
+ */
+
+
+#define HISTOGRAM_INITIAL_CAPACITY  64
+#define HISTOGRAM_DENSE_PRINT_LIMIT 1000
+
+
+static size_t _histogram_slot(uint32_t key, size_t capacity)
+{
+    // Fibonacci hashing, capacity is always a power of two
+    return (size_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (capacity - 1);
+}
+
+static void _histogram_grow(histogram_t* histogram)
+{
+    size_t old_capacity = histogram->capacity;
+    uint32_t* old_keys = histogram->keys;
+    bin_t* old_counts = histogram->counts;
+
+    histogram->capacity = old_capacity ? 2 * old_capacity : HISTOGRAM_INITIAL_CAPACITY;
+    histogram->keys = (uint32_t*)calloc(histogram->capacity, sizeof(uint32_t));
+    histogram->counts = (bin_t*)calloc(histogram->capacity, sizeof(bin_t));
+    histogram->size = 0;
+
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (old_keys[i])
+        {
+            histogram_add(histogram, old_keys[i] - 1, old_counts[i]);
+        }
+    }
+    free(old_keys);
+    free(old_counts);
+}
+
+static int _histogram_compare_keys(const void* a, const void* b)
+{
+    uint32_t ka = *(const uint32_t*)a;
+    uint32_t kb = *(const uint32_t*)b;
+    return (ka > kb) - (ka < kb);
+}
+
+void histogram_init(histogram_t* histogram)
+{
+    histogram->keys = NULL;
+    histogram->counts = NULL;
+    histogram->capacity = 0;
+    histogram->size = 0;
+    _histogram_grow(histogram);
+}
+
+void histogram_free(histogram_t* histogram)
+{
+    free(histogram->keys);
+    free(histogram->counts);
+    histogram->keys = NULL;
+    histogram->counts = NULL;
+    histogram->capacity = 0;
+    histogram->size = 0;
+}
+
+void histogram_add(histogram_t* histogram, uint32_t key, bin_t count)
+{
+    // Keep the load factor at or below one half
+    if (2 * (histogram->size + 1) > histogram->capacity)
+    {
+        _histogram_grow(histogram);
+    }
+
+    size_t slot = _histogram_slot(key, histogram->capacity);
+    while (histogram->keys[slot] && histogram->keys[slot] != key + 1)
+    {
+        slot = (slot + 1) & (histogram->capacity - 1);
+    }
+    if (!histogram->keys[slot])
+    {
+        histogram->keys[slot] = key + 1;
+        histogram->size++;
+    }
+    histogram->counts[slot] += count;
+}
+
+bin_t histogram_get(histogram_t* histogram, uint32_t key)
+{
+    size_t slot = _histogram_slot(key, histogram->capacity);
+    while (histogram->keys[slot])
+    {
+        if (histogram->keys[slot] == key + 1)
+        {
+            return histogram->counts[slot];
+        }
+        slot = (slot + 1) & (histogram->capacity - 1);
+    }
+    return 0;
+}
+
+void histogram_merge(histogram_t* dst, histogram_t* src)
+{
+    for (size_t i = 0; i < src->capacity; i++)
+    {
+        if (src->keys[i])
+        {
+            histogram_add(dst, src->keys[i] - 1, src->counts[i]);
+        }
+    }
+}
+
+uint64_t histogram_total(histogram_t* histogram)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < histogram->capacity; i++)
+    {
+        total += histogram->counts[i];
+    }
+    return total;
+}
+
+size_t histogram_sorted_keys(histogram_t* histogram, uint32_t* keys)
+{
+    // keys must hold histogram->size entries
+    size_t n = 0;
+    for (size_t i = 0; i < histogram->capacity; i++)
+    {
+        if (histogram->keys[i])
+        {
+            keys[n++] = histogram->keys[i] - 1;
+        }
+    }
+    qsort(keys, n, sizeof(uint32_t), _histogram_compare_keys);
+    return n;
+}
+
+void histogram_print(histogram_t* histogram, uint32_t num_bins)
+{
+    // Small populations keep the full dense listing, large ones only the
+    // sizes that occurred
+    if (num_bins <= HISTOGRAM_DENSE_PRINT_LIMIT)
+    {
+        for (uint32_t b = 0; b < num_bins; b++)
+        {
+            printf("%02"PRIu32": %"PRIu32"\n", b, histogram_get(histogram, b));
+        }
+        return;
+    }
+
+    uint32_t* keys = (uint32_t*)malloc(histogram->size * sizeof(uint32_t));
+    size_t n = histogram_sorted_keys(histogram, keys);
+    for (size_t i = 0; i < n; i++)
+    {
+        printf("%02"PRIu32": %"PRIu32"\n", keys[i], histogram_get(histogram, keys[i]));
+    }
+    free(keys);
+}
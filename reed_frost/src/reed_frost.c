@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <gmp.h>
+
+#include "reed_frost.h"
+#include "binomial.h"
+#include "variates.h"
+#include "cdf_cache.h"
+#include "rng.h"
+#include "instrument.h"
+#include "histogram.h"
+#include "checkpoint.h"
+
+
+// Replicas between looks at the clock when a checkpoint deadline is set
+#define REED_FROST_DEADLINE_CHECK   256
+
+
+typedef struct
+{
+    context_t*      context;
+    int             num_replicas;
+    int             completed;
+    uint64_t        deadline;       // Monotonic ns to stop at, 0 to run the share out
+    rng_t           rng;
+    prob_t*         cum_bin_dist;
+    cdf_cache_t*    cache;
+    histogram_t     total_size_bins;
+} reed_frost_worker_t;
+
+
+static uint64_t _reed_frost_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+int check(histogram_t* histogram, int sum)
+{
+    return (histogram_total(histogram) == (uint64_t)sum);
+}
+
+void get_infection_probability(mpf_t infection_probability, int infectives, mpf_t indiv_probability)
+{
+    // p_i = 1 - ( 1 - p ) ^ I
+    mpf_ui_sub(infection_probability, 1, indiv_probability);
+    mpf_pow_ui(infection_probability, infection_probability, infectives);
+    mpf_ui_sub(infection_probability, 1, infection_probability);
+}
+
+int reed_frost_model_timestep(rng_t* rng, int susceptibles, int infectives, mpf_t indiv_probability, prob_t* cum_bin_dist, cdf_cache_t* cache)
+{
+    int n = susceptibles;
+    int new_infectives;
+    INSTRUMENT_COUNT(EVENTS, 1);
+
+    if (cache)
+    {
+        prob_t* cached_dist = cdf_cache_get(cache, n, infectives, indiv_probability);
+        new_infectives = cdf_cache_sample(rng, n, cached_dist);
+    }
+    else
+    {
+        mpf_t p;
+        mpf_init(p);
+        INSTRUMENT_COUNT(MPF_INITS, 1);
+        get_infection_probability(p, infectives, indiv_probability);
+
+        cumulative_binomial_distribution(cum_bin_dist, n, p);
+        new_infectives = random_binomial_integer(rng, n, cum_bin_dist);
+
+        mpf_clear(p);
+    }
+
+    if ((n - new_infectives) <= 0)
+    {
+        return 0;
+    }
+
+    return new_infectives;
+}
+
+int reed_frost_model(rng_t* rng, int initial_susceptibles, int initial_infectives, mpf_t indiv_probability, prob_t* cum_bin_dist, cdf_cache_t* cache)
+{
+    int n = initial_susceptibles;
+    int z = initial_infectives;
+    while (z != 0)
+    {
+        z = reed_frost_model_timestep(rng,
+                                      n,
+                                      z,
+                                      indiv_probability,
+                                      cum_bin_dist,
+                                      cache);
+        n -= z;
+    }
+    int total_size = initial_susceptibles - n;
+    return total_size;
+}
+
+int reed_frost_model_native_timestep(rng_t* rng, int susceptibles, int infectives, double indiv_probability)
+{
+    int n = susceptibles;
+    INSTRUMENT_COUNT(EVENTS, 1);
+
+    // p_i = 1 - ( 1 - p ) ^ I, without cancellation for small p
+    double p = -expm1(infectives * log1p(-indiv_probability));
+    int new_infectives = variates_binomial(rng, n, p);
+
+    if ((n - new_infectives) <= 0)
+    {
+        return 0;
+    }
+
+    return new_infectives;
+}
+
+int reed_frost_model_native(rng_t* rng, int initial_susceptibles, int initial_infectives, double indiv_probability)
+{
+    int n = initial_susceptibles;
+    int z = initial_infectives;
+    while (z != 0)
+    {
+        z = reed_frost_model_native_timestep(rng,
+                                             n,
+                                             z,
+                                             indiv_probability);
+        n -= z;
+    }
+    int total_size = initial_susceptibles - n;
+    return total_size;
+}
+
+static void* _reed_frost_worker(void* arg)
+{
+    reed_frost_worker_t* worker = (reed_frost_worker_t*)arg;
+    context_t* context = worker->context;
+    double indiv_probability_d = mpf_get_d(context->indiv_probability);
+
+    // Keep the stream state and the count off the shared worker array while running
+    rng_t rng = worker->rng;
+    int completed = worker->completed;
+    int total_size;
+
+    // Each round makes some progress, however short the deadline
+    for (int i = 0; completed < worker->num_replicas; i++, completed++)
+    {
+        if (worker->deadline
+            && i > 0 && i % REED_FROST_DEADLINE_CHECK == 0
+            && _reed_frost_now() >= worker->deadline)
+        {
+            break;
+        }
+        if (context->sampler == SAMPLER_GMP)
+        {
+            total_size = reed_frost_model(&rng,
+                                          context->initial_susceptibles,
+                                          context->initial_infectives,
+                                          context->indiv_probability,
+                                          worker->cum_bin_dist,
+                                          worker->cache);
+        }
+        else
+        {
+            total_size = reed_frost_model_native(&rng,
+                                                 context->initial_susceptibles,
+                                                 context->initial_infectives,
+                                                 indiv_probability_d);
+        }
+        histogram_add(&worker->total_size_bins, total_size, 1);
+    }
+
+    worker->rng = rng;
+    worker->completed = completed;
+    return NULL;
+}
+
+static void _reed_frost_worker_init(reed_frost_worker_t* worker, context_t* context, int index, int num_bins)
+{
+    int num_threads = context->num_threads;
+
+    // Replicas split as evenly as possible, stream t is the seed jumped t times
+    worker->context = context;
+    worker->num_replicas = context->iterations / num_threads
+                           + (index < context->iterations % num_threads);
+    worker->completed = 0;
+    worker->deadline = 0;
+    rng_stream(&worker->rng, context->seed, index);
+    histogram_init(&worker->total_size_bins);
+    worker->cum_bin_dist = NULL;
+    worker->cache = NULL;
+
+    if (context->sampler != SAMPLER_GMP)
+    {
+        return;
+    }
+    if (context->cache_bytes > 0)
+    {
+        worker->cache = cdf_cache_new(context->cache_bytes / num_threads);
+    }
+    else
+    {
+        worker->cum_bin_dist = (prob_t*)malloc((num_bins + 1) * sizeof(prob_t));
+        for (int b = 0; b <= num_bins; b++)
+        {
+            mpf_init(worker->cum_bin_dist[b]);
+        }
+    }
+}
+
+static void _reed_frost_worker_free(reed_frost_worker_t* worker, int num_bins)
+{
+    if (worker->cum_bin_dist)
+    {
+        for (int b = 0; b <= num_bins; b++)
+        {
+            mpf_clear(worker->cum_bin_dist[b]);
+        }
+        free(worker->cum_bin_dist);
+    }
+    cdf_cache_free(worker->cache);
+    histogram_free(&worker->total_size_bins);
+}
+
+static int _reed_frost_done(reed_frost_worker_t* workers, int num_threads)
+{
+    for (int t = 0; t < num_threads; t++)
+    {
+        if (workers[t].completed < workers[t].num_replicas)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void _reed_frost_run(reed_frost_worker_t* workers, int num_threads)
+{
+    if (num_threads == 1)
+    {
+        _reed_frost_worker(&workers[0]);
+        return;
+    }
+
+    pthread_t* threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+    for (int t = 0; t < num_threads; t++)
+    {
+        if (pthread_create(&threads[t], NULL, _reed_frost_worker, &workers[t]) != 0)
+        {
+            printf("Failed to start worker thread %d.\n", t);
+            exit(-1);
+        }
+    }
+    for (int t = 0; t < num_threads; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+}
+
+static void _reed_frost_checkpoint(context_t* context, reed_frost_worker_t* workers)
+{
+    checkpoint_stream_t* streams = (checkpoint_stream_t*)malloc(context->num_threads * sizeof(checkpoint_stream_t));
+    for (int t = 0; t < context->num_threads; t++)
+    {
+        streams[t].completed = workers[t].completed;
+        streams[t].rng = workers[t].rng;
+        streams[t].total_size_bins = &workers[t].total_size_bins;
+    }
+    checkpoint_save(context->checkpoint_path, context, streams);
+    free(streams);
+}
+
+static void _reed_frost_resume(context_t* context, reed_frost_worker_t* workers)
+{
+    // Loaded aside, so a checkpoint that turns out bad part way leaves the workers fresh
+    checkpoint_stream_t* streams = (checkpoint_stream_t*)malloc(context->num_threads * sizeof(checkpoint_stream_t));
+    histogram_t* bins = (histogram_t*)malloc(context->num_threads * sizeof(histogram_t));
+    for (int t = 0; t < context->num_threads; t++)
+    {
+        histogram_init(&bins[t]);
+        streams[t].total_size_bins = &bins[t];
+    }
+    int resumed = checkpoint_load(context->checkpoint_path, context, streams) == 0;
+    for (int t = 0; t < context->num_threads; t++)
+    {
+        if (resumed)
+        {
+            workers[t].completed = streams[t].completed;
+            workers[t].rng = streams[t].rng;
+            histogram_merge(&workers[t].total_size_bins, &bins[t]);
+        }
+        histogram_free(&bins[t]);
+    }
+    free(bins);
+    free(streams);
+}
+
+histogram_t* reed_frost_model_simulate(context_t* context)
+{
+    INSTRUMENT_PHASE_BEGIN(SIMULATE);
+    int num_bins = context->initial_susceptibles + context->initial_infectives + 1;
+    int num_threads = context->num_threads > 0 ? context->num_threads : 1;
+    context->num_threads = num_threads;
+
+    reed_frost_worker_t* workers = (reed_frost_worker_t*)calloc(num_threads, sizeof(reed_frost_worker_t));
+    for (int t = 0; t < num_threads; t++)
+    {
+        _reed_frost_worker_init(&workers[t], context, t, num_bins);
+    }
+
+    if (context->checkpoint_path != NULL)
+    {
+        _reed_frost_resume(context, workers);
+    }
+
+    // Without a checkpoint path this is one round to the end. With one, each
+    // round stops after checkpoint_interval seconds and is saved before the
+    // next starts. Threads run their own streams, so rounds change nothing.
+    uint64_t interval = 0;
+    if (context->checkpoint_path != NULL)
+    {
+        double seconds = context->checkpoint_interval > 0.0 ? context->checkpoint_interval : CHECKPOINT_DEFAULT_INTERVAL;
+        interval = (uint64_t)(seconds * 1e9);
+    }
+    while (!_reed_frost_done(workers, num_threads))
+    {
+        uint64_t deadline = interval ? _reed_frost_now() + interval : 0;
+        for (int t = 0; t < num_threads; t++)
+        {
+            workers[t].deadline = deadline;
+        }
+        _reed_frost_run(workers, num_threads);
+        if (context->checkpoint_path != NULL)
+        {
+            _reed_frost_checkpoint(context, workers);
+        }
+    }
+
+    // Merge the private histograms and cache counters
+    histogram_t* total_size_bins = (histogram_t*)malloc(sizeof(histogram_t));
+    histogram_init(total_size_bins);
+    cdf_cache_t cache_totals = {0};
+    cache_totals.max_bytes = context->cache_bytes;
+    for (int t = 0; t < num_threads; t++)
+    {
+        histogram_merge(total_size_bins, &workers[t].total_size_bins);
+        if (workers[t].cache)
+        {
+            cache_totals.hits += workers[t].cache->hits;
+            cache_totals.misses += workers[t].cache->misses;
+            cache_totals.evictions += workers[t].cache->evictions;
+            cache_totals.num_entries += workers[t].cache->num_entries;
+            cache_totals.bytes += workers[t].cache->bytes;
+        }
+        _reed_frost_worker_free(&workers[t], num_bins);
+    }
+    free(workers);
+    if (context->sampler == SAMPLER_GMP && context->cache_bytes > 0)
+    {
+        cdf_cache_print_stats(&cache_totals);
+    }
+
+    INSTRUMENT_PHASE_END(SIMULATE);
+    return total_size_bins;
+}
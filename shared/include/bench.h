@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+
+#define BENCH_MAX_RESULTS       64
+#define BENCH_NAME_LEN          48
+#define BENCH_UNIT_LEN          16
+#define BENCH_REPEATS           5           // Timed runs per microbenchmark, the best is kept
+#define BENCH_MIN_SECONDS       0.05        // Length of each timed run
+#define BENCH_TOLERANCE         0.15        // Change from the baseline that counts as a regression
+
+
+// Runs the measured operation ops times
+typedef void (*bench_fn_t)(void* arg, uint64_t ops);
+
+
+typedef struct
+{
+    char        name[BENCH_NAME_LEN];
+    char        unit[BENCH_UNIT_LEN];
+    double      value;
+    int         higher_is_better;
+} bench_result_t;
+
+
+typedef struct
+{
+    const char*     suite;
+    bench_result_t  results[BENCH_MAX_RESULTS];
+    uint32_t        num_results;
+} bench_t;
+
+
+// Results measured operations feed, so the compiler cannot drop them
+extern volatile uint64_t bench_sink;
+
+
+void bench_init(bench_t* bench, const char* suite);
+double bench_now(void);
+void bench_record(bench_t* bench, const char* name, double value, const char* unit, int higher_is_better);
+double bench_time(bench_t* bench, const char* name, bench_fn_t fn, void* arg);
+void bench_rng(bench_t* bench);
+void bench_print(const bench_t* bench);
+int bench_write(const bench_t* bench, const char* path);
+int bench_compare(const bench_t* bench, const char* baseline_path, double tolerance);
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+
+
+// Counters kept per thread, X(id, name) in report order
+#define INSTRUMENT_COUNTERS(X)          \
+    X(EVENTS,           events)         \
+    X(RNG_DRAWS,        rng_draws)      \
+    X(MPF_INITS,        mpf_inits)      \
+    X(CDF_BUILDS,       cdf_builds)     \
+    X(BYTES_WRITTEN,    bytes_written)
+
+// Phases timed on the monotonic clock, X(id, name)
+#define INSTRUMENT_PHASES(X)            \
+    X(SIMULATE,         simulate)       \
+    X(SAVE,             save)           \
+    X(PLOT,             plot)
+
+
+#define INSTRUMENT_COUNTER_ENUM(id, name)   INSTRUMENT_##id,
+typedef enum
+{
+    INSTRUMENT_COUNTERS(INSTRUMENT_COUNTER_ENUM)
+    INSTRUMENT_NUM_COUNTERS
+} instrument_counter_enum_t;
+
+#define INSTRUMENT_PHASE_ENUM(id, name)     INSTRUMENT_PHASE_##id,
+typedef enum
+{
+    INSTRUMENT_PHASES(INSTRUMENT_PHASE_ENUM)
+    INSTRUMENT_NUM_PHASES
+} instrument_phase_enum_t;
+
+
+/*
+ * Builds without INSTRUMENT defined compile every macro below to nothing:
+ * counts are only looked at by sizeof, so they must not have side effects.
+ * With it, INSTRUMENT_START() writes a JSON report at exit and on SIGUSR1,
+ * to $INSTRUMENT_JSON if set.
+ */
+#ifdef INSTRUMENT
+
+typedef struct instrument_thread_t
+{
+    uint64_t                        counters[INSTRUMENT_NUM_COUNTERS];
+    uint32_t                        index;
+    int                             exited;
+    struct instrument_thread_t*     next;
+} instrument_thread_t;
+
+
+extern _Thread_local instrument_thread_t* instrument_self;
+
+
+instrument_thread_t* instrument_register(void);
+uint64_t instrument_now(void);
+void instrument_phase(instrument_phase_enum_t phase, uint64_t begin);
+void instrument_start(const char* path);
+int instrument_write_json(const char* path);
+
+
+static inline void instrument_count(instrument_counter_enum_t counter, uint64_t n)
+{
+    instrument_thread_t* self = instrument_self;
+    if (self == NULL)
+        self = instrument_register();
+    // Only the owner writes, relaxed accesses let a report read it meanwhile without a locked add
+    uint64_t value = __atomic_load_n(&self->counters[counter], __ATOMIC_RELAXED);
+    __atomic_store_n(&self->counters[counter], value + n, __ATOMIC_RELAXED);
+}
+
+
+#define INSTRUMENT_COUNT(id, n)         instrument_count(INSTRUMENT_##id, (n))
+#define INSTRUMENT_PHASE_BEGIN(id)      uint64_t _instrument_phase_##id = instrument_now()
+#define INSTRUMENT_PHASE_END(id)        instrument_phase(INSTRUMENT_PHASE_##id, _instrument_phase_##id)
+#define INSTRUMENT_START(path)          instrument_start(path)
+
+#else
+
+#define INSTRUMENT_COUNT(id, n)         ((void)sizeof(n))
+#define INSTRUMENT_PHASE_BEGIN(id)      ((void)0)
+#define INSTRUMENT_PHASE_END(id)        ((void)0)
+#define INSTRUMENT_START(path)          ((void)0)
+
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+typedef struct
+{
+    uint32_t key[2];
+    uint32_t counter[4];
+    uint32_t output[4];
+    uint32_t index;         // Next unused word of output
+} philox_t;
+
+
+void philox4x32_10(const uint32_t counter[4], const uint32_t key[2], uint32_t output[4]);
+void philox_init(philox_t* philox, uint64_t seed, uint64_t stream);
+uint32_t philox_next32(philox_t* philox);
+uint64_t philox_next64(philox_t* philox);
+double philox_uniform(philox_t* philox);
+uint32_t philox_bounded(philox_t* philox, uint32_t n);
+void philox_fill_uniform(philox_t* philox, double* out, size_t count);
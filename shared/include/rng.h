@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define RNG_STATE_BYTES     32
+
+
+typedef struct
+{
+    uint64_t s[4];
+} rng_t;
+
+
+void rng_seed(rng_t* rng, uint64_t seed);
+uint64_t rng_next(rng_t* rng);
+double rng_uniform(rng_t* rng);
+uint64_t rng_bounded(rng_t* rng, uint64_t n);
+void rng_fill_uniform(rng_t* rng, double* out, size_t count);
+void rng_jump(rng_t* rng);
+void rng_stream(rng_t* rng, uint64_t seed, uint64_t stream);
+void rng_save(const rng_t* rng, uint8_t state[RNG_STATE_BYTES]);
+int rng_restore(rng_t* rng, const uint8_t state[RNG_STATE_BYTES]);
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "rng.h"
+
+
+uint32_t variates_binomial(rng_t* rng, uint32_t n, double p);
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "bench.h"
+#include "rng.h"
+#include "philox.h"
+#include "variates.h"
+
+
+/*
+ * Benchmark harness shared by both programs. Microbenchmarks are calibrated
+ * to run for BENCH_MIN_SECONDS, timed BENCH_REPEATS times, and the fastest run
+ * is kept as ns/op, which is the least disturbed by the rest of the machine.
+ * End-to-end figures are recorded as measured. Results are written as tab
+ * separated "suite name value unit better" lines, and compared line by line
+ * against a stored baseline in the same format.
+ */
+
+
+#define BENCH_BLOCK     256
+
+
+volatile uint64_t bench_sink;
+
+
+void bench_init(bench_t* bench, const char* suite)
+{
+    memset(bench, 0, sizeof(bench_t));
+    bench->suite = suite;
+}
+
+
+double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void bench_record(bench_t* bench, const char* name, double value, const char* unit, int higher_is_better)
+{
+    if (bench->num_results == BENCH_MAX_RESULTS)
+    {
+        printf("Too many benchmark results, %s is dropped.\n", name);
+        return;
+    }
+    bench_result_t* result = &bench->results[bench->num_results++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    snprintf(result->unit, sizeof(result->unit), "%s", unit);
+    result->value = value;
+    result->higher_is_better = higher_is_better;
+}
+
+
+double bench_time(bench_t* bench, const char* name, bench_fn_t fn, void* arg)
+{
+    // Double the count until one run is long enough to time, then scale it up
+    uint64_t ops = 1;
+    double seconds;
+    for (;;)
+    {
+        double begin = bench_now();
+        fn(arg, ops);
+        seconds = bench_now() - begin;
+        if (seconds >= BENCH_MIN_SECONDS / 10 || ops >= (UINT64_C(1) << 40))
+            break;
+        ops *= 2;
+    }
+    if (seconds < BENCH_MIN_SECONDS)
+        ops = (uint64_t)ceil(ops * BENCH_MIN_SECONDS / fmax(seconds, 1e-9));
+
+    double best = INFINITY;
+    for (int r = 0; r < BENCH_REPEATS; r++)
+    {
+        double begin = bench_now();
+        fn(arg, ops);
+        best = fmin(best, bench_now() - begin);
+    }
+    double ns = best * 1e9 / ops;
+    bench_record(bench, name, ns, "ns/op", 0);
+    return ns;
+}
+
+
+static void _bench_rng_next(void* arg, uint64_t ops)
+{
+    rng_t* rng = (rng_t*)arg;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        sum += rng_next(rng);
+    }
+    bench_sink = sum;
+}
+
+
+static void _bench_rng_uniform(void* arg, uint64_t ops)
+{
+    rng_t* rng = (rng_t*)arg;
+    double sum = 0.0;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        sum += rng_uniform(rng);
+    }
+    bench_sink = (uint64_t)sum;
+}
+
+
+static void _bench_rng_fill_uniform(void* arg, uint64_t ops)
+{
+    // ops uniforms, a block at a time
+    rng_t* rng = (rng_t*)arg;
+    double block[BENCH_BLOCK];
+    double sum = 0.0;
+    for (uint64_t i = 0; i < ops; i += BENCH_BLOCK)
+    {
+        rng_fill_uniform(rng, block, BENCH_BLOCK);
+        sum += block[0];
+    }
+    bench_sink = (uint64_t)sum;
+}
+
+
+static void _bench_philox_uniform(void* arg, uint64_t ops)
+{
+    philox_t* philox = (philox_t*)arg;
+    double sum = 0.0;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        sum += philox_uniform(philox);
+    }
+    bench_sink = (uint64_t)sum;
+}
+
+
+static void _bench_philox_fill_uniform(void* arg, uint64_t ops)
+{
+    philox_t* philox = (philox_t*)arg;
+    double block[BENCH_BLOCK];
+    double sum = 0.0;
+    for (uint64_t i = 0; i < ops; i += BENCH_BLOCK)
+    {
+        philox_fill_uniform(philox, block, BENCH_BLOCK);
+        sum += block[0];
+    }
+    bench_sink = (uint64_t)sum;
+}
+
+
+typedef struct
+{
+    rng_t       rng;
+    uint32_t    n;
+    double      p;
+} bench_binomial_t;
+
+
+static void _bench_variates_binomial(void* arg, uint64_t ops)
+{
+    bench_binomial_t* binomial = (bench_binomial_t*)arg;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        sum += variates_binomial(&binomial->rng, binomial->n, binomial->p);
+    }
+    bench_sink = sum;
+}
+
+
+void bench_rng(bench_t* bench)
+{
+    // Draws every engine makes, per draw
+    rng_t rng;
+    rng_seed(&rng, 1);
+    bench_time(bench, "rng_next", _bench_rng_next, &rng);
+    bench_time(bench, "rng_uniform", _bench_rng_uniform, &rng);
+    bench_time(bench, "rng_fill_uniform", _bench_rng_fill_uniform, &rng);
+
+    philox_t philox;
+    philox_init(&philox, 1, 0);
+    bench_time(bench, "philox_uniform", _bench_philox_uniform, &philox);
+    bench_time(bench, "philox_fill_uniform", _bench_philox_fill_uniform, &philox);
+
+    // Inversion below n·p of 30, BTPE above
+    bench_binomial_t binomial = {.n=50, .p=0.1};
+    rng_seed(&binomial.rng, 1);
+    bench_time(bench, "variates_binomial_inversion", _bench_variates_binomial, &binomial);
+    binomial.n = 10000;
+    binomial.p = 0.3;
+    bench_time(bench, "variates_binomial_btpe", _bench_variates_binomial, &binomial);
+}
+
+
+void bench_print(const bench_t* bench)
+{
+    printf("%-40s %16s %s\n", "benchmark", "value", "unit");
+    for (uint32_t i = 0; i < bench->num_results; i++)
+    {
+        const bench_result_t* result = &bench->results[i];
+        printf("%-40s %16.4g %s\n", result->name, result->value, result->unit);
+    }
+}
+
+
+int bench_write(const bench_t* bench, const char* path)
+{
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        printf("Cannot open %s.\n", path);
+        return -1;
+    }
+    fprintf(fp, "# suite\tname\tvalue\tunit\tbetter\n");
+    for (uint32_t i = 0; i < bench->num_results; i++)
+    {
+        const bench_result_t* result = &bench->results[i];
+        fprintf(fp, "%s\t%s\t%.17g\t%s\t%s\n", bench->suite, result->name, result->value,
+                result->unit, result->higher_is_better ? "higher" : "lower");
+    }
+    fclose(fp);
+    return 0;
+}
+
+
+static const bench_result_t* _bench_find(const bench_t* bench, const char* name)
+{
+    for (uint32_t i = 0; i < bench->num_results; i++)
+    {
+        if (strcmp(bench->results[i].name, name) == 0)
+            return &bench->results[i];
+    }
+    return NULL;
+}
+
+
+int bench_compare(const bench_t* bench, const char* baseline_path, double tolerance)
+{
+    // Returns the number of results worse than the baseline by more than tolerance
+    FILE* fp = fopen(baseline_path, "r");
+    if (fp == NULL)
+    {
+        printf("No baseline at %s, nothing to compare against.\n", baseline_path);
+        return 0;
+    }
+
+    printf("%-40s %12s %12s %8s\n", "against baseline", "baseline", "now", "change");
+    int regressions = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        char suite[BENCH_NAME_LEN];
+        char name[BENCH_NAME_LEN];
+        double value;
+        if (line[0] == '#' || sscanf(line, "%47s %47s %lf", suite, name, &value) != 3)
+            continue;
+        if (strcmp(suite, bench->suite) != 0)
+            continue;
+        const bench_result_t* result = _bench_find(bench, name);
+        if (result == NULL || !(value > 0.0))
+            continue;
+
+        // Change in the direction that is worse, as a fraction of the baseline
+        double change = (result->value - value) / value;
+        double worse = result->higher_is_better ? -change : change;
+        int regressed = worse > tolerance;
+        regressions += regressed;
+        printf("%-40s %12.4g %12.4g %+7.1f%%%s\n", name, value, result->value, 100.0 * change,
+               regressed ? "  REGRESSION" : "");
+    }
+    fclose(fp);
+    if (regressions)
+        printf("%d results regressed by more than %.0f%%.\n", regressions, 100.0 * tolerance);
+    return regressions;
+}
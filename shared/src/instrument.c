@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "instrument.h"
+
+
+/*
+ * Each thread counts into its own block, found through a thread local pointer
+ * and linked into a list the report walks. Blocks outlive their threads, so
+ * the report still breaks down runs whose workers have exited; a block is a
+ * few dozen bytes per thread ever started. Phases are rare and add straight
+ * into shared totals.
+ *
+ * SIGUSR1 is blocked in the thread that calls instrument_start() and so in
+ * every thread it creates afterwards; a dedicated thread takes it with
+ * sigwait() and writes the report outside signal context.
+ */
+
+
+#define INSTRUMENT_DEFAULT_PATH     "instrument.json"
+
+
+_Thread_local instrument_thread_t* instrument_self;
+
+
+static pthread_mutex_t _instrument_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t _instrument_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _instrument_key;
+static instrument_thread_t* _instrument_threads;
+static instrument_thread_t* _instrument_last;
+static uint32_t _instrument_num_threads;
+static uint64_t _instrument_phase_ns[INSTRUMENT_NUM_PHASES];
+static uint64_t _instrument_phase_count[INSTRUMENT_NUM_PHASES];
+static uint64_t _instrument_begin;
+static const char* _instrument_path = INSTRUMENT_DEFAULT_PATH;
+
+
+#define INSTRUMENT_COUNTER_NAME(id, name)   #name,
+static const char* _instrument_counter_names[] = { INSTRUMENT_COUNTERS(INSTRUMENT_COUNTER_NAME) };
+
+#define INSTRUMENT_PHASE_NAME(id, name)     #name,
+static const char* _instrument_phase_names[] = { INSTRUMENT_PHASES(INSTRUMENT_PHASE_NAME) };
+
+
+uint64_t instrument_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void _instrument_retire(void* arg)
+{
+    instrument_thread_t* self = (instrument_thread_t*)arg;
+    __atomic_store_n(&self->exited, 1, __ATOMIC_RELAXED);
+}
+
+
+static void _instrument_create_key(void)
+{
+    pthread_key_create(&_instrument_key, _instrument_retire);
+}
+
+
+instrument_thread_t* instrument_register(void)
+{
+    pthread_once(&_instrument_once, _instrument_create_key);
+    instrument_thread_t* self = (instrument_thread_t*)calloc(1, sizeof(instrument_thread_t));
+    if (self == NULL)
+    {
+        printf("Failed to allocate instrumentation counters.\n");
+        exit(-1);
+    }
+    // Appended, so the report lists threads in the order they first counted
+    pthread_mutex_lock(&_instrument_lock);
+    self->index = _instrument_num_threads++;
+    if (_instrument_last != NULL)
+        _instrument_last->next = self;
+    else
+        _instrument_threads = self;
+    _instrument_last = self;
+    pthread_mutex_unlock(&_instrument_lock);
+    pthread_setspecific(_instrument_key, self);
+    instrument_self = self;
+    return self;
+}
+
+
+void instrument_phase(instrument_phase_enum_t phase, uint64_t begin)
+{
+    __atomic_fetch_add(&_instrument_phase_ns[phase], instrument_now() - begin, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&_instrument_phase_count[phase], 1, __ATOMIC_RELAXED);
+}
+
+
+int instrument_write_json(const char* path)
+{
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        printf("Cannot open %s.\n", path);
+        return -1;
+    }
+
+    pthread_mutex_lock(&_instrument_lock);
+    uint64_t totals[INSTRUMENT_NUM_COUNTERS] = {0};
+    for (instrument_thread_t* t = _instrument_threads; t != NULL; t = t->next)
+    {
+        for (int c = 0; c < INSTRUMENT_NUM_COUNTERS; c++)
+        {
+            totals[c] += __atomic_load_n(&t->counters[c], __ATOMIC_RELAXED);
+        }
+    }
+
+    fprintf(fp, "{\n  \"elapsed_ns\": %" PRIu64 ",\n", instrument_now() - _instrument_begin);
+    fprintf(fp, "  \"counters\": {");
+    for (int c = 0; c < INSTRUMENT_NUM_COUNTERS; c++)
+    {
+        fprintf(fp, "%s\"%s\": %" PRIu64, c ? ", " : "", _instrument_counter_names[c], totals[c]);
+    }
+    fprintf(fp, "},\n  \"phases\": {");
+    for (int p = 0; p < INSTRUMENT_NUM_PHASES; p++)
+    {
+        fprintf(fp, "%s\"%s\": {\"count\": %" PRIu64 ", \"ns\": %" PRIu64 "}", p ? ", " : "",
+                _instrument_phase_names[p],
+                __atomic_load_n(&_instrument_phase_count[p], __ATOMIC_RELAXED),
+                __atomic_load_n(&_instrument_phase_ns[p], __ATOMIC_RELAXED));
+    }
+    fprintf(fp, "},\n  \"threads\": [");
+    for (instrument_thread_t* t = _instrument_threads; t != NULL; t = t->next)
+    {
+        fprintf(fp, "%s\n    {\"thread\": %u, \"exited\": %s", t == _instrument_threads ? "" : ",", t->index,
+                __atomic_load_n(&t->exited, __ATOMIC_RELAXED) ? "true" : "false");
+        for (int c = 0; c < INSTRUMENT_NUM_COUNTERS; c++)
+        {
+            fprintf(fp, ", \"%s\": %" PRIu64, _instrument_counter_names[c],
+                    __atomic_load_n(&t->counters[c], __ATOMIC_RELAXED));
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    pthread_mutex_unlock(&_instrument_lock);
+
+    fclose(fp);
+    return 0;
+}
+
+
+static void* _instrument_signal_thread(void* arg)
+{
+    sigset_t* signals = (sigset_t*)arg;
+    int signal;
+    while (sigwait(signals, &signal) == 0)
+    {
+        if (instrument_write_json(_instrument_path) == 0)
+            printf("Instrumentation report written to %s.\n", _instrument_path);
+    }
+    return NULL;
+}
+
+
+static void _instrument_exit(void)
+{
+    instrument_write_json(_instrument_path);
+}
+
+
+void instrument_start(const char* path)
+{
+    // Called once, from main, before any other thread is started
+    const char* env = getenv("INSTRUMENT_JSON");
+    _instrument_path = env != NULL ? env : path != NULL ? path : INSTRUMENT_DEFAULT_PATH;
+    _instrument_begin = instrument_now();
+
+    static sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, _instrument_signal_thread, &signals) != 0)
+    {
+        printf("Failed to start the instrumentation signal thread.\n");
+        exit(-1);
+    }
+    pthread_detach(thread);
+    atexit(_instrument_exit);
+}
@@ -0,0 +1,130 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "philox.h"
+#include "instrument.h"
+
+
+/*
+ * Philox4x32-10 counter based generator (Salmon et al., 2011). Output block
+ * n of stream s under seed k is philox4x32_10({n, s}, k), so any replica can
+ * regenerate its numbers from (seed, replica id) alone, independently of
+ * which thread runs it or in what order.
+ *
+ * Counter words 0-1 count blocks within a stream, words 2-3 hold the stream.
+ */
+
+
+#define PHILOX_M0   0xD2511F53U
+#define PHILOX_M1   0xCD9E8D57U
+#define PHILOX_W0   0x9E3779B9U
+#define PHILOX_W1   0xBB67AE85U
+#define PHILOX_ROUNDS   10
+
+
+void philox4x32_10(const uint32_t counter[4], const uint32_t key[2], uint32_t output[4])
+{
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+
+    for (int r = 0; r < PHILOX_ROUNDS; r++)
+    {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+        c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        c1 = (uint32_t)p1;
+        c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c3 = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    output[0] = c0;
+    output[1] = c1;
+    output[2] = c2;
+    output[3] = c3;
+}
+
+void philox_init(philox_t* philox, uint64_t seed, uint64_t stream)
+{
+    philox->key[0] = (uint32_t)seed;
+    philox->key[1] = (uint32_t)(seed >> 32);
+    philox->counter[0] = 0;
+    philox->counter[1] = 0;
+    philox->counter[2] = (uint32_t)stream;
+    philox->counter[3] = (uint32_t)(stream >> 32);
+    philox->index = 4;
+}
+
+static inline void _philox_refill(philox_t* philox)
+{
+    // Draws are counted in 64 bit words, two per block
+    INSTRUMENT_COUNT(RNG_DRAWS, 2);
+    philox4x32_10(philox->counter, philox->key, philox->output);
+    if (++philox->counter[0] == 0)
+        ++philox->counter[1];
+    philox->index = 0;
+}
+
+uint32_t philox_next32(philox_t* philox)
+{
+    if (philox->index == 4)
+        _philox_refill(philox);
+    return philox->output[philox->index++];
+}
+
+uint64_t philox_next64(philox_t* philox)
+{
+    uint64_t hi = philox_next32(philox);
+    return (hi << 32) | philox_next32(philox);
+}
+
+double philox_uniform(philox_t* philox)
+{
+    // 53 random bits centred in their interval, so never 0 or 1
+    return ((philox_next64(philox) >> 11) + 0.5) * 0x1.0p-53;
+}
+
+uint32_t philox_bounded(philox_t* philox, uint32_t n)
+{
+    // Lemire's multiply and reject: unbiased in [0, n), rarely divides
+    uint64_t m = (uint64_t)philox_next32(philox) * n;
+    uint32_t low = (uint32_t)m;
+    if (low < n)
+    {
+        uint32_t threshold = -n % n;
+        while (low < threshold)
+        {
+            m = (uint64_t)philox_next32(philox) * n;
+            low = (uint32_t)m;
+        }
+    }
+    return (uint32_t)(m >> 32);
+}
+
+void philox_fill_uniform(philox_t* philox, double* out, size_t count)
+{
+    // Same values, in the same order, as count calls to philox_uniform()
+    size_t i = 0;
+    while (i < count && philox->index != 4)
+    {
+        out[i++] = philox_uniform(philox);
+    }
+    // Whole blocks give two uniforms each without going through the buffer
+    INSTRUMENT_COUNT(RNG_DRAWS, (count - i) & ~(size_t)1);
+    for (; i + 2 <= count; i += 2)
+    {
+        uint32_t block[4];
+        philox4x32_10(philox->counter, philox->key, block);
+        if (++philox->counter[0] == 0)
+            ++philox->counter[1];
+        uint64_t a = ((uint64_t)block[0] << 32) | block[1];
+        uint64_t b = ((uint64_t)block[2] << 32) | block[3];
+        out[i] = ((a >> 11) + 0.5) * 0x1.0p-53;
+        out[i + 1] = ((b >> 11) + 0.5) * 0x1.0p-53;
+    }
+    if (i < count)
+    {
+        out[i] = philox_uniform(philox);
+    }
+}
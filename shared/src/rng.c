@@ -0,0 +1,163 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rng.h"
+#include "instrument.h"
+
+
+/*
+ * xoshiro256++ (Blackman & Vigna). Each call to rng_jump() advances the state
+ * by 2^128 draws, so stream t of a seed is the seeded state jumped t times and
+ * streams never overlap in practice.
+ */
+
+
+__extension__ typedef unsigned __int128 rng_u128_t;
+
+
+static inline uint64_t _rng_rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t _rng_splitmix64(uint64_t* x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void rng_seed(rng_t* rng, uint64_t seed)
+{
+    // Expand the seed with splitmix64 so no seed gives the all zero state
+    for (int i = 0; i < 4; i++)
+    {
+        rng->s[i] = _rng_splitmix64(&seed);
+    }
+}
+
+static inline uint64_t _rng_step(uint64_t s[4])
+{
+    uint64_t result = _rng_rotl(s[0] + s[3], 23) + s[0];
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+
+    s[2] ^= t;
+    s[3] = _rng_rotl(s[3], 45);
+
+    return result;
+}
+
+uint64_t rng_next(rng_t* rng)
+{
+    INSTRUMENT_COUNT(RNG_DRAWS, 1);
+    return _rng_step(rng->s);
+}
+
+double rng_uniform(rng_t* rng)
+{
+    // 53 random bits centred in their interval, so never 0 or 1
+    return ((rng_next(rng) >> 11) + 0.5) * 0x1.0p-53;
+}
+
+uint64_t rng_bounded(rng_t* rng, uint64_t n)
+{
+    // Lemire's multiply and reject: unbiased in [0, n), rarely divides
+    rng_u128_t m = (rng_u128_t)rng_next(rng) * n;
+    uint64_t low = (uint64_t)m;
+    if (low < n)
+    {
+        uint64_t threshold = -n % n;
+        while (low < threshold)
+        {
+            m = (rng_u128_t)rng_next(rng) * n;
+            low = (uint64_t)m;
+        }
+    }
+    return (uint64_t)(m >> 64);
+}
+
+void rng_fill_uniform(rng_t* rng, double* out, size_t count)
+{
+    // Same values, in the same order, as count calls to rng_uniform()
+    uint64_t s[4] = { rng->s[0], rng->s[1], rng->s[2], rng->s[3] };
+    INSTRUMENT_COUNT(RNG_DRAWS, count);
+    for (size_t i = 0; i < count; i++)
+    {
+        out[i] = ((_rng_step(s) >> 11) + 0.5) * 0x1.0p-53;
+    }
+    memcpy(rng->s, s, sizeof(s));
+}
+
+static void _rng_apply_jump(rng_t* rng, const uint64_t jump[4])
+{
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        for (int b = 0; b < 64; b++)
+        {
+            if (jump[i] & (1ULL << b))
+            {
+                s0 ^= rng->s[0];
+                s1 ^= rng->s[1];
+                s2 ^= rng->s[2];
+                s3 ^= rng->s[3];
+            }
+            rng_next(rng);
+        }
+    }
+    rng->s[0] = s0;
+    rng->s[1] = s1;
+    rng->s[2] = s2;
+    rng->s[3] = s3;
+}
+
+void rng_jump(rng_t* rng)
+{
+    static const uint64_t jump[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                     0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+    _rng_apply_jump(rng, jump);
+}
+
+void rng_stream(rng_t* rng, uint64_t seed, uint64_t stream)
+{
+    rng_seed(rng, seed);
+    for (uint64_t i = 0; i < stream; i++)
+    {
+        rng_jump(rng);
+    }
+}
+
+void rng_save(const rng_t* rng, uint8_t state[RNG_STATE_BYTES])
+{
+    // Little endian whatever the host, so saved state moves between machines
+    for (int i = 0; i < 4; i++)
+    {
+        for (int b = 0; b < 8; b++)
+        {
+            state[8 * i + b] = (uint8_t)(rng->s[i] >> (8 * b));
+        }
+    }
+}
+
+int rng_restore(rng_t* rng, const uint8_t state[RNG_STATE_BYTES])
+{
+    uint64_t any = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        rng->s[i] = 0;
+        for (int b = 0; b < 8; b++)
+        {
+            rng->s[i] |= (uint64_t)state[8 * i + b] << (8 * b);
+        }
+        any |= rng->s[i];
+    }
+    // The all zero state is a fixed point, never a saved one
+    return any ? 0 : -1;
+}
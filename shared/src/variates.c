@@ -0,0 +1,181 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "variates.h"
+
+
+// Below n·p of this the CDF is walked by inversion, above it BTPE is used
+#define VARIATES_BINOMIAL_INVERSION_THRESHOLD   30.0
+
+
+static uint32_t _variates_binomial_inversion(rng_t* rng, uint32_t n, double p)
+{
+    // Walk the pmf up from k = 0 with f(k) = f(k-1) · (n-k+1)/k · p/q.
+    // The bound restarts the walk should round-off leave u above the tail.
+    double q = 1.0 - p;
+    double qn = exp(n * log(q));
+    double np = n * p;
+    double bound = fmin(n, np + 10.0 * sqrt(np * q + 1.0));
+
+    uint32_t x = 0;
+    double px = qn;
+    double u = rng_uniform(rng);
+    while (u > px)
+    {
+        x++;
+        if (x > bound)
+        {
+            x = 0;
+            px = qn;
+            u = rng_uniform(rng);
+        }
+        else
+        {
+            u -= px;
+            px = ((n - x + 1) * p * px) / (x * q);
+        }
+    }
+    return x;
+}
+
+static double _variates_stirling_correction(double x)
+{
+    // 1/12x - 1/360x^3 + 1/1260x^5 - 1/1680x^7 + 1/1188x^9
+    double x2 = x * x;
+    return (13860. - (462. - (132. - (99. - 140. / x2) / x2) / x2) / x2) / x / 166320.;
+}
+
+static uint32_t _variates_binomial_btpe(rng_t* rng, uint32_t n, double p)
+{
+    // Kachitvichyanukul & Schmeiser (1988) triangle / parallelogram /
+    // exponential rejection, for p <= 0.5 and n·p above the inversion threshold
+    double q = 1.0 - p;
+    double npq = n * p * q;
+    double fm = n * p + p;
+    int64_t m = (int64_t)floor(fm);
+    double p1 = floor(2.195 * sqrt(npq) - 4.6 * q) + 0.5;
+    double xm = m + 0.5;
+    double xl = xm - p1;
+    double xr = xm + p1;
+    double c = 0.134 + 20.5 / (15.3 + m);
+    double a = (fm - xl) / (fm - xl * p);
+    double laml = a * (1.0 + a / 2.0);
+    a = (xr - fm) / (xr * q);
+    double lamr = a * (1.0 + a / 2.0);
+    double p2 = p1 * (1.0 + 2.0 * c);
+    double p3 = p2 + c / laml;
+    double p4 = p3 + c / lamr;
+
+    int64_t y;
+    for (;;)
+    {
+        double u = rng_uniform(rng) * p4;
+        double v = rng_uniform(rng);
+
+        // Triangular centre, always accepted
+        if (u <= p1)
+        {
+            y = (int64_t)floor(xm - p1 * v + u);
+            break;
+        }
+
+        if (u <= p2)
+        {
+            // Parallelograms either side of the triangle
+            double x = xl + (u - p1) / c;
+            v = v * c + 1.0 - fabs(m - x + 0.5) / p1;
+            if (v > 1.0)
+                continue;
+            y = (int64_t)floor(x);
+        }
+        else if (u <= p3)
+        {
+            // Left exponential tail
+            y = (int64_t)floor(xl + log(v) / laml);
+            if (y < 0)
+                continue;
+            v = v * (u - p2) * laml;
+        }
+        else
+        {
+            // Right exponential tail
+            y = (int64_t)floor(xr - log(v) / lamr);
+            if (y > n)
+                continue;
+            v = v * (u - p3) * lamr;
+        }
+
+        int64_t k = llabs(y - m);
+        if (k <= 20 || k >= npq / 2.0 - 1)
+        {
+            // Close to the mode f(y)/f(m) is cheap to evaluate exactly
+            double s = p / q;
+            double as = s * (n + 1);
+            double f = 1.0;
+            if (m < y)
+            {
+                for (int64_t i = m + 1; i <= y; i++)
+                    f *= (as / i - s);
+            }
+            else if (m > y)
+            {
+                for (int64_t i = y + 1; i <= m; i++)
+                    f /= (as / i - s);
+            }
+            if (v > f)
+                continue;
+            break;
+        }
+
+        // Squeeze on log(f(y)/f(m)) before falling back to Stirling's bound
+        double rho = (k / npq) * ((k * (k / 3.0 + 0.625) + 0.16666666666666666) / npq + 0.5);
+        double t = -(double)k * k / (2.0 * npq);
+        double alv = log(v);
+        if (alv < t - rho)
+            break;
+        if (alv > t + rho)
+            continue;
+
+        double x1 = y + 1;
+        double f1 = m + 1;
+        double z = n + 1 - m;
+        double w = n - y + 1;
+        double bound = xm * log(f1 / x1)
+                     + (n - m + 0.5) * log(z / w)
+                     + (y - m) * log(w * p / (x1 * q))
+                     + _variates_stirling_correction(f1)
+                     + _variates_stirling_correction(z)
+                     + _variates_stirling_correction(x1)
+                     + _variates_stirling_correction(w);
+        if (alv > bound)
+            continue;
+        break;
+    }
+    return (uint32_t)y;
+}
+
+uint32_t variates_binomial(rng_t* rng, uint32_t n, double p)
+{
+    if (n == 0 || p <= 0.0)
+    {
+        return 0;
+    }
+    if (p >= 1.0)
+    {
+        return n;
+    }
+
+    // Both samplers want p <= 0.5, reflect for the upper half
+    double r = (p <= 0.5) ? p : 1.0 - p;
+    uint32_t x;
+    if (n * r < VARIATES_BINOMIAL_INVERSION_THRESHOLD)
+    {
+        x = _variates_binomial_inversion(rng, n, r);
+    }
+    else
+    {
+        x = _variates_binomial_btpe(rng, n, r);
+    }
+    return (p <= 0.5) ? x : n - x;
+}